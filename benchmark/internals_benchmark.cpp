@@ -0,0 +1,488 @@
+// Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+//
+// This file is part of the heyoka.py library.
+//
+// This Source Code Form is subject to the terms of the Mozilla
+// Public License v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+// Microbenchmarks for heyoka.py's internal routines.
+//
+// This program embeds the Python interpreter and runs, from a varying number
+// of threads, the NumPy memory handler (numpy_memory.cpp), the ufunc inner loops
+// of the real type (expose_real.cpp), the array helpers from common_utils.cpp
+// and the pickling wrappers (pickle_wrappers.hpp). The internal sources are compiled
+// directly into the executable, so that the routines which do not require the GIL
+// can be invoked without going through Python.
+//
+// Usage: internals_benchmark [output.json]
+//
+// The results are written in JSON format to the file passed as first
+// argument, or to the standard output if no argument is provided.
+
+#include <heyoka/config.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <pybind11/embed.h>
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+#define PY_ARRAY_UNIQUE_SYMBOL heyoka_py_ARRAY_API
+#define PY_UFUNC_UNIQUE_SYMBOL heyoka_py_UFUNC_API
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+
+#include <Python.h>
+#include <numpy/arrayobject.h>
+#include <numpy/ufuncobject.h>
+
+#include <heyoka/nbody.hpp>
+#include <heyoka/taylor.hpp>
+
+#include "common_utils.hpp"
+#include "expose_real.hpp"
+#include "expose_real128.hpp"
+#include "numpy_memory.hpp"
+#include "pickle_wrappers.hpp"
+
+namespace py = pybind11;
+namespace hey = heyoka;
+namespace heypy = heyoka_py;
+
+using ta_t = hey::taylor_adaptive<double>;
+
+// NOTE: the embedded module hosts the types used in the benchmarks. It is
+// populated with the real/real128 types (which also installs the custom NumPy
+// memory handler) and with a minimal exposition of the scalar integrator.
+PYBIND11_EMBEDDED_MODULE(heyoka_py_bench, m)
+{
+    heypy::expose_real128(m);
+    heypy::expose_real(m);
+
+    py::class_<ta_t>(m, "taylor_adaptive", py::dynamic_attr{});
+}
+
+namespace
+{
+
+// Helper to import the NumPy API bits.
+bool import_numpy()
+{
+    import_array1(false);
+
+    import_umath1(false);
+
+    return true;
+}
+
+// The result of a benchmark.
+struct bench_result {
+    std::string name;
+    unsigned nthreads;
+    // Number of operations per thread.
+    std::size_t n_ops;
+    // Wall-clock time per operation in nanoseconds
+    // (median and minimum over the repetitions).
+    double median_ns;
+    double min_ns;
+};
+
+// Run f(thread_idx, n_ops) concurrently on nthreads threads, nreps times, and
+// collect the timings. If with_python is true, each thread will be associated to
+// a Python thread state before the timing starts, so that f can acquire the GIL
+// without paying for the creation of the thread state.
+// NOTE: the caller must not be holding the GIL.
+template <typename F>
+bench_result run_bench(std::string name, unsigned nthreads, std::size_t n_ops, unsigned nreps, bool with_python,
+                       const F &f)
+{
+    std::vector<double> timings;
+
+    for (unsigned r = 0; r < nreps; ++r) {
+        std::atomic<unsigned> n_ready(0);
+        std::atomic<bool> go(false);
+
+        std::exception_ptr eptr;
+        std::mutex eptr_mutex;
+
+        std::vector<std::thread> threads;
+        threads.reserve(nthreads);
+
+        for (unsigned i = 0; i < nthreads; ++i) {
+            threads.emplace_back([&, i]() {
+                auto runner = [&]() {
+                    ++n_ready;
+
+                    while (!go.load()) {
+                        std::this_thread::yield();
+                    }
+
+                    try {
+                        f(i, n_ops);
+                    } catch (...) {
+                        std::lock_guard lock(eptr_mutex);
+                        eptr = std::current_exception();
+                    }
+                };
+
+                if (with_python) {
+                    // NOTE: acquire and immediately release the GIL, so that
+                    // the thread state stays alive while f() is running.
+                    py::gil_scoped_acquire gil_acq;
+                    py::gil_scoped_release gil_rel;
+
+                    runner();
+                } else {
+                    runner();
+                }
+            });
+        }
+
+        while (n_ready.load() != nthreads) {
+            std::this_thread::yield();
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        go.store(true);
+        for (auto &t : threads) {
+            t.join();
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        if (eptr) {
+            std::rethrow_exception(eptr);
+        }
+
+        timings.push_back(std::chrono::duration<double, std::nano>(end - start).count()
+                          / static_cast<double>(n_ops));
+    }
+
+    std::sort(timings.begin(), timings.end());
+
+    return bench_result{std::move(name), nthreads, n_ops, timings[timings.size() / 2u], timings[0]};
+}
+
+// Fetch the NumPy memory handler currently in use,
+// checking that it is heyoka.py's custom one.
+PyDataMem_Handler *get_mem_handler()
+{
+    auto cap = py::reinterpret_steal<py::object>(PyDataMem_GetHandler());
+    if (!cap) {
+        throw py::error_already_set();
+    }
+
+    auto *handler = static_cast<PyDataMem_Handler *>(PyCapsule_GetPointer(cap.ptr(), "mem_handler"));
+    if (handler == nullptr) {
+        throw py::error_already_set();
+    }
+
+    if (std::string(handler->name) != "npy_custom_allocator") {
+        throw std::runtime_error(
+            fmt::format("The custom NumPy memory handler is not installed (the current handler is '{}')",
+                        handler->name));
+    }
+
+    // NOTE: the handler is a global variable in numpy_memory.cpp,
+    // thus it is ok to return a pointer to it.
+    return handler;
+}
+
+// Thread counts to be benchmarked: the powers of 2
+// up to the hardware concurrency, and the hardware concurrency itself.
+std::vector<unsigned> thread_counts()
+{
+    const auto hc = std::max(std::thread::hardware_concurrency(), 1u);
+
+    std::vector<unsigned> retval;
+    for (unsigned n = 1; n < hc; n *= 2u) {
+        retval.push_back(n);
+    }
+    retval.push_back(hc);
+
+    return retval;
+}
+
+void write_json(std::ostream &os, const std::vector<bench_result> &results, const std::string &numpy_version)
+{
+    os << "{\n";
+    os << fmt::format("  \"python_version\": \"{}\",\n", PY_VERSION);
+    os << fmt::format("  \"numpy_version\": \"{}\",\n", numpy_version);
+    os << fmt::format("  \"free_threaded\": {},\n",
+#if defined(Py_GIL_DISABLED)
+                      true
+#else
+                      false
+#endif
+    );
+    os << fmt::format("  \"hardware_concurrency\": {},\n", std::thread::hardware_concurrency());
+    os << "  \"benchmarks\": [\n";
+
+    for (decltype(results.size()) i = 0; i < results.size(); ++i) {
+        const auto &r = results[i];
+
+        os << fmt::format("    {{\"name\": \"{}\", \"nthreads\": {}, \"ops_per_thread\": {}, "
+                          "\"median_ns_per_op\": {}, \"min_ns_per_op\": {}, \"throughput_ops_per_s\": {}}}{}\n",
+                          r.name, r.nthreads, r.n_ops, r.median_ns, r.min_ns, r.nthreads * 1e9 / r.median_ns,
+                          i + 1u == results.size() ? "" : ",");
+    }
+
+    os << "  ]\n}\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    py::scoped_interpreter guard;
+
+    if (!import_numpy()) {
+        PyErr_Print();
+        return 1;
+    }
+
+    try {
+        auto np = py::module_::import("numpy");
+        auto bm = py::module_::import("heyoka_py_bench");
+
+        const auto tcounts = thread_counts();
+        const auto max_threads = tcounts.back();
+        constexpr unsigned nreps = 7;
+
+        std::vector<bench_result> results;
+
+        // Helper to run a benchmark for all thread counts,
+        // logging the progress on stderr.
+        auto run_all = [&](const std::string &name, std::size_t n_ops, bool with_python, const auto &f) {
+            // NOTE: the threads spawned by run_bench() must be able
+            // to acquire the GIL.
+            py::gil_scoped_release gil_rel;
+
+            for (auto nt : tcounts) {
+                results.push_back(run_bench(name, nt, n_ops, nreps, with_python, f));
+
+                const auto &r = results.back();
+                std::cerr << fmt::format("{:<40} threads: {:>3}  median: {:>12.1f} ns/op  min: {:>12.1f} ns/op\n",
+                                         r.name, r.nthreads, r.median_ns, r.min_ns);
+            }
+        };
+
+        // The NumPy memory handler.
+        auto *mh = get_mem_handler();
+        auto *const mh_ctx = mh->allocator.ctx;
+
+        for (const std::size_t sz : {64u, 4096u}) {
+            run_all(fmt::format("numpy_custom_malloc_free/{}", sz), 100000, false,
+                    [mh, mh_ctx, sz](unsigned, std::size_t n_ops) {
+                        for (std::size_t i = 0; i < n_ops; ++i) {
+                            auto *p = mh->allocator.malloc(mh_ctx, sz);
+                            if (p == nullptr) {
+                                throw std::bad_alloc();
+                            }
+                            mh->allocator.free(mh_ctx, p, sz);
+                        }
+                    });
+        }
+
+        {
+            // Populate the memory map with a number of live buffers,
+            // and look up random addresses within them.
+            constexpr std::size_t nbufs = 10000, buf_size = 256;
+
+            std::vector<unsigned char *> bufs;
+            bufs.reserve(nbufs);
+            for (std::size_t i = 0; i < nbufs; ++i) {
+                auto *p = static_cast<unsigned char *>(mh->allocator.malloc(mh_ctx, buf_size));
+                if (p == nullptr) {
+                    throw std::bad_alloc();
+                }
+                bufs.push_back(p);
+            }
+
+            run_all("get_memory_metadata/hit", 100000, false, [&bufs](unsigned tidx, std::size_t n_ops) {
+                // NOTE: simple LCG to pick the addresses.
+                std::uint64_t state = tidx + 1u;
+
+                for (std::size_t i = 0; i < n_ops; ++i) {
+                    state = state * 6364136223846793005ull + 1442695040888963407ull;
+                    const auto idx = static_cast<std::size_t>((state >> 33) % nbufs);
+
+                    const auto [base, meta] = heypy::get_memory_metadata(bufs[idx] + (i % buf_size));
+                    if (base != bufs[idx] || meta == nullptr) {
+                        throw std::runtime_error("Inconsistent memory metadata detected");
+                    }
+                }
+            });
+
+            run_all("get_memory_metadata/miss", 100000, false, [](unsigned, std::size_t n_ops) {
+                const unsigned char local = 0;
+
+                for (std::size_t i = 0; i < n_ops; ++i) {
+                    if (heypy::get_memory_metadata(&local).second != nullptr) {
+                        throw std::runtime_error("Inconsistent memory metadata detected");
+                    }
+                }
+            });
+
+            for (auto *p : bufs) {
+                mh->allocator.free(mh_ctx, p, buf_size);
+            }
+        }
+
+        // The array helpers from common_utils.cpp.
+        // NOTE: the arrays are created (and destroyed) by the main thread
+        // while holding the GIL, one set per benchmark thread.
+        {
+            std::vector<py::array> arrs, views;
+            for (unsigned i = 0; i < max_threads; ++i) {
+                arrs.push_back(np.attr("zeros")(py::make_tuple(10, 10)).cast<py::array>());
+                views.push_back(arrs.back()
+                                    .attr("__getitem__")(py::make_tuple(py::slice(0, 10, 2), py::slice(0, 10, 1)))
+                                    .cast<py::array>());
+            }
+
+            run_all("may_share_memory", 10000, true, [&arrs, &views](unsigned tidx, std::size_t n_ops) {
+                for (std::size_t i = 0; i < n_ops; ++i) {
+                    py::gil_scoped_acquire gil;
+
+                    if (!heypy::may_share_memory(arrs[tidx], views[tidx])) {
+                        throw std::runtime_error("may_share_memory() returned an unexpected value");
+                    }
+                }
+            });
+
+            run_all("is_npy_array_carray", 100000, true, [&arrs, &views](unsigned tidx, std::size_t n_ops) {
+                for (std::size_t i = 0; i < n_ops; ++i) {
+                    py::gil_scoped_acquire gil;
+
+                    if (!heypy::is_npy_array_carray(arrs[tidx], true) || heypy::is_npy_array_carray(views[tidx])) {
+                        throw std::runtime_error("is_npy_array_carray() returned an unexpected value");
+                    }
+                }
+            });
+
+            arrs.clear();
+            views.clear();
+        }
+
+#if defined(HEYOKA_HAVE_REAL)
+
+        // The ufunc inner loops of the real type.
+        {
+            constexpr std::size_t arr_size = 1000;
+
+            auto real_t = bm.attr("real");
+            auto val = real_t("1.1", 128);
+
+            std::vector<py::object> a_arrs, b_arrs, out_arrs;
+            for (unsigned i = 0; i < max_threads; ++i) {
+                a_arrs.push_back(np.attr("full")(arr_size, val, py::arg("dtype") = real_t));
+                b_arrs.push_back(np.attr("full")(arr_size, val, py::arg("dtype") = real_t));
+                out_arrs.push_back(np.attr("full")(arr_size, val, py::arg("dtype") = real_t));
+            }
+
+            for (const auto *uf_name : {"add", "multiply"}) {
+                auto uf = np.attr(uf_name);
+
+                run_all(fmt::format("real_ufunc_{}/{}", uf_name, arr_size), 1000, true,
+                        [&](unsigned tidx, std::size_t n_ops) {
+                            for (std::size_t i = 0; i < n_ops; ++i) {
+                                py::gil_scoped_acquire gil;
+
+                                uf(a_arrs[tidx], b_arrs[tidx], py::arg("out") = out_arrs[tidx]);
+                            }
+                        });
+            }
+
+            for (const auto *uf_name : {"sqrt", "sin"}) {
+                auto uf = np.attr(uf_name);
+
+                run_all(fmt::format("real_ufunc_{}/{}", uf_name, arr_size), 100, true,
+                        [&](unsigned tidx, std::size_t n_ops) {
+                            for (std::size_t i = 0; i < n_ops; ++i) {
+                                py::gil_scoped_acquire gil;
+
+                                uf(a_arrs[tidx], py::arg("out") = out_arrs[tidx]);
+                            }
+                        });
+            }
+
+            // NOTE: the creation of arrays from scratch exercises
+            // the construction tracking in the memory handler.
+            run_all(fmt::format("real_array_alloc/{}", arr_size), 1000, true,
+                    [&](unsigned tidx, std::size_t n_ops) {
+                        for (std::size_t i = 0; i < n_ops; ++i) {
+                            py::gil_scoped_acquire gil;
+
+                            (void)np.attr("empty_like")(a_arrs[tidx]);
+                        }
+                    });
+
+            a_arrs.clear();
+            b_arrs.clear();
+            out_arrs.clear();
+        }
+
+#endif
+
+        // The pickling wrappers.
+        {
+            std::vector<double> init_state;
+            for (unsigned i = 0; i < 3u; ++i) {
+                init_state.insert(init_state.end(), {static_cast<double>(i), 1., 0., 0., 0.5, 0.});
+            }
+
+            const ta_t ta(hey::make_nbody_sys(3), init_state);
+
+            std::vector<py::object> tas;
+            for (unsigned i = 0; i < max_threads; ++i) {
+                tas.push_back(py::cast(ta));
+            }
+
+            run_all("pickle_getstate_wrapper/taylor_adaptive", 100, true, [&tas](unsigned tidx, std::size_t n_ops) {
+                for (std::size_t i = 0; i < n_ops; ++i) {
+                    py::gil_scoped_acquire gil;
+
+                    (void)heypy::pickle_getstate_wrapper<ta_t>(tas[tidx]);
+                }
+            });
+
+            tas.clear();
+        }
+
+        const auto numpy_version = py::str(np.attr("__version__")).cast<std::string>();
+
+        if (argc > 1) {
+            std::ofstream ofs(argv[1]);
+            if (!ofs) {
+                throw std::runtime_error(fmt::format("Cannot open the output file '{}'", argv[1]));
+            }
+            write_json(ofs, results, numpy_version);
+        } else {
+            write_json(std::cout, results, numpy_version);
+        }
+    } catch (py::error_already_set &eas) {
+        std::cerr << eas.what() << std::endl;
+        return 1;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
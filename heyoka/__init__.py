@@ -18,7 +18,6 @@ from . import test
 from ._version import __version__
 
 import os as _os
-import cloudpickle as _cloudpickle
 from threading import Lock as _Lock
 
 if _os.name == "posix":
@@ -110,6 +109,17 @@ def taylor_adaptive(sys, state, **kwargs):
     return getattr(core, "taylor_adaptive{}".format(fp_suffix))(sys, state, **kwargs)
 
 
+def taylor_adaptive_tiered(sys, state, **kwargs):
+    from . import core
+
+    fp_type = kwargs.pop("fp_type", float)
+    fp_suffix = _fp_to_suffix(fp_type)
+
+    return getattr(core, "taylor_adaptive_tiered{}".format(fp_suffix))(
+        sys, state, **kwargs
+    )
+
+
 def taylor_adaptive_batch(sys, state, **kwargs):
     from . import core
 
@@ -227,13 +237,17 @@ def from_sympy(ex, s_dict={}):
 
 
 # Machinery for the setup of the serialization backend.
+# NOTE: the serialization backends are imported lazily
+# on first use, so that importing heyoka does not
+# import cloudpickle.
 
 # Helper to create dicts mapping a name to a serialization backend
 # and vice-versa.
 def _make_s11n_backend_maps():
     import pickle
+    import cloudpickle
 
-    ret = {"cloudpickle": _cloudpickle, "pickle": pickle}
+    ret = {"cloudpickle": cloudpickle, "pickle": pickle}
 
     try:
         import dill
@@ -247,15 +261,35 @@ def _make_s11n_backend_maps():
     return ret, inv
 
 
-_s11n_backend_map, _s11n_backend_inv_map = _make_s11n_backend_maps()
+# The backend maps and the currently active s11n backend.
+# They are set up by _init_s11n_backend().
+_s11n_backend_map = None
+_s11n_backend_inv_map = None
+_s11n_backend = None
 
-# The currently active s11n backend.
-_s11n_backend = _cloudpickle
-
-# Lock to protect access to _s11n_backend.
+# Lock to protect access to the variables above.
 _s11n_backend_mutex = _Lock()
 
 
+# Helper to set up the s11n backend machinery, if needed.
+# NOTE: this must be called with _s11n_backend_mutex held.
+def _init_s11n_backend():
+    global _s11n_backend_map, _s11n_backend_inv_map, _s11n_backend
+
+    if _s11n_backend_map is None:
+        _s11n_backend_map, _s11n_backend_inv_map = _make_s11n_backend_maps()
+
+        # The default backend.
+        _s11n_backend = _s11n_backend_map["cloudpickle"]
+
+
+def _get_s11n_backend_maps():
+    with _s11n_backend_mutex:
+        _init_s11n_backend()
+
+        return _s11n_backend_map, _s11n_backend_inv_map
+
+
 def set_serialization_backend(name):
     global _s11n_backend
 
@@ -266,21 +300,23 @@ def set_serialization_backend(name):
             )
         )
 
-    if not name in _s11n_backend_map:
-        raise ValueError(
-            "The serialization backend '{}' is not valid. The valid backends are: {}".format(
-                name, list(_s11n_backend_map.keys())
-            )
-        )
+    with _s11n_backend_mutex:
+        _init_s11n_backend()
 
-    new_backend = _s11n_backend_map[name]
+        if not name in _s11n_backend_map:
+            raise ValueError(
+                "The serialization backend '{}' is not valid. The valid backends are: {}".format(
+                    name, list(_s11n_backend_map.keys())
+                )
+            )
 
-    with _s11n_backend_mutex:
-        _s11n_backend = new_backend
+        _s11n_backend = _s11n_backend_map[name]
 
 
 def get_serialization_backend():
     with _s11n_backend_mutex:
+        _init_s11n_backend()
+
         return _s11n_backend
 
 
@@ -328,19 +364,43 @@ def _ensemble_propagate_generic(tp, ta, arg, n_iter, gen, **kwargs):
             'Cannot perform an ensemble propagate_until/for/grid(): the "max_delta_t" argument must be a scalar, not an iterable object'
         )
 
+    # Optional sink for the results of propagate_grid().
+    sink = kwargs.pop("sink", None)
+    sink_format = kwargs.pop("sink_format", "npy")
+
+    if sink is not None:
+        if tp != "grid":
+            raise ValueError(
+                "The 'sink' argument can be used only in ensemble propagate_grid()"
+            )
+
+        from ._grid_sink import _make_grid_sink
+
+        sink = _make_grid_sink(sink, sink_format)
+
     # Parallelisation algorithm.
     algo = kwargs.pop("algorithm", "thread")
-    allowed_algos = ["thread", "process"]
+    allowed_algos = ["thread", "process", "mpi"]
+
+    if "reuse_integrators" in kwargs and algo != "thread":
+        raise ValueError(
+            "The 'reuse_integrators' argument can be used only with the 'thread' parallelisation algorithm"
+        )
 
     if algo == "thread":
         from ._ensemble_impl import _ensemble_propagate_thread
 
-        return _ensemble_propagate_thread(tp, ta, arg, n_iter, gen, **kwargs)
+        return _ensemble_propagate_thread(tp, ta, arg, n_iter, gen, sink, **kwargs)
 
     if algo == "process":
         from ._ensemble_impl import _ensemble_propagate_process
 
-        return _ensemble_propagate_process(tp, ta, arg, n_iter, gen, **kwargs)
+        return _ensemble_propagate_process(tp, ta, arg, n_iter, gen, sink, **kwargs)
+
+    if algo == "mpi":
+        from ._ensemble_impl import _ensemble_propagate_mpi
+
+        return _ensemble_propagate_mpi(tp, ta, arg, n_iter, gen, sink, **kwargs)
 
     raise ValueError(
         "The parallelisation algorithm must be one of {}, but '{}' was provided instead".format(
@@ -373,6 +433,112 @@ def ensemble_propagate_grid_batch(ta, grid, n_iter, gen, **kwargs):
     return _ensemble_propagate_generic("grid", ta, grid, n_iter, gen, **kwargs)
 
 
+def propagate_grid_chunked(
+    ta, grid, sink, chunk_size=1024, sink_format="npy", **kwargs
+):
+    from ._grid_sink import _propagate_grid_chunked
+
+    return _propagate_grid_chunked(ta, grid, sink, sink_format, chunk_size, **kwargs)
+
+
+# Helpers for the integrators of the ODE systems
+# returned by make_variational_sys().
+def variational_ic(ic, stm=True, npars=0):
+    import numpy as np
+
+    ic = np.asarray(ic)
+
+    if ic.ndim not in (1, 2):
+        raise ValueError(
+            "The initial conditions must be a one-dimensional (scalar mode) or two-dimensional (batch mode) array, but an array with {} dimensions was provided instead".format(
+                ic.ndim
+            )
+        )
+
+    n = ic.shape[0]
+    batch_shape = ic.shape[1:]
+
+    parts = [ic]
+
+    if stm:
+        # The state transition matrix is initially the identity.
+        eye = np.eye(n, dtype=ic.dtype).reshape((n * n,) + (1,) * len(batch_shape))
+        parts.append(np.broadcast_to(eye, (n * n,) + batch_shape))
+
+    # The sensitivities with respect to the parameters are initially zero.
+    parts.append(np.zeros((n * npars,) + batch_shape, dtype=ic.dtype))
+
+    return np.concatenate(parts)
+
+
+def stm_view(ta, n):
+    st = ta.state
+
+    if st.shape[0] < n + n * n:
+        raise ValueError(
+            "The state vector of the integrator is too short to contain the state transition matrix of a system with {} state variables".format(
+                n
+            )
+        )
+
+    # NOTE: this is a view on the state vector
+    # of the integrator, no copy is performed.
+    return st[n : n + n * n].reshape((n, n) + st.shape[1:])
+
+
+def sens_view(ta, n, npars, stm=True):
+    st = ta.state
+
+    off = n + (n * n if stm else 0)
+
+    if st.shape[0] < off + n * npars:
+        raise ValueError(
+            "The state vector of the integrator is too short to contain the sensitivities of a system with {} state variables with respect to {} parameter(s)".format(
+                n, npars
+            )
+        )
+
+    # NOTE: this is a view on the state vector
+    # of the integrator, no copy is performed.
+    return st[off : off + n * npars].reshape((n, npars) + st.shape[1:])
+
+
+def fit_lm(
+    sys,
+    state,
+    grid,
+    obs,
+    pars=None,
+    fit_state=True,
+    fit_pars=None,
+    obs_idx=None,
+    weights=None,
+    max_iter=100,
+    xtol=1e-10,
+    ftol=1e-12,
+    lambda0=1e-3,
+    **kwargs
+):
+    from ._fit import _fit_lm
+
+    return _fit_lm(
+        sys,
+        state,
+        grid,
+        obs,
+        pars,
+        fit_state,
+        fit_pars,
+        obs_idx,
+        weights,
+        max_iter,
+        xtol,
+        ftol,
+        lambda0,
+        **kwargs
+    )
+
+
 def _real_reduce_factory():
     # Internal factory function used in the implementation
     # of the pickle protocol for real.
@@ -6,6 +6,9 @@
 # Public License v. 2.0. If a copy of the MPL was not distributed
 # with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
+from ._grid_sink import _sink_grid_result
+
+
 # NOTE: this is a small helper to splat a 1D grid into the
 # appropriate shape for a batch integrator. If ta is a scalar integrator,
 # the original grid will be returned unchanged.
@@ -18,18 +21,66 @@ def _splat_grid(arg, ta):
         return arg
 
 
+# Helper to reset the mutable state of the integrator
+# local_ta (time, state, parameters and event cooldowns)
+# to the state of the integrator ta.
+# NOTE: the time is copied in double-length format,
+# so that no precision is lost.
+def _resync_ta(local_ta, ta):
+    if hasattr(local_ta, "batch_size"):
+        local_ta.set_dtime(*ta.dtime)
+    else:
+        local_ta.dtime = ta.dtime
+
+    local_ta.state[:] = ta.state
+    local_ta.pars[:] = ta.pars
+    local_ta.reset_cooldowns()
+
+
+# Helper to check if the integrator ta has events with callbacks.
+def _has_event_callbacks(ta):
+    return len(ta.nt_events) > 0 or any(ev.callback is not None for ev in ta.t_events)
+
+
 # Thread-based implementation.
-def _ensemble_propagate_thread(tp, ta, arg, n_iter, gen, **kwargs):
+def _ensemble_propagate_thread(tp, ta, arg, n_iter, gen, sink, **kwargs):
     from concurrent.futures import ThreadPoolExecutor
     from copy import deepcopy
+    import threading
 
     # Pop the multithreading options from kwargs.
     max_workers = kwargs.pop("max_workers", None)
+    reuse_integrators = kwargs.pop("reuse_integrators", False)
+
+    # NOTE: when reusing the integrators, the event callbacks
+    # would be shared across the iterations run by the same thread,
+    # and any state stored in them would leak from one iteration
+    # to the next. Hence, disallow reuse in presence of event callbacks.
+    if reuse_integrators and _has_event_callbacks(ta):
+        raise ValueError(
+            "The 'reuse_integrators' argument cannot be used with integrators whose events have callbacks"
+        )
+
+    # Thread-local storage for the integrators
+    # reused across the iterations.
+    tls = threading.local()
 
     # The worker function.
     def func(i):
         # Create the local integrator.
-        local_ta = gen(deepcopy(ta), i)
+        if reuse_integrators:
+            # NOTE: copy ta only the first time
+            # this thread runs an iteration. In the
+            # subsequent iterations, the copy is reset to
+            # the state of ta.
+            if not hasattr(tls, "ta"):
+                tls.ta = deepcopy(ta)
+            else:
+                _resync_ta(tls.ta, ta)
+
+            local_ta = gen(tls.ta, i)
+        else:
+            local_ta = gen(deepcopy(ta), i)
 
         # Run the propagation.
         if tp == "until":
@@ -37,15 +88,26 @@ def _ensemble_propagate_thread(tp, ta, arg, n_iter, gen, **kwargs):
         elif tp == "for":
             loc_ret = local_ta.propagate_for(arg, **kwargs)
         else:
-            loc_ret = local_ta.propagate_grid(_splat_grid(arg, ta), **kwargs)
+            grid = _splat_grid(arg, ta)
+            loc_ret = local_ta.propagate_grid(grid, **kwargs)
+
+            # Write the results into the sink, if requested.
+            if sink is not None:
+                loc_ret = _sink_grid_result(
+                    sink, "member_{:08d}".format(i), grid, loc_ret
+                )
+
+        # NOTE: if the integrators are reused, they cannot
+        # be returned. Return a copy of the final state instead.
+        ta_ret = local_ta.state.copy() if reuse_integrators else local_ta
 
         # Return the results.
         # NOTE: in batch mode, loc_ret will be single
         # value rather than a tuple, hence the branch.
         if isinstance(loc_ret, tuple):
-            return (local_ta,) + loc_ret
+            return (ta_ret,) + loc_ret
         else:
-            return (local_ta, loc_ret)
+            return (ta_ret, loc_ret)
 
     with ThreadPoolExecutor(max_workers=max_workers) as executor:
         ret = list(executor.map(func, range(n_iter)))
@@ -55,13 +117,13 @@ def _ensemble_propagate_thread(tp, ta, arg, n_iter, gen, **kwargs):
 
 # The worker function used in the multiprocessing implementation.
 def _mp_propagate(tup):
-    from . import _s11n_backend_map
+    from . import _get_s11n_backend_maps
 
-    tp, ta, gen, arg, kwargs, i, s11n_str = tup
+    tp, ta, gen, arg, kwargs, i, s11n_str, sink = tup
 
     # Fetch the s11n backend from its
     # str representation.
-    s11n_be = _s11n_backend_map[s11n_str]
+    s11n_be = _get_s11n_backend_maps()[0][s11n_str]
 
     # Unpickle the other arguments.
     ta = s11n_be.loads(ta)
@@ -77,7 +139,12 @@ def _mp_propagate(tup):
     elif tp == "for":
         loc_ret = local_ta.propagate_for(arg, **kwargs)
     else:
-        loc_ret = local_ta.propagate_grid(_splat_grid(arg, ta), **kwargs)
+        grid = _splat_grid(arg, ta)
+        loc_ret = local_ta.propagate_grid(grid, **kwargs)
+
+        # Write the results into the sink, if requested.
+        if sink is not None:
+            loc_ret = _sink_grid_result(sink, "member_{:08d}".format(i), grid, loc_ret)
 
     # Return the results.
     # NOTE: in batch mode, loc_ret will be single
@@ -89,16 +156,16 @@ def _mp_propagate(tup):
 
 
 # Process-based implementation.
-def _ensemble_propagate_process(tp, ta, arg, n_iter, gen, **kwargs):
+def _ensemble_propagate_process(tp, ta, arg, n_iter, gen, sink, **kwargs):
     from concurrent.futures import ProcessPoolExecutor
     import multiprocessing as mp
-    from . import get_serialization_backend, _s11n_backend_inv_map
+    from . import get_serialization_backend, _get_s11n_backend_maps
 
     # Fetch the currently active s11n backend.
     s11n_be = get_serialization_backend()
 
     # Fetch its string counterpart.
-    s11n_str = _s11n_backend_inv_map[s11n_be]
+    s11n_str = _get_s11n_backend_maps()[1][s11n_be]
 
     # NOTE: ensure the processes are started with
     # the 'spawn' method.
@@ -120,9 +187,205 @@ def _ensemble_propagate_process(tp, ta, arg, n_iter, gen, **kwargs):
                     [s11n_be.dumps(kwargs)] * n_iter,
                     range(n_iter),
                     [s11n_str] * n_iter,
+                    [sink] * n_iter,
                 ),
                 chunksize=chunksize,
             )
         )
 
     return [s11n_be.loads(_) for _ in ret]
+
+
+# MPI message tags.
+_MPI_TAG_READY = 1
+_MPI_TAG_WORK = 2
+_MPI_TAG_RESULT = 3
+_MPI_TAG_STOP = 4
+_MPI_TAG_ERROR = 5
+
+
+# MPI-based implementation.
+# NOTE: this must be invoked collectively by all the ranks of
+# the communicator. The arguments on the root rank (rank 0) are
+# serialised and broadcast to the other ranks, which act as workers
+# and ask the root for chunks of iterations to run (dynamic load balancing).
+# Each rank deserialises the integrator once, and then resets its copy
+# at the beginning of each iteration. Only the final state vectors
+# (rather than the integrators) are sent back to the root, which
+# returns the list of results. The other ranks return None.
+# If an iteration raises an exception on a worker, the exception
+# is sent to the root, which stops the workers and re-raises it.
+def _ensemble_propagate_mpi(tp, ta, arg, n_iter, gen, sink, **kwargs):
+    from copy import deepcopy
+    from types import SimpleNamespace
+    import numpy as np
+    from . import get_serialization_backend, _get_s11n_backend_maps
+
+    try:
+        from mpi4py import MPI
+    except ImportError:
+        raise ImportError(
+            "The 'mpi' parallelisation algorithm requires the mpi4py module, which could not be imported"
+        )
+
+    # Pop the MPI options from kwargs.
+    comm = kwargs.pop("comm", None)
+    if comm is None:
+        comm = MPI.COMM_WORLD
+    chunksize = kwargs.pop("chunksize", 1)
+
+    if not isinstance(chunksize, int) or chunksize < 1:
+        raise ValueError(
+            "The chunk size must be a positive integer, but {} was provided instead".format(
+                chunksize
+            )
+        )
+
+    rank = comm.Get_rank()
+    size = comm.Get_size()
+
+    # Broadcast the name of the s11n backend in use on the root rank,
+    # and then the serialised arguments.
+    s11n_str = comm.bcast(
+        _get_s11n_backend_maps()[1][get_serialization_backend()] if rank == 0 else None,
+        root=0,
+    )
+    s11n_be = _get_s11n_backend_maps()[0][s11n_str]
+
+    # NOTE: all the arguments are taken from the root rank. The arguments
+    # passed to this function on the other ranks are ignored.
+    payload = comm.bcast(
+        s11n_be.dumps((tp, ta, arg, n_iter, gen, sink, kwargs)) if rank == 0 else None,
+        root=0,
+    )
+    tp, ta, arg, n_iter, gen, sink, kwargs = s11n_be.loads(payload)
+
+    # NOTE: ta has just been deserialised, hence it is already
+    # a private copy which can be used as the local integrator.
+    # Store its initial time, state and parameters, so that
+    # it can be reset at the beginning of each iteration.
+    # If ta has event callbacks, it is copied in each iteration
+    # instead, so that the state of the callbacks does not
+    # persist across the iterations.
+    reuse_ta = not _has_event_callbacks(ta)
+    ta_init = SimpleNamespace(
+        dtime=tuple(np.copy(_) for _ in ta.dtime)
+        if hasattr(ta, "batch_size")
+        else ta.dtime,
+        state=ta.state.copy(),
+        pars=ta.pars.copy(),
+    )
+
+    def run(i):
+        if reuse_ta:
+            _resync_ta(ta, ta_init)
+            local_ta = gen(ta, i)
+        else:
+            local_ta = gen(deepcopy(ta), i)
+
+        # Run the propagation.
+        if tp == "until":
+            loc_ret = local_ta.propagate_until(arg, **kwargs)
+        elif tp == "for":
+            loc_ret = local_ta.propagate_for(arg, **kwargs)
+        else:
+            grid = _splat_grid(arg, ta)
+            loc_ret = local_ta.propagate_grid(grid, **kwargs)
+
+            # Write the results into the sink, if requested.
+            if sink is not None:
+                loc_ret = _sink_grid_result(
+                    sink, "member_{:08d}".format(i), grid, loc_ret
+                )
+
+        # NOTE: return a copy of the final
+        # state in place of the integrator.
+        st = local_ta.state.copy()
+
+        if isinstance(loc_ret, tuple):
+            return (st,) + loc_ret
+        else:
+            return (st, loc_ret)
+
+    if size == 1:
+        # No workers, run everything on the root.
+        return [run(i) for i in range(n_iter)]
+
+    if rank == 0:
+        ret = [None] * n_iter
+        next_i = 0
+        n_workers = size - 1
+        # The first error reported by the workers, if any.
+        error = None
+
+        while n_workers > 0:
+            status = MPI.Status()
+            msg = comm.recv(source=MPI.ANY_SOURCE, tag=MPI.ANY_TAG, status=status)
+            src = status.Get_source()
+            tag = status.Get_tag()
+
+            if tag == _MPI_TAG_RESULT and error is None:
+                for i, res in s11n_be.loads(msg):
+                    ret[i] = res
+            elif tag == _MPI_TAG_ERROR and error is None:
+                error = s11n_be.loads(msg)
+
+            # NOTE: after an error, no more work is dispatched
+            # and the workers are stopped as soon as they report back.
+            if error is None and next_i < n_iter:
+                comm.send(
+                    (next_i, min(next_i + chunksize, n_iter)),
+                    dest=src,
+                    tag=_MPI_TAG_WORK,
+                )
+                next_i += chunksize
+            else:
+                comm.send(None, dest=src, tag=_MPI_TAG_STOP)
+                n_workers -= 1
+
+        if error is not None:
+            raise error
+
+        return ret
+    else:
+        comm.send(None, dest=0, tag=_MPI_TAG_READY)
+
+        # The error raised on this rank, if any.
+        error = None
+
+        while True:
+            status = MPI.Status()
+            task = comm.recv(source=0, tag=MPI.ANY_TAG, status=status)
+
+            if status.Get_tag() == _MPI_TAG_STOP:
+                break
+
+            start, end = task
+
+            try:
+                msg = s11n_be.dumps([(i, run(i)) for i in range(start, end)])
+            except Exception as e:
+                # NOTE: report the error to the root rank, which will stop
+                # the workers and re-raise it. If the exception cannot be
+                # serialised, report its string representation instead.
+                error = e
+
+                try:
+                    msg = s11n_be.dumps(e)
+                except Exception:
+                    msg = s11n_be.dumps(
+                        RuntimeError(
+                            "The ensemble propagation failed on the MPI rank {} with the exception: {}".format(
+                                rank, repr(e)
+                            )
+                        )
+                    )
+
+                comm.send(msg, dest=0, tag=_MPI_TAG_ERROR)
+            else:
+                comm.send(msg, dest=0, tag=_MPI_TAG_RESULT)
+
+        if error is not None:
+            raise error
+
+        return None
@@ -0,0 +1,224 @@
+# Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+#
+# This file is part of the heyoka.py library.
+#
+# This Source Code Form is subject to the terms of the Mozilla
+# Public License v. 2.0. If a copy of the MPL was not distributed
+# with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+# Batch nonlinear least-squares fitting.
+#
+# Each lane of a batch integrator hosts an independent fitting problem
+# (i.e., the same ODE system with different observations, initial
+# conditions and parameters). The sensitivities of the observed state
+# components with respect to the fitted quantities are computed exactly
+# via the variational equations, and the fitted quantities are updated
+# via Levenberg-Marquardt iterations. All the lanes are propagated
+# together in a single call to propagate_grid(), which runs without
+# holding the GIL, while the linear algebra is vectorised over the lanes.
+
+
+# Helper to propagate the variational integrator ta (whose lanes start
+# at the first grid point) from the initial state state and the parameters
+# pars, and to compute the cost, the weighted residuals and the weighted
+# Jacobian for each lane.
+def _fit_eval(ta, state, pars, grid, obs, sqrt_w, obs_idx, fit_state, fit_pars):
+    import numpy as np
+    from . import variational_ic, taylor_outcome
+
+    n = state.shape[0]
+    npars = len(fit_pars)
+    m = (n if fit_state else 0) + npars
+    ngrid, nobs, bs = obs.shape
+
+    ta.set_time(grid[0])
+    ta.state[:] = variational_ic(state, stm=fit_state, npars=npars)
+    ta.pars[:] = pars
+    ta.reset_cooldowns()
+
+    res = ta.propagate_grid(grid)
+
+    # Residuals.
+    r = (obs - res[:, obs_idx, :]) * sqrt_w
+
+    # Jacobian of the model with respect to the fitted quantities.
+    J = np.zeros((ngrid, nobs, m, bs))
+    off = n
+    if fit_state:
+        J[:, :, :n, :] = res[:, off : off + n * n, :].reshape((ngrid, n, n, bs))[
+            :, obs_idx
+        ]
+        off += n * n
+    if npars > 0:
+        J[:, :, m - npars :, :] = res[:, off : off + n * npars, :].reshape(
+            (ngrid, n, npars, bs)
+        )[:, obs_idx]
+    J *= sqrt_w[:, :, None, :]
+
+    cost = 0.5 * np.sum(r**2, axis=(0, 1))
+
+    # NOTE: lanes whose propagation did not reach the
+    # end of the grid have an infinite cost.
+    ok = np.array([_[0] == taylor_outcome.time_limit for _ in ta.propagate_res])
+    cost = np.where(ok & np.isfinite(cost), cost, np.inf)
+
+    return cost, r.reshape((-1, bs)), J.reshape((-1, m, bs))
+
+
+def _fit_lm(
+    sys,
+    state,
+    grid,
+    obs,
+    pars,
+    fit_state,
+    fit_pars,
+    obs_idx,
+    weights,
+    max_iter,
+    xtol,
+    ftol,
+    lambda0,
+    **kwargs
+):
+    import numpy as np
+    from . import make_variational_sys, taylor_adaptive_batch, variational_ic
+
+    state = np.array(state, dtype=float)
+    grid = np.array(grid, dtype=float)
+    obs = np.array(obs, dtype=float)
+    fit_pars = [] if fit_pars is None else list(fit_pars)
+
+    if state.ndim != 2 or state.shape[0] != len(sys):
+        raise ValueError(
+            "The initial guess for the state must be an array of shape ({}, batch_size)".format(
+                len(sys)
+            )
+        )
+
+    n, bs = state.shape
+
+    if obs_idx is None:
+        obs_idx = list(range(n))
+    obs_idx = list(obs_idx)
+
+    if grid.ndim != 2 or grid.shape[1] != bs or grid.shape[0] == 0:
+        raise ValueError(
+            "The time grid must be a non-empty array of shape (ngrid, {})".format(bs)
+        )
+
+    if obs.shape != (grid.shape[0], len(obs_idx), bs):
+        raise ValueError(
+            "The observations must be an array of shape {}, but an array of shape {} was provided instead".format(
+                (grid.shape[0], len(obs_idx), bs), obs.shape
+            )
+        )
+
+    if weights is None:
+        sqrt_w = np.ones_like(obs)
+    else:
+        weights = np.broadcast_to(np.asarray(weights, dtype=float), obs.shape)
+        if np.any(weights < 0) or not np.all(np.isfinite(weights)):
+            raise ValueError("The weights must be finite and non-negative")
+        sqrt_w = np.sqrt(weights)
+
+    if not isinstance(max_iter, int) or max_iter < 0:
+        raise ValueError(
+            "The maximum number of iterations must be a non-negative integer, but {} was provided instead".format(
+                max_iter
+            )
+        )
+
+    npars = len(fit_pars)
+    m = (n if fit_state else 0) + npars
+
+    if m > obs.shape[0] * obs.shape[1]:
+        raise ValueError(
+            "The number of fitted quantities ({}) cannot be larger than the number of observations ({})".format(
+                m, obs.shape[0] * obs.shape[1]
+            )
+        )
+
+    # Build the integrator of the variational equations.
+    vsys = make_variational_sys(sys, stm=fit_state, pars=fit_pars)
+    ta = taylor_adaptive_batch(
+        vsys,
+        variational_ic(state, stm=fit_state, npars=npars),
+        pars=np.zeros((0, bs)) if pars is None else np.array(pars, dtype=float),
+        time=grid[0],
+        **kwargs
+    )
+
+    # NOTE: fetch the parameter values from the integrator,
+    # which pads them with zeros if they are not provided.
+    pars = np.array(ta.pars)
+
+    # Helpers to pack/unpack the fitted quantities
+    # into/from an array of shape (m, bs).
+    def pack(st, ps):
+        parts = [st] if fit_state else []
+        parts.append(ps[fit_pars])
+        return np.concatenate(parts)
+
+    def unpack(x):
+        st = x[:n] if fit_state else state
+        ps = pars.copy()
+        ps[fit_pars] = x[m - npars :]
+        return st, ps
+
+    args = (grid, obs, sqrt_w, obs_idx, fit_state, fit_pars)
+
+    x = pack(state, pars)
+    cost, r, J = _fit_eval(ta, *unpack(x), *args)
+
+    if not np.all(np.isfinite(cost)):
+        raise ValueError(
+            "The propagation from the initial guess failed in the batch lane(s) {}".format(
+                list(np.nonzero(~np.isfinite(cost))[0])
+            )
+        )
+
+    lam = np.full((bs,), float(lambda0))
+    converged = cost == 0
+    niter = np.zeros((bs,), dtype=int)
+
+    for _ in range(max_iter):
+        active = ~converged
+        if not np.any(active):
+            break
+
+        # Normal equations, with the Marquardt scaling of the damping.
+        A = np.einsum("kib,kjb->bij", J, J)
+        g = np.einsum("kib,kb->bi", J, r)
+        D = np.einsum("bii->bi", A).copy()
+        D[D == 0] = 1
+        A_lm = A + (lam[:, None] * D)[:, :, None] * np.eye(m)
+
+        delta = np.linalg.solve(A_lm, g[:, :, None])[:, :, 0].T
+        delta[:, ~active] = 0
+
+        x_new = x + delta
+        cost_new, r_new, J_new = _fit_eval(ta, *unpack(x_new), *args)
+
+        accept = active & (cost_new < cost)
+
+        small_step = np.linalg.norm(delta, axis=0) <= xtol * (
+            np.linalg.norm(x, axis=0) + xtol
+        )
+        small_cost = cost - cost_new <= ftol * cost
+
+        converged |= accept & (small_step | small_cost | (cost_new == 0))
+        # NOTE: stop the lanes in which the damping
+        # grew too large to make any further progress.
+        converged |= active & ~accept & (lam > 1e16)
+
+        x = np.where(accept, x_new, x)
+        cost = np.where(accept, cost_new, cost)
+        r = np.where(accept, r_new, r)
+        J = np.where(accept, J_new, J)
+        lam = np.where(accept, lam / 10, np.where(active, lam * 10, lam))
+        niter += active
+
+    st, ps = unpack(x)
+
+    return st, ps, cost, niter, converged
@@ -0,0 +1,196 @@
+# Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+#
+# This file is part of the heyoka.py library.
+#
+# This Source Code Form is subject to the terms of the Mozilla
+# Public License v. 2.0. If a copy of the MPL was not distributed
+# with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+# Sinks for the results of propagate_grid().
+#
+# A sink writes the output of a propagate_grid() call
+# (i.e., the time grid and the corresponding array of state
+# vectors/outputs) to disk, so that the results of large ensemble
+# or chunked propagations do not have to be kept in memory.
+# Each call to write() produces its own file(s) in the sink directory,
+# so that multiple workers can write concurrently without
+# coordination. The following formats are supported:
+#
+# - "npy": for each record "name", the files "name.npy" and
+#   "name_times.npy" contain, respectively, the array returned by
+#   propagate_grid() and the corresponding time grid;
+# - "arrow": for each record "name", the file "name.arrow" contains
+#   a single Arrow record batch in the IPC file format, with the columns
+#   "time", "lane" (batch mode only) and "c0", "c1", ... (one column
+#   for each state component/output). Requires pyarrow.
+
+
+class _npy_sink:
+    def __init__(self, path):
+        import os
+
+        os.makedirs(path, exist_ok=True)
+
+        self.path = path
+
+    def write(self, name, times, data):
+        import os
+        import numpy as np
+
+        fname = os.path.join(self.path, name + ".npy")
+
+        # NOTE: NumPy releases the GIL while writing
+        # the array data to the file.
+        np.save(fname, data)
+        np.save(os.path.join(self.path, name + "_times.npy"), times)
+
+        return fname
+
+
+class _arrow_sink:
+    def __init__(self, path):
+        import os
+
+        try:
+            import pyarrow
+        except ImportError:
+            raise ImportError(
+                "The 'arrow' sink format requires the pyarrow module, which could not be imported"
+            )
+
+        os.makedirs(path, exist_ok=True)
+
+        self.path = path
+
+    def write(self, name, times, data):
+        import os
+        import numpy as np
+        import pyarrow as pa
+
+        if data.dtype not in (np.dtype(float), np.dtype(np.float32)):
+            raise TypeError(
+                "The 'arrow' sink format supports only single and double-precision data, but data of type {} was provided instead".format(
+                    data.dtype
+                )
+            )
+
+        cols = {}
+
+        if data.ndim == 3:
+            # Batch mode: the data has shape (n, ncols, batch_size),
+            # and we flatten it into n * batch_size rows.
+            n, ncols, bs = data.shape
+
+            cols["time"] = pa.array(np.ascontiguousarray(times).reshape(-1))
+            cols["lane"] = pa.array(np.tile(np.arange(bs, dtype=np.uint32), n))
+
+            for j in range(ncols):
+                cols["c{}".format(j)] = pa.array(
+                    np.ascontiguousarray(data[:, j, :]).reshape(-1)
+                )
+        else:
+            cols["time"] = pa.array(np.ascontiguousarray(times))
+
+            for j in range(data.shape[1]):
+                cols["c{}".format(j)] = pa.array(np.ascontiguousarray(data[:, j]))
+
+        batch = pa.RecordBatch.from_pydict(cols)
+
+        fname = os.path.join(self.path, name + ".arrow")
+
+        # NOTE: pyarrow releases the GIL while writing.
+        with pa.OSFile(fname, "wb") as f:
+            with pa.ipc.new_file(f, batch.schema) as w:
+                w.write_batch(batch)
+
+        return fname
+
+
+_sink_formats = {"npy": _npy_sink, "arrow": _arrow_sink}
+
+
+def _make_grid_sink(path, fmt):
+    if fmt not in _sink_formats:
+        raise ValueError(
+            "The sink format must be one of {}, but '{}' was provided instead".format(
+                list(_sink_formats), fmt
+            )
+        )
+
+    return _sink_formats[fmt](path)
+
+
+# Write the result of a propagate_grid() call into a sink,
+# replacing the array of results with the name of the written file.
+# NOTE: in scalar mode, res is a tuple whose last element is the
+# array of results, which could contain fewer rows than the grid
+# in case of early interruption. In batch mode, res is the array
+# of results.
+def _sink_grid_result(sink, name, grid, res):
+    if isinstance(res, tuple):
+        data = res[-1]
+
+        return res[:-1] + (sink.write(name, grid[: data.shape[0]], data),)
+    else:
+        return sink.write(name, grid, res)
+
+
+# Propagate ta over the time grid in chunks of chunk_size
+# grid points, writing the results of each chunk into the sink.
+def _propagate_grid_chunked(ta, grid, sink_path, sink_format, chunk_size, **kwargs):
+    import numpy as np
+    from . import taylor_outcome
+
+    if not isinstance(chunk_size, int) or chunk_size < 1:
+        raise ValueError(
+            "The chunk size must be a positive integer, but {} was provided instead".format(
+                chunk_size
+            )
+        )
+
+    grid = np.asarray(grid)
+
+    batch_mode = hasattr(ta, "batch_size")
+    ngrid = grid.shape[0]
+
+    if ngrid == 0:
+        raise ValueError("Cannot propagate over an empty time grid")
+
+    sink = _make_grid_sink(sink_path, sink_format)
+
+    fnames = []
+    min_h, max_h, nsteps = np.inf, 0.0, 0
+
+    for k, start in enumerate(range(0, ngrid, chunk_size)):
+        end = min(start + chunk_size, ngrid)
+
+        # NOTE: from the second chunk onwards, prepend the last
+        # grid point of the previous chunk (which is the current
+        # time of the integrator), and discard the corresponding
+        # result, which was already written.
+        skip = 0 if start == 0 else 1
+        res = ta.propagate_grid(grid[start - skip : end], **kwargs)
+
+        if batch_mode:
+            data = res[skip:]
+        else:
+            data = res[-1][skip:]
+
+            min_h = min(min_h, res[1])
+            max_h = max(max_h, res[2])
+            nsteps += res[3]
+
+        name = "chunk_{:08d}".format(k)
+        fnames.append(sink.write(name, grid[start : start + data.shape[0]], data))
+
+        # Stop in case of early interruption.
+        if batch_mode:
+            if any(_[0] != taylor_outcome.time_limit for _ in ta.propagate_res):
+                break
+        elif res[0] != taylor_outcome.time_limit:
+            break
+
+    if batch_mode:
+        return fnames
+    else:
+        return (res[0], min_h, max_h, nsteps, fnames)
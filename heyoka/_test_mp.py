@@ -158,6 +158,34 @@ class mp_test_case(_ut.TestCase):
             in str(cm.exception)
         )
 
+        # Interleave evaluations at different precisions
+        # via the evaluation buffers.
+        # NOTE: use more precisions than the buffers can hold,
+        # so that the least recently used buffers are recycled.
+        fns = {
+            p: make_cfunc(func, vars=[y, x], fp_type=real, prec=p)
+            for p in [prec * 2, prec // 2, prec * 3, prec * 4, prec + 1]
+        }
+        fns[prec] = fn
+        for p in [
+            prec,
+            prec * 2,
+            prec // 2,
+            prec * 3,
+            prec * 4,
+            prec + 1,
+            prec,
+            prec * 4,
+        ]:
+            f = fns[p]
+            inputs = np.array([real(1, p), 0, real(2, p), 0])[::2]
+            pars = np.array([real(3, p), 0, real(4, p), 0])[::2]
+            out = f(inputs=inputs, pars=pars)
+            self.assertEqual(out[0], np.sin(inputs[1] + inputs[0]))
+            self.assertEqual(out[0].prec, p)
+            self.assertEqual(out[1], inputs[1] - pars[0])
+            self.assertEqual(out[2], inputs[1] + inputs[0] + pars[1])
+
     def test_add_jet(self):
         from . import (
             taylor_add_jet,
@@ -0,0 +1,218 @@
+# Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+#
+# This file is part of the heyoka.py library.
+#
+# This Source Code Form is subject to the terms of the Mozilla
+# Public License v. 2.0. If a copy of the MPL was not distributed
+# with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+# Tests for the MPI-based ensemble propagations.
+#
+# These tests are part of the main test suite (where they run
+# with a single rank), and they can also be run on multiple ranks with:
+#
+#   mpirun -n 4 python -c "from heyoka import _test_mpi; _test_mpi.run_test_suite()"
+
+import unittest as _ut
+
+
+# A stateful event callback, counting the number of times
+# it has been invoked.
+class _counting_cb:
+    def __init__(self):
+        self.n = 0
+
+    def __call__(self, ta, t, d_sgn):
+        self.n += 1
+
+
+class mpi_test_case(_ut.TestCase):
+    def runTest(self):
+        try:
+            from mpi4py import MPI
+        except ImportError:
+            return
+
+        self.test_scalar()
+        self.test_batch()
+        self.test_event_callbacks()
+        self.test_errors()
+
+    def _gen(self, ta, idx):
+        ta.state[1] += idx * 0.001
+
+        return ta
+
+    def test_scalar(self):
+        from mpi4py import MPI
+        from . import (
+            ensemble_propagate_until,
+            ensemble_propagate_grid,
+            make_vars,
+            sin,
+            taylor_adaptive,
+        )
+        from copy import deepcopy
+        import numpy as np
+
+        rank = MPI.COMM_WORLD.Get_rank()
+
+        x, v = make_vars("x", "v")
+        ta = taylor_adaptive([(x, v), (v, -9.8 * sin(x))], [0.0, 0.25])
+
+        n_iter = 11
+        grid = np.linspace(0, 5, 10)
+
+        for chunksize in [1, 3, 20]:
+            # NOTE: the MPI ensemble propagations are collective
+            # operations, hence they must be invoked on all the ranks.
+            ret = ensemble_propagate_until(
+                ta, 5.0, n_iter, self._gen, algorithm="mpi", chunksize=chunksize
+            )
+            ret_grid = ensemble_propagate_grid(
+                ta, grid, n_iter, self._gen, algorithm="mpi", chunksize=chunksize
+            )
+
+            if rank != 0:
+                self.assertIsNone(ret)
+                self.assertIsNone(ret_grid)
+                continue
+
+            self.assertEqual(len(ret), n_iter)
+
+            ref = ensemble_propagate_until(ta, 5.0, n_iter, self._gen)
+
+            for i, r in enumerate(ret):
+                # NOTE: the final state is returned
+                # in place of the integrator.
+                self.assertTrue(isinstance(r[0], np.ndarray))
+                self.assertTrue(np.all(r[0] == ref[i][0].state))
+                self.assertEqual(r[1:], ref[i][1:])
+
+            for i, r in enumerate(ret_grid):
+                ref_ta = self._gen(deepcopy(ta), i)
+                ref = ref_ta.propagate_grid(grid)
+
+                self.assertTrue(np.all(r[-1] == ref[-1]))
+
+    def test_event_callbacks(self):
+        from mpi4py import MPI
+        from . import (
+            ensemble_propagate_until,
+            make_vars,
+            nt_event,
+            sin,
+            taylor_adaptive,
+        )
+        import numpy as np
+
+        rank = MPI.COMM_WORLD.Get_rank()
+
+        x, v = make_vars("x", "v")
+        ta = taylor_adaptive(
+            [(x, v), (v, -9.8 * sin(x))],
+            [0.0, 0.25],
+            nt_events=[nt_event(v, _counting_cb())],
+        )
+
+        ret = ensemble_propagate_until(ta, 5.0, 9, self._gen, algorithm="mpi")
+
+        if rank != 0:
+            self.assertIsNone(ret)
+            return
+
+        ref = ensemble_propagate_until(ta, 5.0, 9, self._gen)
+
+        for i, r in enumerate(ret):
+            self.assertTrue(np.all(r[0] == ref[i][0].state))
+
+    def _bad_gen(self, ta, idx):
+        if idx == 5:
+            raise ValueError("Failure in the generator")
+
+        return ta
+
+    def test_batch(self):
+        from mpi4py import MPI
+        from . import (
+            ensemble_propagate_for_batch,
+            make_vars,
+            sin,
+            taylor_adaptive_batch,
+        )
+        from copy import deepcopy
+        import numpy as np
+
+        rank = MPI.COMM_WORLD.Get_rank()
+
+        x, v = make_vars("x", "v")
+        ta = taylor_adaptive_batch(
+            [(x, v), (v, -9.8 * sin(x))], [[0.0, 0.01], [0.25, 0.26]]
+        )
+
+        ret = ensemble_propagate_for_batch(ta, 5.0, 7, self._gen, algorithm="mpi")
+
+        if rank != 0:
+            self.assertIsNone(ret)
+            return
+
+        for i, r in enumerate(ret):
+            ref_ta = self._gen(deepcopy(ta), i)
+            ref_ta.propagate_for(5.0)
+
+            self.assertTrue(np.all(r[0] == ref_ta.state))
+
+    def test_errors(self):
+        from mpi4py import MPI
+        from . import ensemble_propagate_until, make_vars, taylor_adaptive
+
+        rank = MPI.COMM_WORLD.Get_rank()
+
+        x, v = make_vars("x", "v")
+        ta = taylor_adaptive([(x, v), (v, -x)], [0.0, 0.25])
+
+        with self.assertRaises(ValueError) as cm:
+            ensemble_propagate_until(
+                ta, 5.0, 10, self._gen, algorithm="mpi", chunksize=0
+            )
+        self.assertTrue(
+            "The chunk size must be a positive integer, but 0 was provided instead"
+            in str(cm.exception)
+        )
+
+        # An exception raised in an iteration is re-raised on the root
+        # (and on the rank where it was raised), without deadlocks.
+        raised = False
+        try:
+            ensemble_propagate_until(
+                ta, 1.0, 10, self._bad_gen, algorithm="mpi", chunksize=2
+            )
+        except ValueError as e:
+            raised = True
+            self.assertTrue("Failure in the generator" in str(e))
+
+        if rank == 0:
+            self.assertTrue(raised)
+
+        # The communicator is still usable afterwards.
+        ret = ensemble_propagate_until(ta, 1.0, 10, self._gen, algorithm="mpi")
+        if rank == 0:
+            self.assertEqual(len(ret), 10)
+
+
+def run_test_suite():
+    from mpi4py import MPI
+
+    suite = _ut.TestSuite()
+    suite.addTest(mpi_test_case())
+
+    # NOTE: only the root rank is verbose.
+    verbosity = 2 if MPI.COMM_WORLD.Get_rank() == 0 else 0
+    test_result = _ut.TextTestRunner(verbosity=verbosity).run(suite)
+
+    failed = len(test_result.failures) > 0 or len(test_result.errors) > 0
+
+    # NOTE: make sure that all the ranks agree
+    # on the outcome of the tests.
+    if MPI.COMM_WORLD.allreduce(failed, op=MPI.LOR):
+        raise RuntimeError("One or more tests failed.")
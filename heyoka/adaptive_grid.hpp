@@ -0,0 +1,411 @@
+// Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+//
+// This file is part of the heyoka.py library.
+//
+// This Source Code Form is subject to the terms of the Mozilla
+// Public License v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef HEYOKA_PY_ADAPTIVE_GRID_HPP
+#define HEYOKA_PY_ADAPTIVE_GRID_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <boost/numeric/conversion/cast.hpp>
+
+#include <fmt/format.h>
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+#include <Python.h>
+
+#include <heyoka/expression.hpp>
+#include <heyoka/taylor.hpp>
+
+#include "common_utils.hpp"
+#include "dtypes.hpp"
+#include "state_outputs.hpp"
+
+namespace heyoka_py
+{
+
+namespace py = pybind11;
+
+namespace detail
+{
+
+// Helper to turn the vector v into a NumPy array with the given shape,
+// without copying the data. The array takes ownership of the vector.
+template <typename T>
+inline py::array vector_to_array(std::vector<T> v, py::array::ShapeContainer shape)
+{
+    auto v_ptr = std::make_unique<std::vector<T>>(std::move(v));
+
+    py::capsule v_caps(v_ptr.get(),
+                       [](void *ptr) { std::unique_ptr<std::vector<T>> vptr(static_cast<std::vector<T> *>(ptr)); });
+
+    // NOTE: the capsule is now responsible for destroying the vector.
+    auto *ptr = v_ptr.release();
+
+    return py::array(py::dtype(get_dtype<T>()), std::move(shape), ptr->data(), std::move(v_caps));
+}
+
+} // namespace detail
+
+// Propagate ta up to the time t_final, producing output on an adaptive
+// time grid. The base grid has a cadence of dt. Each base interval is refined
+// into refine sub-intervals if:
+//
+// - it is within window from an event, or
+// - the change of any output quantity across the interval exceeds max_change
+//   (in a mixed absolute/relative sense).
+//
+// The events are the terminal events of the integrator and the zero crossings of the
+// (optional) event expressions. The zero crossings are detected via sign changes
+// across each integration step and they are then located via bisection on the dense output.
+// The output quantities are the (optional) output expressions, or the state variables.
+// The times of the events are also added to the output grid.
+// The samples are appended to growable buffers while the integration proceeds,
+// and the emission of each base interval is delayed until the integration has
+// moved past it by at least window, so that events detected later can still refine it.
+// Only the Taylor coefficients of the integration steps which have not been fully
+// emitted yet are kept in memory.
+// NOTE: this must be invoked with the GIL held.
+template <typename T>
+inline py::tuple propagate_adaptive_grid(heyoka::taylor_adaptive<T> &ta, T t_final, T dt, std::uint32_t refine,
+                                         std::optional<T> window, std::optional<T> max_change,
+                                         const std::optional<py::object> &outputs,
+                                         const std::optional<py::object> &events,
+                                         std::size_t max_steps, T max_delta_t)
+{
+    namespace hey = heyoka;
+    using std::abs;
+    using std::isfinite;
+
+    if (!isfinite(t_final)) {
+        py_throw(PyExc_ValueError, fmt::format("A non-finite final time of {} was passed to propagate_adaptive_grid()",
+                                               t_final)
+                                       .c_str());
+    }
+
+    if (!isfinite(dt) || !(dt > 0)) {
+        py_throw(PyExc_ValueError,
+                 fmt::format("The base cadence in propagate_adaptive_grid() must be positive and finite, but it is {} "
+                             "instead",
+                             dt)
+                     .c_str());
+    }
+
+    if (refine == 0u) {
+        py_throw(PyExc_ValueError, "The refinement factor in propagate_adaptive_grid() must be positive");
+    }
+
+    const auto w = window ? *window : dt;
+    if (!isfinite(w) || w < 0) {
+        py_throw(PyExc_ValueError,
+                 fmt::format("The event window in propagate_adaptive_grid() must be non-negative and finite, but it "
+                             "is {} instead",
+                             w)
+                     .c_str());
+    }
+
+    if (max_change && (!isfinite(*max_change) || !(*max_change > 0))) {
+        py_throw(PyExc_ValueError,
+                 fmt::format("The maximum output change in propagate_adaptive_grid() must be positive and finite, but "
+                             "it is {} instead",
+                             *max_change)
+                     .c_str());
+    }
+
+    if (std::isnan(max_delta_t) || !(max_delta_t > 0)) {
+        py_throw(PyExc_ValueError,
+                 fmt::format("The maximum timestep in propagate_adaptive_grid() must be positive, but it is {} instead",
+                             max_delta_t)
+                     .c_str());
+    }
+
+    // Compile the output and event expressions, if provided.
+    // NOTE: do it before the propagation, so that
+    // errors are raised without altering the state of ta.
+    std::shared_ptr<const state_outputs<T>> s_outs, s_evs;
+    if (outputs) {
+        s_outs = fetch_state_outputs<T>(ta, *outputs);
+    }
+    if (events) {
+        s_evs = fetch_state_outputs<T>(ta, *events);
+    }
+
+    const auto dim = ta.get_dim();
+    const auto order = ta.get_order();
+    const auto ncols = s_outs ? s_outs->get_nouts() : dim;
+
+    const auto t0 = ta.get_time();
+    const auto dir = t_final >= t0 ? T(1) : T(-1);
+    // The total length of the time interval.
+    const auto s_final = abs(t_final - t0);
+
+    // The integration steps which have not been fully emitted yet.
+    struct step_data {
+        // Start/end of the step, relative to t0 and in the direction of integration.
+        T s_begin, s_end;
+        // The Taylor coefficients at the beginning of the step.
+        std::vector<T> tc;
+    };
+    std::deque<step_data> steps;
+
+    // The events, relative to t0 and in the direction of integration.
+    std::deque<T> ev_s;
+    std::vector<T> ev_times;
+
+    // The output buffers.
+    std::vector<T> out_times, out_states;
+
+    // The outcome and step statistics.
+    auto oc = hey::taylor_outcome::time_limit;
+    std::size_t nsteps = 0;
+    auto min_h = std::numeric_limits<T>::infinity(), max_h = T(0);
+
+    // Evaluate the state at the relative time s via the dense output of
+    // the stored steps, writing the result into out.
+    auto eval_state = [&](T s, T *out) {
+        assert(!steps.empty());
+
+        // NOTE: locate the step containing s, using the last one
+        // in case s is beyond its end (due to floating-point rounding).
+        auto it = std::find_if(steps.begin(), steps.end(), [s](const auto &st) { return s <= st.s_end; });
+        const auto &st = it == steps.end() ? steps.back() : *it;
+
+        const auto h = dir * (s - st.s_begin);
+        for (std::uint32_t i = 0; i < dim; ++i) {
+            const auto *cf = st.tc.data() + static_cast<std::size_t>(i) * (order + 1u);
+
+            auto acc = cf[order];
+            for (std::uint32_t k = order; k > 0u; --k) {
+                acc = acc * h + cf[k - 1u];
+            }
+
+            out[i] = acc;
+        }
+    };
+
+    // Evaluate the output quantities on the state vectors in st.
+    auto eval_outputs = [&](const std::vector<T> &st) { return s_outs ? (*s_outs)(st, ta.get_pars()) : st; };
+
+    // Append the sample at the relative time s to the output buffers.
+    std::vector<T> tmp_st(dim);
+    auto emit_sample = [&](T s, T t) {
+        eval_state(s, tmp_st.data());
+
+        out_times.push_back(t);
+        out_states.insert(out_states.end(), tmp_st.begin(), tmp_st.end());
+    };
+
+    // Emission of the base intervals.
+    std::size_t next_k = 0;
+    std::vector<T> ab_st(static_cast<std::size_t>(dim) * 2u);
+    // Emit all the base intervals ending before the relative time s_lim.
+    // If last is true, the trailing partial interval and the final sample
+    // at s_lim (corresponding to the time t_lim) are also emitted.
+    auto emit_intervals = [&](T s_lim, bool last, T t_lim) {
+        while (true) {
+            const auto a = static_cast<T>(next_k) * dt;
+            if (!(a < s_lim)) {
+                break;
+            }
+
+            const auto b_full = static_cast<T>(next_k + 1u) * dt;
+            const auto b = std::min(b_full, s_lim);
+            if (!last && (b < b_full || b + w > s_lim)) {
+                // NOTE: wait until the integration has moved
+                // beyond the window of a possible future event.
+                break;
+            }
+
+            // Discard the events which cannot affect this interval anymore.
+            while (!ev_s.empty() && ev_s.front() + w < a) {
+                ev_s.pop_front();
+            }
+
+            // Check if the interval needs to be refined.
+            bool refined = std::any_of(ev_s.begin(), ev_s.end(), [&](T e) { return e - w <= b; });
+
+            if (!refined && max_change) {
+                eval_state(a, ab_st.data());
+                eval_state(b, ab_st.data() + dim);
+
+                const auto vals = eval_outputs(ab_st);
+                for (std::uint32_t i = 0; i < ncols; ++i) {
+                    if (abs(vals[ncols + i] - vals[i]) > *max_change * std::max(T(1), abs(vals[i]))) {
+                        refined = true;
+                        break;
+                    }
+                }
+            }
+
+            // Emit the samples, including the events within the interval.
+            const auto n_sub = refined ? refine : 1u;
+            auto ev_it = ev_s.begin();
+            for (std::uint32_t j = 0; j < n_sub; ++j) {
+                const auto s = a + (b - a) * (static_cast<T>(j) / n_sub);
+                const auto s_next = a + (b - a) * (static_cast<T>(j + 1u) / n_sub);
+
+                emit_sample(s, t0 + dir * s);
+
+                for (; ev_it != ev_s.end() && *ev_it < s_next; ++ev_it) {
+                    if (*ev_it > s) {
+                        emit_sample(*ev_it, t0 + dir * *ev_it);
+                    }
+                }
+            }
+
+            ++next_k;
+
+            // Discard the steps which are not needed anymore.
+            while (steps.size() > 1u && steps.front().s_end < b) {
+                steps.pop_front();
+            }
+        }
+
+        if (last) {
+            emit_sample(s_lim, t_lim);
+        }
+    };
+
+    {
+        // NOTE: after releasing the GIL here, the only potential
+        // calls into the Python interpreter are when invoking
+        // the events' callbacks (which are protected by GIL reacquire).
+        py::gil_scoped_release release;
+
+        std::vector<T> ev_vals_st(static_cast<std::size_t>(dim) * 2u);
+        std::vector<T> mid_st(dim);
+
+        // The relative time reached by the integration.
+        T s_done = 0;
+        bool finished = !(s_final > 0);
+
+        while (!finished) {
+            if (max_steps != 0u && nsteps == max_steps) {
+                oc = hey::taylor_outcome::step_limit;
+                break;
+            }
+
+            const auto rem = s_final - s_done;
+            const auto h_req = std::min(rem, max_delta_t);
+            const auto t_begin = ta.get_time();
+            const auto [s_oc, h] = ta.step(dir * h_req, true);
+
+            if (s_oc == hey::taylor_outcome::err_nf_state) {
+                oc = s_oc;
+                break;
+            }
+
+            // NOTE: the step is the last one if it reached the final time.
+            finished = (h_req == rem && abs(h) == h_req);
+            const auto s_begin = s_done;
+            s_done = finished ? s_final : abs(ta.get_time() - t0);
+
+            if (h != 0) {
+                ++nsteps;
+                min_h = std::min(min_h, abs(h));
+                max_h = std::max(max_h, abs(h));
+
+                steps.push_back(step_data{s_begin, s_done, ta.get_tc()});
+            }
+
+            // Zero crossings of the event expressions.
+            if (s_evs && h != 0) {
+                eval_state(s_begin, ev_vals_st.data());
+                eval_state(s_done, ev_vals_st.data() + dim);
+                const auto ev_vals = (*s_evs)(ev_vals_st, ta.get_pars());
+
+                const auto nev = s_evs->get_nouts();
+                std::vector<T> new_evs;
+                for (std::uint32_t i = 0; i < nev; ++i) {
+                    const auto v0 = ev_vals[i], v1 = ev_vals[nev + i];
+                    if (!(v0 < 0 && v1 >= 0) && !(v0 > 0 && v1 <= 0)) {
+                        continue;
+                    }
+
+                    // Locate the zero crossing via bisection.
+                    auto lo = s_begin, hi = s_done;
+                    for (auto iter = 0; iter < std::numeric_limits<T>::digits; ++iter) {
+                        const auto mid = lo + (hi - lo) / 2;
+                        if (!(mid > lo && mid < hi)) {
+                            break;
+                        }
+
+                        eval_state(mid, mid_st.data());
+                        const auto mid_val = (*s_evs)(mid_st, ta.get_pars())[i];
+
+                        if ((v0 < 0) == (mid_val < 0)) {
+                            lo = mid;
+                        } else {
+                            hi = mid;
+                        }
+                    }
+
+                    new_evs.push_back(hi);
+                }
+
+                std::sort(new_evs.begin(), new_evs.end());
+                for (const auto e : new_evs) {
+                    ev_s.push_back(e);
+                    ev_times.push_back(t0 + dir * e);
+                }
+            }
+
+            // Terminal events.
+            if (s_oc > hey::taylor_outcome::success) {
+                ev_s.push_back(s_done);
+                ev_times.push_back(ta.get_time());
+
+                if (static_cast<std::int64_t>(s_oc) < 0) {
+                    // The propagation was stopped by a terminal event.
+                    oc = s_oc;
+                    break;
+                }
+            }
+
+            emit_intervals(s_done, false, T(0));
+        }
+
+        // Emit the remaining intervals.
+        if (steps.empty()) {
+            // No step was taken, output only the current state.
+            out_times.push_back(ta.get_time());
+            out_states.insert(out_states.end(), ta.get_state().begin(), ta.get_state().end());
+        } else {
+            emit_intervals(s_done, true, s_done == s_final ? t_final : ta.get_time());
+        }
+
+        // Compute the output quantities, if needed.
+        if (s_outs) {
+            out_states = (*s_outs)(out_states, ta.get_pars());
+        }
+    }
+
+    const auto nrows = boost::numeric_cast<py::ssize_t>(out_times.size());
+
+    const auto nevs = boost::numeric_cast<py::ssize_t>(ev_times.size());
+
+    return py::make_tuple(
+        oc, min_h, max_h, nsteps, detail::vector_to_array(std::move(out_times), {nrows}),
+        detail::vector_to_array(std::move(out_states), {nrows, boost::numeric_cast<py::ssize_t>(ncols)}),
+        detail::vector_to_array(std::move(ev_times), {nevs}));
+}
+
+} // namespace heyoka_py
+
+#endif
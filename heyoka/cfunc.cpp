@@ -9,16 +9,22 @@
 #include <heyoka/config.hpp>
 
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <initializer_list>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <string>
 #include <type_traits>
 #include <utility>
+#include <variant>
 #include <vector>
 
 #include <boost/numeric/conversion/cast.hpp>
@@ -35,6 +41,8 @@
 
 #include <heyoka/expression.hpp>
 #include <heyoka/llvm_state.hpp>
+#include <heyoka/number.hpp>
+#include <heyoka/variable.hpp>
 
 #if defined(HEYOKA_HAVE_REAL128)
 
@@ -73,7 +81,7 @@ namespace
 {
 
 template <typename T>
-constexpr bool default_cm =
+constexpr bool is_real =
 #if defined(HEYOKA_HAVE_REAL)
     std::is_same_v<T, mppp::real>
 #else
@@ -82,473 +90,1051 @@ constexpr bool default_cm =
     ;
 
 template <typename T>
-void expose_add_cfunc_impl(py::module &m, const char *name)
+constexpr bool default_cm = is_real<T>;
+
+// Thread-local scratch buffers for the evaluation of compiled functions,
+// with the same semantics as real_scratch() (minus the precision).
+// NOTE: the buffers are not members of the compiled function objects,
+// so that concurrent invocations of the same object from multiple
+// threads (e.g., in free-threaded Python builds) do not race.
+template <typename T>
+T *fp_scratch(std::size_t n, unsigned slot)
 {
-    using namespace pybind11::literals;
-    namespace kw = hey::kw;
+    thread_local std::array<std::vector<T>, 3> arena;
 
-    m.def(
-        name,
-        [](const std::vector<hey::expression> &fn, const std::optional<std::vector<hey::expression>> &vars,
-           bool high_accuracy, bool compact_mode, bool parallel_mode, unsigned opt_level, bool force_avx512,
-           std::optional<std::uint32_t> batch_size, bool fast_math, long long prec) {
-            // Compute the SIMD size.
-            const auto simd_size = batch_size ? *batch_size : hey::recommended_simd_size<T>();
+    assert(slot < arena.size());
+    auto &vec = arena[slot];
 
-            // Forbid batch sizes > 1 for everything but double.
-            if (!std::is_same_v<T, double> && simd_size > 1u) {
-                py_throw(PyExc_ValueError, "Batch sizes greater than 1 are not supported for this floating-point type");
+    if (vec.size() < n) {
+        vec.resize(n);
+    }
+
+    return vec.data();
+}
+
+// Helper to detect NaN values.
+template <typename T>
+bool fp_isnan(const T &x)
+{
+    using std::isnan;
+
+    return isnan(x);
+}
+
+// Helper to detect outputs which are identically zero.
+// NOTE: only outputs which are numerical constants equal to zero
+// are detected. Outputs which evaluate to zero but are not
+// literally zero (e.g., x - x) are considered nonzero. This is
+// conservative (such outputs are evaluated and stored explicitly
+// in the CSR format), but it never produces wrong results.
+bool is_zero_output(const hey::expression &ex)
+{
+    if (const auto *num_ptr = std::get_if<hey::number>(&ex.value())) {
+        return std::visit([](const auto &v) { return v == 0; }, num_ptr->value());
+    }
+
+    return false;
+}
+
+template <typename T>
+struct cfunc_obj;
+
+template <typename T>
+cfunc_obj<T> compile_cfunc(std::vector<hey::expression>, std::vector<hey::expression>, bool, bool, bool, unsigned,
+                           bool, std::uint32_t, bool, long long);
+
+// The compiled function object returned by make_cfunc().
+// It owns the llvm states containing the scalar and batch
+// compiled functions, so that the function pointers stored
+// within remain valid for the lifetime of the object.
+// NOTE: the function pointers refer to the JIT-compiled code
+// of the object's own llvm states, hence on copy they must be
+// looked up again in the copied states.
+template <typename T>
+struct cfunc_obj {
+    using ptr_t = void (*)(T *, const T *, const T *) noexcept;
+    using ptr_s_t = void (*)(T *, const T *, const T *, std::size_t) noexcept;
+
+    hey::llvm_state s_scal, s_batch;
+    std::uint32_t simd_size = 0, nparams = 0, nouts = 0, nvars = 0;
+    ptr_t fptr_scal = nullptr, fptr_batch = nullptr;
+    ptr_s_t fptr_scal_s = nullptr, fptr_batch_s = nullptr;
+    long long prec = 0;
+
+    // The outputs and the variables of the function, and the compilation
+    // options, which are needed to compile the function for subsets of its outputs.
+    std::vector<hey::expression> fn, vars;
+    bool high_accuracy = false, compact_mode = false, parallel_mode = false, force_avx512 = false, fast_math = false;
+    unsigned opt_level = 3;
+
+    // Cache of the functions compiled for subsets of the outputs (keyed
+    // by the list of output indices), and the indices of the outputs which
+    // are not identically zero (computed on first use).
+    // NOTE: the cache is shared by all the threads invoking
+    // the object, hence the mutex.
+    struct sub_cache_t {
+        std::mutex mut;
+        std::map<std::vector<std::uint32_t>, std::shared_ptr<cfunc_obj>> subs;
+        std::optional<std::vector<std::uint32_t>> nz_idx;
+    };
+    std::unique_ptr<sub_cache_t> sub_cache = std::make_unique<sub_cache_t>();
+
+    cfunc_obj() = default;
+    // NOTE: the cache of the subset functions is not copied,
+    // the copy will re-compile the subsets on demand.
+    cfunc_obj(const cfunc_obj &other)
+        : s_scal(other.s_scal), s_batch(other.s_batch), simd_size(other.simd_size), nparams(other.nparams),
+          nouts(other.nouts), nvars(other.nvars), prec(other.prec), fn(other.fn), vars(other.vars),
+          high_accuracy(other.high_accuracy), compact_mode(other.compact_mode), parallel_mode(other.parallel_mode),
+          force_avx512(other.force_avx512), fast_math(other.fast_math), opt_level(other.opt_level)
+    {
+        fptr_scal = reinterpret_cast<ptr_t>(s_scal.jit_lookup("cfunc"));
+        fptr_scal_s = reinterpret_cast<ptr_s_t>(s_scal.jit_lookup("cfunc.strided"));
+        fptr_batch = reinterpret_cast<ptr_t>(s_batch.jit_lookup("cfunc"));
+        fptr_batch_s = reinterpret_cast<ptr_s_t>(s_batch.jit_lookup("cfunc.strided"));
+    }
+    cfunc_obj(cfunc_obj &&) = default;
+    cfunc_obj &operator=(const cfunc_obj &) = delete;
+    cfunc_obj &operator=(cfunc_obj &&) = delete;
+    ~cfunc_obj() = default;
+
+    // Fetch the function compiled for the subset of outputs idx, compiling
+    // it (and caching it) if necessary. Because only the requested outputs
+    // are compiled, the computations needed exclusively by the other
+    // outputs are removed from the compiled code.
+    std::shared_ptr<cfunc_obj> get_subset(const std::vector<std::uint32_t> &idx)
+    {
+        if (idx.empty()) {
+            heypy::py_throw(PyExc_ValueError, "The list of output indices for the evaluation of a compiled "
+                                              "function cannot be empty");
+        }
+
+        for (const auto i : idx) {
+            if (i >= nouts) {
+                heypy::py_throw(PyExc_ValueError,
+                                fmt::format("The output index {} is out of range for a compiled function "
+                                            "with {} output(s)",
+                                            i, nouts)
+                                    .c_str());
             }
+        }
 
-            // Add the compiled functions.
-            using ptr_t = void (*)(T *, const T *, const T *) noexcept;
-            ptr_t fptr_scal = nullptr, fptr_batch = nullptr;
-            using ptr_s_t = void (*)(T *, const T *, const T *, std::size_t) noexcept;
-            ptr_s_t fptr_scal_s = nullptr, fptr_batch_s = nullptr;
-
-            hey::llvm_state s_scal{kw::opt_level = opt_level, kw::force_avx512 = force_avx512,
-                                   kw::fast_math = fast_math},
-                s_batch{kw::opt_level = opt_level, kw::force_avx512 = force_avx512, kw::fast_math = fast_math};
-
-            {
-                // NOTE: release the GIL during compilation.
-                py::gil_scoped_release release;
-
-                oneapi::tbb::parallel_invoke(
-                    [&]() {
-                        // Scalar.
-                        if (vars) {
-                            hey::add_cfunc<T>(s_scal, "cfunc", fn, kw::vars = *vars, kw::high_accuracy = high_accuracy,
-                                              kw::compact_mode = compact_mode, kw::parallel_mode = parallel_mode,
-                                              kw::prec = prec);
-                        } else {
-                            hey::add_cfunc<T>(s_scal, "cfunc", fn, kw::high_accuracy = high_accuracy,
-                                              kw::compact_mode = compact_mode, kw::parallel_mode = parallel_mode,
-                                              kw::prec = prec);
-                        }
+        {
+            std::lock_guard lock(sub_cache->mut);
 
-                        s_scal.compile();
-
-                        fptr_scal = reinterpret_cast<ptr_t>(s_scal.jit_lookup("cfunc"));
-                        fptr_scal_s = reinterpret_cast<ptr_s_t>(s_scal.jit_lookup("cfunc.strided"));
-                    },
-                    [&]() {
-                        // Batch.
-                        if (vars) {
-                            hey::add_cfunc<T>(s_batch, "cfunc", fn, kw::vars = *vars, kw::batch_size = simd_size,
-                                              kw::high_accuracy = high_accuracy, kw::compact_mode = compact_mode,
-                                              kw::parallel_mode = parallel_mode, kw::prec = prec);
-                        } else {
-                            hey::add_cfunc<T>(s_batch, "cfunc", fn, kw::batch_size = simd_size,
-                                              kw::high_accuracy = high_accuracy, kw::compact_mode = compact_mode,
-                                              kw::parallel_mode = parallel_mode, kw::prec = prec);
-                        }
+            if (const auto it = sub_cache->subs.find(idx); it != sub_cache->subs.end()) {
+                return it->second;
+            }
+        }
+
+        std::vector<hey::expression> sub_fn;
+        sub_fn.reserve(idx.size());
+        for (const auto i : idx) {
+            sub_fn.push_back(fn[i]);
+        }
+
+        // NOTE: the cache is not locked during compilation. If another thread
+        // compiles the same subset concurrently, the first insertion wins.
+        auto sub = std::make_shared<cfunc_obj>(compile_cfunc<T>(std::move(sub_fn), vars, high_accuracy,
+                                                                compact_mode, parallel_mode, opt_level,
+                                                                force_avx512, simd_size, fast_math, prec));
+
+        // NOTE: the subset function must be evaluated with the same
+        // array of parameter values as the original function, even
+        // if its outputs depend on fewer parameters.
+        sub->nparams = nparams;
+
+        std::lock_guard lock(sub_cache->mut);
+
+        return sub_cache->subs.emplace(idx, std::move(sub)).first->second;
+    }
+
+    // Fetch the indices of the outputs which are not identically zero.
+    // NOTE: see is_zero_output() for the limitations of the detection.
+    const std::vector<std::uint32_t> &nz_outputs()
+    {
+        std::lock_guard lock(sub_cache->mut);
+
+        if (!sub_cache->nz_idx) {
+            std::vector<std::uint32_t> nz_idx;
+
+            for (std::uint32_t i = 0; i < nouts; ++i) {
+                if (!is_zero_output(fn[i])) {
+                    nz_idx.push_back(i);
+                }
+            }
 
-                        s_batch.compile();
+            sub_cache->nz_idx.emplace(std::move(nz_idx));
+        }
+
+        // NOTE: nz_idx is never modified after
+        // its creation, hence it is safe to return
+        // a reference to it.
+        return *sub_cache->nz_idx;
+    }
+
+    // Evaluate the function, interpreting the outputs as the elements of a
+    // matrix with the given shape (in row-major order), and return the result
+    // in the compressed sparse row (CSR) format. The sparsity pattern is determined
+    // by the outputs which are identically zero, and only the nonzero outputs
+    // are computed. The returned tuple contains the values of the nonzero elements
+    // (with an additional dimension if multiple evaluations are requested, in which
+    // case the sparsity pattern is shared by all evaluations), the column indices
+    // of the nonzero elements and the row pointers.
+    py::tuple eval_csr(const py::iterable &inputs_ob, const std::array<std::uint32_t, 2> &shape,
+                       std::optional<py::iterable> pars_ob)
+    {
+        const auto [nrows, ncols] = shape;
+
+        if (static_cast<std::uint64_t>(nrows) * ncols != nouts) {
+            heypy::py_throw(PyExc_ValueError,
+                            fmt::format("The shape ({}, {}) passed to eval_csr() is incompatible with the number "
+                                        "of outputs of the compiled function ({})",
+                                        nrows, ncols, nouts)
+                                .c_str());
+        }
+
+        const auto &nz_idx = nz_outputs();
+
+        // Build the column indices and the row pointers.
+        py::array_t<py::ssize_t> indices(boost::numeric_cast<py::ssize_t>(nz_idx.size())),
+            indptr(boost::numeric_cast<py::ssize_t>(nrows) + 1);
+        auto u_indices = indices.template mutable_unchecked<1>();
+        auto u_indptr = indptr.template mutable_unchecked<1>();
+
+        u_indptr(0) = 0;
+        py::ssize_t k = 0;
+        for (std::uint32_t r = 0; r < nrows; ++r) {
+            for (; k < static_cast<py::ssize_t>(nz_idx.size()) && nz_idx[static_cast<std::size_t>(k)] / ncols == r;
+                 ++k) {
+                u_indices(k) = static_cast<py::ssize_t>(nz_idx[static_cast<std::size_t>(k)] % ncols);
+            }
 
-                        fptr_batch = reinterpret_cast<ptr_t>(s_batch.jit_lookup("cfunc"));
-                        fptr_batch_s = reinterpret_cast<ptr_s_t>(s_batch.jit_lookup("cfunc.strided"));
-                    });
+            u_indptr(static_cast<py::ssize_t>(r) + 1) = k;
+        }
+
+        // Compute the values of the nonzero elements.
+        py::array data;
+        if (nz_idx.empty()) {
+            // NOTE: evaluate the full function and discard all its outputs,
+            // so that the inputs and the parameters are validated exactly
+            // as in the evaluation of the nonzero outputs. The cost is negligible,
+            // as all the outputs are constants.
+            const auto full = (*this)(inputs_ob, {}, std::move(pars_ob), {}, {}, {});
+            data = py::array(full[py::slice(0, 0, 1)].attr("copy")());
+        } else {
+            data = (*get_subset(nz_idx))(inputs_ob, {}, std::move(pars_ob), {}, {}, {});
+        }
+
+        return py::make_tuple(std::move(data), std::move(indices), std::move(indptr));
+    }
+
+    py::array operator()(const py::iterable &inputs_ob, std::optional<py::iterable> outputs_ob,
+                         std::optional<py::iterable> pars_ob, const std::optional<std::string> &reduce,
+                         std::optional<py::iterable> weights_ob,
+                         const std::optional<std::vector<std::uint32_t>> &out_idx)
+    {
+        using namespace pybind11::literals;
+
+        // Evaluate only a subset of the outputs, if requested.
+        if (out_idx) {
+            return (*get_subset(*out_idx))(inputs_ob, std::move(outputs_ob), std::move(pars_ob), reduce,
+                                           std::move(weights_ob), {});
+        }
+
+        // Attempt to convert the input arguments into arrays.
+        // NOTE: objects supporting the DLPack protocol are converted
+        // without copying.
+        py::array inputs = from_dlpack(inputs_ob);
+        std::optional<py::array> outputs_ = outputs_ob ? from_dlpack(*outputs_ob) : std::optional<py::array>{};
+        std::optional<py::array> pars = pars_ob ? from_dlpack(*pars_ob) : std::optional<py::array>{};
+
+        // Enforce the correct dtype for all arrays.
+        const auto dt = get_dtype<T>();
+        if (inputs.dtype().num() != dt) {
+            inputs = inputs.attr("astype")(py::dtype(dt), "casting"_a = "safe");
+        }
+        if (outputs_ && outputs_->dtype().num() != dt) {
+            *outputs_ = outputs_->attr("astype")(py::dtype(dt), "casting"_a = "safe");
+        }
+        if (pars && pars->dtype().num() != dt) {
+            *pars = pars->attr("astype")(py::dtype(dt), "casting"_a = "safe");
+        }
+
+        // If we have params in the function, we must be provided
+        // with an array of parameter values.
+        if (nparams > 0u && !pars) {
+            heypy::py_throw(PyExc_ValueError,
+                            fmt::format("The compiled function contains {} parameter(s), but no array "
+                                        "of parameter values was provided for evaluation",
+                                        nparams)
+                                .c_str());
+        }
+
+        // Validate the number of dimensions for the inputs.
+        if (inputs.ndim() != 1 && inputs.ndim() != 2) {
+            heypy::py_throw(PyExc_ValueError,
+                            fmt::format("The array of inputs provided for the evaluation "
+                                        "of a compiled function has {} dimensions, "
+                                        "but it must have either 1 or 2 dimensions instead",
+                                        inputs.ndim())
+                                .c_str());
+        }
+
+        // Check the number of inputs.
+        if (boost::numeric_cast<std::uint32_t>(inputs.shape(0)) != nvars) {
+            heypy::py_throw(PyExc_ValueError,
+                            fmt::format("The array of inputs provided for the evaluation "
+                                        "of a compiled function has size {} in the first dimension, "
+                                        "but it must have a size of {} instead (i.e., the size in the "
+                                        "first dimension must be equal to the number of variables)",
+                                        inputs.shape(0), nvars)
+                                .c_str());
+        }
+
+        // Determine if we are running one or more evaluations.
+        const auto multi_eval = inputs.ndim() == 2;
+
+        // Validate the reduction arguments.
+        if (reduce) {
+            if (*reduce != "sum" && *reduce != "max" && *reduce != "min" && *reduce != "mean") {
+                heypy::py_throw(PyExc_ValueError,
+                                fmt::format("Invalid reduction '{}' requested for the evaluation of a compiled "
+                                            "function: the reduction must be one of 'sum', 'max', 'min' or 'mean'",
+                                            *reduce)
+                                    .c_str());
             }
 
-            // Let's figure out if fn contains params.
-            std::uint32_t nparams = 0;
-            for (const auto &ex : fn) {
-                nparams = std::max<std::uint32_t>(nparams, hey::get_param_size(ex));
+            if (!multi_eval) {
+                heypy::py_throw(PyExc_ValueError, "A reduction can be requested for the evaluation of a compiled "
+                                                  "function only if the array of inputs has 2 dimensions");
             }
 
-            // Cache the number of variables and outputs.
-            // NOTE: static casts are fine, because add_cfunc()
-            // succeeded and that guarantees that the number of vars and outputs
-            // fits in a 32-bit int.
-            const auto nouts = static_cast<std::uint32_t>(fn.size());
+            if (outputs_) {
+                heypy::py_throw(PyExc_ValueError, "An array of outputs cannot be provided for the evaluation of a "
+                                                  "compiled function if a reduction is requested");
+            }
 
-            std::uint32_t nvars = 0;
-            if (vars) {
-                nvars = static_cast<std::uint32_t>(vars->size());
+            if (inputs.shape(1) == 0) {
+                heypy::py_throw(PyExc_ValueError, "Cannot compute a reduction over zero evaluations of a compiled "
+                                                  "function");
+            }
+
+            if (weights_ob && (*reduce == "max" || *reduce == "min")) {
+                heypy::py_throw(PyExc_ValueError,
+                                "Weights can be used only with the 'sum' and 'mean' reductions in the evaluation "
+                                "of a compiled function");
+            }
+        } else if (weights_ob) {
+            heypy::py_throw(PyExc_ValueError,
+                            "Weights can be provided for the evaluation of a compiled function only if a "
+                            "reduction is requested");
+        }
+
+        // Prepare the array of outputs.
+        auto outputs = [&]() {
+            if (reduce) {
+                // NOTE: no array of outputs is needed
+                // when running a reduction.
+                return py::array{};
+            }
+
+            if (outputs_) {
+                // The outputs array was provided, check it.
+
+                // Check if we can write to the outputs.
+                if (!outputs_->writeable()) {
+                    heypy::py_throw(PyExc_ValueError, "The array of outputs provided for the evaluation "
+                                                      "of a compiled function is not writeable");
+                }
+
+                // Validate the number of dimensions for the outputs.
+                if (outputs_->ndim() != inputs.ndim()) {
+                    heypy::py_throw(PyExc_ValueError,
+                                    fmt::format("The array of outputs provided for the evaluation "
+                                                "of a compiled function has {} dimension(s), "
+                                                "but it must have {} dimension(s) instead (i.e., the same "
+                                                "number of dimensions as the array of inputs)",
+                                                outputs_->ndim(), inputs.ndim())
+                                        .c_str());
+                }
+
+                // Check the number of outputs.
+                if (boost::numeric_cast<std::uint32_t>(outputs_->shape(0)) != nouts) {
+                    heypy::py_throw(
+                        PyExc_ValueError,
+                        fmt::format("The array of outputs provided for the evaluation "
+                                    "of a compiled function has size {} in the first dimension, "
+                                    "but it must have a size of {} instead (i.e., the size in the "
+                                    "first dimension must be equal to the number of outputs)",
+                                    outputs_->shape(0), nouts)
+                            .c_str());
+                }
+
+                // If we are running multiple evaluations, the number must
+                // be consistent between inputs and outputs.
+                if (multi_eval && outputs_->shape(1) != inputs.shape(1)) {
+                    heypy::py_throw(
+                        PyExc_ValueError,
+                        fmt::format("The size in the second dimension for the output array provided for "
+                                    "the evaluation of a compiled function ({}) must match the size in the "
+                                    "second dimension for the array of inputs ({})",
+                                    outputs_->shape(1), inputs.shape(1))
+                            .c_str());
+                }
+
+                return std::move(*outputs_);
             } else {
-                // NOTE: this is a bit of repetition from add_cfunc().
-                // If this becomes an issue, we can consider in the
-                // future changing add_cfunc() to return also the number
-                // of detected variables.
-                std::set<std::string> dvars;
-                for (const auto &ex : fn) {
-                    for (const auto &var : hey::get_variables(ex)) {
-                        dvars.emplace(var);
-                    }
+                // Create the outputs array.
+                if (multi_eval) {
+                    return py::array(inputs.dtype(),
+                                     py::array::ShapeContainer{boost::numeric_cast<py::ssize_t>(nouts),
+                                                               inputs.shape(1)});
+                } else {
+                    return py::array(inputs.dtype(),
+                                     py::array::ShapeContainer{boost::numeric_cast<py::ssize_t>(nouts)});
                 }
+            }
+        }();
 
-                nvars = static_cast<std::uint32_t>(dvars.size());
+#if defined(HEYOKA_HAVE_REAL)
+
+        if constexpr (std::is_same_v<T, mppp::real>) {
+            // For mppp::real:
+            // - check that the inputs array contains values with the correct precision,
+            // - ensure that the outputs array contains constructed values with the correct
+            //   precision.
+            pyreal_check_array(inputs, boost::numeric_cast<mpfr_prec_t>(prec));
+            if (!reduce) {
+                pyreal_ensure_array(outputs, boost::numeric_cast<mpfr_prec_t>(prec));
             }
+        }
+
+#endif
 
-            // Prepare local buffers to store inputs, outputs and pars
-            // during the invocation of the compiled functions.
-            // These are used only if we cannot read from/write to
-            // the numpy arrays directly.
-            std::vector<T> buf_in, buf_out, buf_pars;
+        // Check the pars array, if necessary.
+        if (pars) {
+            // Validate the number of dimensions.
+            if (pars->ndim() != inputs.ndim()) {
+                heypy::py_throw(PyExc_ValueError,
+                                fmt::format("The array of parameter values provided for the evaluation "
+                                            "of a compiled function has {} dimension(s), "
+                                            "but it must have {} dimension(s) instead (i.e., the same "
+                                            "number of dimensions as the array of inputs)",
+                                            pars->ndim(), inputs.ndim())
+                                    .c_str());
+            }
+
+            // Check the number of pars.
+            if (boost::numeric_cast<std::uint32_t>(pars->shape(0)) != nparams) {
+                heypy::py_throw(
+                    PyExc_ValueError,
+                    fmt::format(
+                        "The array of parameter values provided for the evaluation "
+                        "of a compiled function has size {} in the first dimension, "
+                        "but it must have a size of {} instead (i.e., the size in the "
+                        "first dimension must be equal to the number of parameters in the function)",
+                        pars->shape(0), nparams)
+                        .c_str());
+            }
+
+            // If we are running multiple evaluations, the number must
+            // be consistent between inputs and pars.
+            if (multi_eval && pars->shape(1) != inputs.shape(1)) {
+                heypy::py_throw(
+                    PyExc_ValueError,
+                    fmt::format("The size in the second dimension for the array of parameter values "
+                                "provided for "
+                                "the evaluation of a compiled function ({}) must match the size in the "
+                                "second dimension for the array of inputs ({})",
+                                pars->shape(1), inputs.shape(1))
+                        .c_str());
+            }
+
+#if defined(HEYOKA_HAVE_REAL)
+
+            if constexpr (std::is_same_v<T, mppp::real>) {
+                // For mppp::real, check that the pars array is filled
+                // with constructed values with the correct precision.
+                pyreal_check_array(*pars, boost::numeric_cast<mpfr_prec_t>(prec));
+            }
+
+#endif
+        }
+
+        // Fetch the buffers used to store inputs, outputs and pars
+        // during the invocation of the compiled functions.
+        // These are used only if we cannot read from/write to
+        // the numpy arrays directly.
+        T *buf_in_ptr = nullptr, *buf_out_ptr = nullptr, *buf_par_ptr = nullptr;
+
+        if constexpr (!is_real<T>) {
             // NOTE: the multiplications are safe because
             // the overflow checks we run during the compilation
             // of the function in batch mode did not raise errors.
-            buf_in.resize(boost::numeric_cast<decltype(buf_in.size())>(nvars * simd_size));
-            buf_out.resize(boost::numeric_cast<decltype(buf_out.size())>(nouts * simd_size));
-            buf_pars.resize(boost::numeric_cast<decltype(buf_pars.size())>(nparams * simd_size));
+            buf_in_ptr = fp_scratch<T>(static_cast<std::size_t>(nvars) * simd_size, 0);
+            buf_out_ptr = fp_scratch<T>(static_cast<std::size_t>(nouts) * simd_size, 1);
+            buf_par_ptr = fp_scratch<T>(static_cast<std::size_t>(nparams) * simd_size, 2);
+        }
 
 #if defined(HEYOKA_HAVE_REAL)
 
-            if constexpr (std::is_same_v<T, mppp::real>) {
-                // For mppp::real, ensure that all buffers contain
-                // values with the correct precision.
+        if constexpr (std::is_same_v<T, mppp::real>) {
+            // For mppp::real, fetch the buffers from the scratch arena.
+            // NOTE: only the scalar functions are available for mppp::real,
+            // hence there is no need to multiply the sizes by simd_size.
+            assert(simd_size == 1u);
 
-                for (auto &val : buf_in) {
-                    val.set_prec(boost::numeric_cast<mpfr_prec_t>(prec));
-                }
+            const auto p = boost::numeric_cast<mpfr_prec_t>(prec);
+
+            buf_in_ptr = real_scratch(p, nvars, 0);
+            buf_out_ptr = real_scratch(p, nouts, 1);
+            buf_par_ptr = real_scratch(p, nparams, 2);
+        }
 
-                for (auto &val : buf_out) {
-                    val.set_prec(boost::numeric_cast<mpfr_prec_t>(prec));
+#endif
+
+        // Run the reduction, if requested.
+        if (reduce) {
+            return eval_reduce(inputs, pars, *reduce, std::move(weights_ob), buf_in_ptr, buf_out_ptr, buf_par_ptr);
+        }
+
+        // Check if we can use a zero-copy implementation. This is enabled
+        // for C-style contiguous aligned arrays guaranteed not to share any data.
+        bool zero_copy = is_npy_array_carray(inputs) && is_npy_array_carray(outputs)
+                         && (!pars || is_npy_array_carray(*pars));
+        if (zero_copy) {
+            const auto maybe_share_memory
+                = pars ? may_share_memory(inputs, outputs, *pars) : may_share_memory(inputs, outputs);
+            if (maybe_share_memory) {
+                zero_copy = false;
+            }
+        }
+
+        // Run the evaluation.
+        if (multi_eval) {
+            // Signed version of the recommended simd size.
+            const auto ss_size = boost::numeric_cast<py::ssize_t>(simd_size);
+
+            // Cache the number of evals.
+            const auto nevals = inputs.shape(1);
+
+            // Number of simd blocks in the arrays.
+            const auto n_simd_blocks = nevals / ss_size;
+
+            if (zero_copy) {
+                // Safely cast nevals to size_t to compute
+                // the stride value.
+                const auto stride = boost::numeric_cast<std::size_t>(nevals);
+
+                // Cache pointers.
+                auto *out_data = static_cast<T *>(outputs.mutable_data());
+                auto *in_data = static_cast<const T *>(inputs.data());
+                auto *par_data = pars ? static_cast<const T *>(pars->data()) : nullptr;
+                // NOTE: we define these two boolean variables in order
+                // to avoid doing pointer arithmetic (when invoking fptr_batch_s)
+                // on bogus pointers (such as nullptr). This could happen for instance
+                // if the function has no inputs, or if an empty pars array was provided
+                // (that is, in both cases we would be dealing with numpy arrays
+                // with shape (0, nevals)). In other words, while we assume
+                // calling .data() on any numpy array is always safe, we are taking
+                // precautions when doing arithmetics on the pointer returned by .data().
+                const auto with_inputs = nvars > 0u;
+                const auto with_pars = nparams > 0u;
+
+                // Evaluate over the simd blocks.
+                for (py::ssize_t k = 0; k < n_simd_blocks; ++k) {
+                    const auto start_offset = k * ss_size;
+
+                    // Run the evaluation.
+                    fptr_batch_s(out_data + start_offset, with_inputs ? in_data + start_offset : nullptr,
+                                 with_pars ? par_data + start_offset : nullptr, stride);
                 }
 
-                for (auto &val : buf_pars) {
-                    val.set_prec(boost::numeric_cast<mpfr_prec_t>(prec));
+                // Handle the remainder, if present.
+                for (auto k = n_simd_blocks * ss_size; k < nevals; ++k) {
+                    fptr_scal_s(out_data + k, with_inputs ? in_data + k : nullptr,
+                                with_pars ? par_data + k : nullptr, stride);
                 }
-            }
+            } else {
+                // Unchecked access to inputs and outputs.
+                auto u_inputs = inputs.template unchecked<T, 2>();
+                auto u_outputs = outputs.template mutable_unchecked<T, 2>();
+
+                // Evaluate over the simd blocks.
+                for (py::ssize_t k = 0; k < n_simd_blocks; ++k) {
+                    // Copy over the input data.
+                    for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nvars); ++i) {
+                        for (py::ssize_t j = 0; j < ss_size; ++j) {
+                            buf_in_ptr[i * ss_size + j] = u_inputs(i, k * ss_size + j);
+                        }
+                    }
 
-#endif
+                    // Copy over the pars.
+                    if (pars) {
+                        auto u_pars = pars->template unchecked<T, 2>();
 
-            return py::cpp_function(
-                [s_scal = std::move(s_scal), s_batch = std::move(s_batch), simd_size, nparams, nouts, nvars, fptr_scal,
-                 fptr_scal_s, fptr_batch, fptr_batch_s, buf_in = std::move(buf_in), buf_out = std::move(buf_out),
-                 buf_pars = std::move(buf_pars),
-                 prec](const py::iterable &inputs_ob, std::optional<py::iterable> outputs_ob,
-                       std::optional<py::iterable> pars_ob) mutable {
-                    (void)prec;
-
-                    // Attempt to convert the input arguments into arrays.
-                    py::array inputs = inputs_ob;
-                    std::optional<py::array> outputs_ = outputs_ob ? *outputs_ob : std::optional<py::array>{};
-                    std::optional<py::array> pars = pars_ob ? *pars_ob : std::optional<py::array>{};
-
-                    // Enforce the correct dtype for all arrays.
-                    const auto dt = get_dtype<T>();
-                    if (inputs.dtype().num() != dt) {
-                        inputs = inputs.attr("astype")(py::dtype(dt), "casting"_a = "safe");
+                        for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nparams); ++i) {
+                            for (py::ssize_t j = 0; j < ss_size; ++j) {
+                                buf_par_ptr[i * ss_size + j] = u_pars(i, k * ss_size + j);
+                            }
+                        }
                     }
-                    if (outputs_ && outputs_->dtype().num() != dt) {
-                        *outputs_ = outputs_->attr("astype")(py::dtype(dt), "casting"_a = "safe");
+
+                    // Run the evaluation.
+                    fptr_batch(buf_out_ptr, buf_in_ptr, buf_par_ptr);
+
+                    // Write the outputs.
+                    for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nouts); ++i) {
+                        for (py::ssize_t j = 0; j < ss_size; ++j) {
+                            u_outputs(i, k * ss_size + j) = buf_out_ptr[i * ss_size + j];
+                        }
                     }
-                    if (pars && pars->dtype().num() != dt) {
-                        *pars = pars->attr("astype")(py::dtype(dt), "casting"_a = "safe");
+                }
+
+                // Handle the remainder, if present.
+                for (auto k = n_simd_blocks * ss_size; k < nevals; ++k) {
+                    for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nvars); ++i) {
+                        buf_in_ptr[i] = u_inputs(i, k);
                     }
 
-                    // If we have params in the function, we must be provided
-                    // with an array of parameter values.
-                    if (nparams > 0u && !pars) {
-                        heypy::py_throw(PyExc_ValueError,
-                                        fmt::format("The compiled function contains {} parameter(s), but no array "
-                                                    "of parameter values was provided for evaluation",
-                                                    nparams)
-                                            .c_str());
+                    if (pars) {
+                        auto u_pars = pars->template unchecked<T, 2>();
+
+                        for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nparams); ++i) {
+                            buf_par_ptr[i] = u_pars(i, k);
+                        }
                     }
 
-                    // Validate the number of dimensions for the inputs.
-                    if (inputs.ndim() != 1 && inputs.ndim() != 2) {
-                        heypy::py_throw(PyExc_ValueError,
-                                        fmt::format("The array of inputs provided for the evaluation "
-                                                    "of a compiled function has {} dimensions, "
-                                                    "but it must have either 1 or 2 dimensions instead",
-                                                    inputs.ndim())
-                                            .c_str());
+                    fptr_scal(buf_out_ptr, buf_in_ptr, buf_par_ptr);
+
+                    for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nouts); ++i) {
+                        u_outputs(i, k) = buf_out_ptr[i];
                     }
+                }
+            }
+        } else {
+            if (zero_copy) {
+                fptr_scal(static_cast<T *>(outputs.mutable_data()), static_cast<const T *>(inputs.data()),
+                          pars ? static_cast<const T *>(pars->data()) : nullptr);
+            } else {
+                // Copy over the input data.
+                auto u_inputs = inputs.template unchecked<T, 1>();
+                for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nvars); ++i) {
+                    buf_in_ptr[i] = u_inputs(i);
+                }
+
+                // Copy over the pars.
+                if (pars) {
+                    auto u_pars = pars->template unchecked<T, 1>();
 
-                    // Check the number of inputs.
-                    if (boost::numeric_cast<std::uint32_t>(inputs.shape(0)) != nvars) {
-                        heypy::py_throw(PyExc_ValueError,
-                                        fmt::format("The array of inputs provided for the evaluation "
-                                                    "of a compiled function has size {} in the first dimension, "
-                                                    "but it must have a size of {} instead (i.e., the size in the "
-                                                    "first dimension must be equal to the number of variables)",
-                                                    inputs.shape(0), nvars)
-                                            .c_str());
+                    for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nparams); ++i) {
+                        buf_par_ptr[i] = u_pars(i);
                     }
+                }
 
-                    // Determine if we are running one or more evaluations.
-                    const auto multi_eval = inputs.ndim() == 2;
+                // Run the evaluation.
+                fptr_scal(buf_out_ptr, buf_in_ptr, buf_par_ptr);
 
-                    // Prepare the array of outputs.
-                    auto outputs = [&]() {
-                        if (outputs_) {
-                            // The outputs array was provided, check it.
+                // Write the outputs.
+                auto u_outputs = outputs.template mutable_unchecked<T, 1>();
+                for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nouts); ++i) {
+                    u_outputs(i) = buf_out_ptr[i];
+                }
+            }
+        }
+
+        return outputs;
+    }
+
+    // Evaluate the function over the columns of inputs (and pars), reducing the
+    // outputs via the operation op, optionally weighted by weights_ob. The outputs
+    // of the evaluations are accumulated lane by lane in a local buffer and then
+    // combined, so that the outputs of the individual evaluations are never
+    // written to memory.
+    py::array eval_reduce(const py::array &inputs, const std::optional<py::array> &pars, const std::string &op,
+                          std::optional<py::iterable> weights_ob, T *buf_in_ptr, T *buf_out_ptr,
+                          T *buf_par_ptr) const
+    {
+        using namespace pybind11::literals;
+
+        assert(inputs.ndim() == 2);
+        assert(inputs.shape(1) > 0);
+
+        // Cache the number of evals.
+        const auto nevals = inputs.shape(1);
+
+        // Convert and validate the weights, if provided.
+        std::optional<py::array> weights = weights_ob ? from_dlpack(*weights_ob) : std::optional<py::array>{};
+        if (weights) {
+            const auto dt = get_dtype<T>();
+            if (weights->dtype().num() != dt) {
+                *weights = weights->attr("astype")(py::dtype(dt), "casting"_a = "safe");
+            }
 
-                            // Check if we can write to the outputs.
-                            if (!outputs_->writeable()) {
-                                heypy::py_throw(PyExc_ValueError, "The array of outputs provided for the evaluation "
-                                                                  "of a compiled function is not writeable");
-                            }
+            if (weights->ndim() != 1 || weights->shape(0) != nevals) {
+                heypy::py_throw(PyExc_ValueError,
+                                fmt::format("The array of weights provided for the evaluation of a compiled function "
+                                            "must be one-dimensional with a size of {} (i.e., the number of "
+                                            "evaluations)",
+                                            nevals)
+                                    .c_str());
+            }
 
-                            // Validate the number of dimensions for the outputs.
-                            if (outputs_->ndim() != inputs.ndim()) {
-                                heypy::py_throw(PyExc_ValueError,
-                                                fmt::format("The array of outputs provided for the evaluation "
-                                                            "of a compiled function has {} dimension(s), "
-                                                            "but it must have {} dimension(s) instead (i.e., the same "
-                                                            "number of dimensions as the array of inputs)",
-                                                            outputs_->ndim(), inputs.ndim())
-                                                    .c_str());
-                            }
+#if defined(HEYOKA_HAVE_REAL)
 
-                            // Check the number of outputs.
-                            if (boost::numeric_cast<std::uint32_t>(outputs_->shape(0)) != nouts) {
-                                heypy::py_throw(
-                                    PyExc_ValueError,
-                                    fmt::format("The array of outputs provided for the evaluation "
-                                                "of a compiled function has size {} in the first dimension, "
-                                                "but it must have a size of {} instead (i.e., the size in the "
-                                                "first dimension must be equal to the number of outputs)",
-                                                outputs_->shape(0), nouts)
-                                        .c_str());
-                            }
+            if constexpr (std::is_same_v<T, mppp::real>) {
+                pyreal_check_array(*weights, boost::numeric_cast<mpfr_prec_t>(prec));
+            }
 
-                            // If we are running multiple evaluations, the number must
-                            // be consistent between inputs and outputs.
-                            if (multi_eval && outputs_->shape(1) != inputs.shape(1)) {
-                                heypy::py_throw(
-                                    PyExc_ValueError,
-                                    fmt::format("The size in the second dimension for the output array provided for "
-                                                "the evaluation of a compiled function ({}) must match the size in the "
-                                                "second dimension for the array of inputs ({})",
-                                                outputs_->shape(1), inputs.shape(1))
-                                        .c_str());
-                            }
+#endif
+        }
+
+        const auto is_max = op == "max", is_min = op == "min";
+
+        // Helper to accumulate val into acc. If first is true,
+        // acc is initialised with val.
+        // NOTE: NaNs are propagated by max/min, consistently with NumPy.
+        const auto accumulate = [is_max, is_min](T &acc, const T &val, bool first) {
+            if (first) {
+                acc = val;
+            } else if (is_max) {
+                if (!fp_isnan(acc) && (fp_isnan(val) || val > acc)) {
+                    acc = val;
+                }
+            } else if (is_min) {
+                if (!fp_isnan(acc) && (fp_isnan(val) || val < acc)) {
+                    acc = val;
+                }
+            } else {
+                acc += val;
+            }
+        };
 
-                            return std::move(*outputs_);
-                        } else {
-                            // Create the outputs array.
-                            if (multi_eval) {
-                                return py::array(inputs.dtype(),
-                                                 py::array::ShapeContainer{boost::numeric_cast<py::ssize_t>(nouts),
-                                                                           inputs.shape(1)});
-                            } else {
-                                return py::array(inputs.dtype(),
-                                                 py::array::ShapeContainer{boost::numeric_cast<py::ssize_t>(nouts)});
-                            }
-                        }
-                    }();
+        // Signed version of the recommended simd size.
+        const auto ss_size = boost::numeric_cast<py::ssize_t>(simd_size);
 
-#if defined(HEYOKA_HAVE_REAL)
+        // Number of simd blocks in the arrays.
+        const auto n_simd_blocks = nevals / ss_size;
+
+        // Number of lanes in use in the accumulators.
+        const auto nlanes = n_simd_blocks > 0 ? ss_size : py::ssize_t(1);
+
+        // The accumulators for the outputs and the weights.
+        std::vector<T> acc, w_acc;
+        acc.resize(boost::numeric_cast<decltype(acc.size())>(nouts * nlanes));
+        w_acc.resize(boost::numeric_cast<decltype(w_acc.size())>(nlanes));
+
+        // Unchecked access to inputs.
+        auto u_inputs = inputs.template unchecked<T, 2>();
+
+        // Evaluate over the simd blocks.
+        for (py::ssize_t k = 0; k < n_simd_blocks; ++k) {
+            // Copy over the input data.
+            for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nvars); ++i) {
+                for (py::ssize_t j = 0; j < ss_size; ++j) {
+                    buf_in_ptr[i * ss_size + j] = u_inputs(i, k * ss_size + j);
+                }
+            }
 
-                    if constexpr (std::is_same_v<T, mppp::real>) {
-                        // For mppp::real:
-                        // - check that the inputs array contains values with the correct precision,
-                        // - ensure that the outputs array contains constructed values with the correct
-                        //   precision.
-                        pyreal_check_array(inputs, boost::numeric_cast<mpfr_prec_t>(prec));
-                        pyreal_ensure_array(outputs, boost::numeric_cast<mpfr_prec_t>(prec));
+            // Copy over the pars.
+            if (pars) {
+                auto u_pars = pars->template unchecked<T, 2>();
+
+                for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nparams); ++i) {
+                    for (py::ssize_t j = 0; j < ss_size; ++j) {
+                        buf_par_ptr[i * ss_size + j] = u_pars(i, k * ss_size + j);
                     }
+                }
+            }
 
-#endif
+            // Run the evaluation.
+            fptr_batch(buf_out_ptr, buf_in_ptr, buf_par_ptr);
 
-                    // Check the pars array, if necessary.
-                    if (pars) {
-                        // Validate the number of dimensions.
-                        if (pars->ndim() != inputs.ndim()) {
-                            heypy::py_throw(PyExc_ValueError,
-                                            fmt::format("The array of parameter values provided for the evaluation "
-                                                        "of a compiled function has {} dimension(s), "
-                                                        "but it must have {} dimension(s) instead (i.e., the same "
-                                                        "number of dimensions as the array of inputs)",
-                                                        pars->ndim(), inputs.ndim())
-                                                .c_str());
-                        }
+            // Accumulate the outputs.
+            if (weights) {
+                auto u_weights = weights->template unchecked<T, 1>();
 
-                        // Check the number of pars.
-                        if (boost::numeric_cast<std::uint32_t>(pars->shape(0)) != nparams) {
-                            heypy::py_throw(
-                                PyExc_ValueError,
-                                fmt::format(
-                                    "The array of parameter values provided for the evaluation "
-                                    "of a compiled function has size {} in the first dimension, "
-                                    "but it must have a size of {} instead (i.e., the size in the "
-                                    "first dimension must be equal to the number of parameters in the function)",
-                                    pars->shape(0), nparams)
-                                    .c_str());
-                        }
+                for (py::ssize_t j = 0; j < ss_size; ++j) {
+                    const auto &w = u_weights(k * ss_size + j);
 
-                        // If we are running multiple evaluations, the number must
-                        // be consistent between inputs and pars.
-                        if (multi_eval && pars->shape(1) != inputs.shape(1)) {
-                            heypy::py_throw(
-                                PyExc_ValueError,
-                                fmt::format("The size in the second dimension for the array of parameter values "
-                                            "provided for "
-                                            "the evaluation of a compiled function ({}) must match the size in the "
-                                            "second dimension for the array of inputs ({})",
-                                            pars->shape(1), inputs.shape(1))
-                                    .c_str());
-                        }
+                    for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nouts); ++i) {
+                        accumulate(acc[static_cast<std::size_t>(i * nlanes + j)], buf_out_ptr[i * ss_size + j] * w,
+                                   k == 0);
+                    }
+
+                    accumulate(w_acc[static_cast<std::size_t>(j)], w, k == 0);
+                }
+            } else {
+                for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nouts); ++i) {
+                    for (py::ssize_t j = 0; j < ss_size; ++j) {
+                        accumulate(acc[static_cast<std::size_t>(i * nlanes + j)], buf_out_ptr[i * ss_size + j],
+                                   k == 0);
+                    }
+                }
+            }
+        }
+
+        // Handle the remainder, if present. The remainder
+        // is accumulated in the first lane.
+        for (auto k = n_simd_blocks * ss_size; k < nevals; ++k) {
+            for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nvars); ++i) {
+                buf_in_ptr[i] = u_inputs(i, k);
+            }
+
+            if (pars) {
+                auto u_pars = pars->template unchecked<T, 2>();
+
+                for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nparams); ++i) {
+                    buf_par_ptr[i] = u_pars(i, k);
+                }
+            }
+
+            fptr_scal(buf_out_ptr, buf_in_ptr, buf_par_ptr);
+
+            if (weights) {
+                auto u_weights = weights->template unchecked<T, 1>();
+                const auto &w = u_weights(k);
+
+                for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nouts); ++i) {
+                    accumulate(acc[static_cast<std::size_t>(i * nlanes)], buf_out_ptr[i] * w, k == 0);
+                }
+
+                accumulate(w_acc[0], w, k == 0);
+            } else {
+                for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nouts); ++i) {
+                    accumulate(acc[static_cast<std::size_t>(i * nlanes)], buf_out_ptr[i], k == 0);
+                }
+            }
+        }
+
+        // Combine the lanes.
+        for (py::ssize_t j = 1; j < nlanes; ++j) {
+            for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nouts); ++i) {
+                accumulate(acc[static_cast<std::size_t>(i * nlanes)], acc[static_cast<std::size_t>(i * nlanes + j)],
+                           false);
+            }
+
+            if (weights) {
+                accumulate(w_acc[0], w_acc[static_cast<std::size_t>(j)], false);
+            }
+        }
+
+        // Compute the mean, if requested.
+        if (op == "mean") {
+            T div = weights ? w_acc[0] : T(nevals);
 
 #if defined(HEYOKA_HAVE_REAL)
 
-                        if constexpr (std::is_same_v<T, mppp::real>) {
-                            // For mppp::real, check that the pars array is filled
-                            // with constructed values with the correct precision.
-                            pyreal_check_array(*pars, boost::numeric_cast<mpfr_prec_t>(prec));
-                        }
+            if constexpr (std::is_same_v<T, mppp::real>) {
+                // Ensure that the divisor has the precision of the function.
+                div.prec_round(boost::numeric_cast<mpfr_prec_t>(prec));
+            }
 
 #endif
-                    }
 
-                    // Check if we can use a zero-copy implementation. This is enabled
-                    // for C-style contiguous aligned arrays guaranteed not to share any data.
-                    bool zero_copy = is_npy_array_carray(inputs) && is_npy_array_carray(outputs)
-                                     && (!pars || is_npy_array_carray(*pars));
-                    if (zero_copy) {
-                        const auto maybe_share_memory
-                            = pars ? may_share_memory(inputs, outputs, *pars) : may_share_memory(inputs, outputs);
-                        if (maybe_share_memory) {
-                            zero_copy = false;
-                        }
-                    }
+            for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nouts); ++i) {
+                acc[static_cast<std::size_t>(i * nlanes)] /= div;
+            }
+        }
 
-                    // Fetch pointers to the buffers, to decrease typing.
-                    const auto buf_in_ptr = buf_in.data();
-                    const auto buf_out_ptr = buf_out.data();
-                    const auto buf_par_ptr = buf_pars.data();
+        // Write the result.
+        py::array ret(inputs.dtype(), py::array::ShapeContainer{boost::numeric_cast<py::ssize_t>(nouts)});
 
-                    // Run the evaluation.
-                    if (multi_eval) {
-                        // Signed version of the recommended simd size.
-                        const auto ss_size = boost::numeric_cast<py::ssize_t>(simd_size);
-
-                        // Cache the number of evals.
-                        const auto nevals = inputs.shape(1);
-
-                        // Number of simd blocks in the arrays.
-                        const auto n_simd_blocks = nevals / ss_size;
-
-                        if (zero_copy) {
-                            // Safely cast nevals to size_t to compute
-                            // the stride value.
-                            const auto stride = boost::numeric_cast<std::size_t>(nevals);
-
-                            // Cache pointers.
-                            auto *out_data = static_cast<T *>(outputs.mutable_data());
-                            auto *in_data = static_cast<const T *>(inputs.data());
-                            auto *par_data = pars ? static_cast<const T *>(pars->data()) : nullptr;
-                            // NOTE: we define these two boolean variables in order
-                            // to avoid doing pointer arithmetic (when invoking fptr_batch_s)
-                            // on bogus pointers (such as nullptr). This could happen for instance
-                            // if the function has no inputs, or if an empty pars array was provided
-                            // (that is, in both cases we would be dealing with numpy arrays
-                            // with shape (0, nevals)). In other words, while we assume
-                            // calling .data() on any numpy array is always safe, we are taking
-                            // precautions when doing arithmetics on the pointer returned by .data().
-                            const auto with_inputs = nvars > 0u;
-                            const auto with_pars = nparams > 0u;
-
-                            // Evaluate over the simd blocks.
-                            for (py::ssize_t k = 0; k < n_simd_blocks; ++k) {
-                                const auto start_offset = k * ss_size;
-
-                                // Run the evaluation.
-                                fptr_batch_s(out_data + start_offset, with_inputs ? in_data + start_offset : nullptr,
-                                             with_pars ? par_data + start_offset : nullptr, stride);
-                            }
+#if defined(HEYOKA_HAVE_REAL)
 
-                            // Handle the remainder, if present.
-                            for (auto k = n_simd_blocks * ss_size; k < nevals; ++k) {
-                                fptr_scal_s(out_data + k, with_inputs ? in_data + k : nullptr,
-                                            with_pars ? par_data + k : nullptr, stride);
-                            }
-                        } else {
-                            // Unchecked access to inputs and outputs.
-                            auto u_inputs = inputs.template unchecked<T, 2>();
-                            auto u_outputs = outputs.template mutable_unchecked<T, 2>();
-
-                            // Evaluate over the simd blocks.
-                            for (py::ssize_t k = 0; k < n_simd_blocks; ++k) {
-                                // Copy over the input data.
-                                for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nvars); ++i) {
-                                    for (py::ssize_t j = 0; j < ss_size; ++j) {
-                                        buf_in_ptr[i * ss_size + j] = u_inputs(i, k * ss_size + j);
-                                    }
-                                }
-
-                                // Copy over the pars.
-                                if (pars) {
-                                    auto u_pars = pars->template unchecked<T, 2>();
-
-                                    for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nparams); ++i) {
-                                        for (py::ssize_t j = 0; j < ss_size; ++j) {
-                                            buf_par_ptr[i * ss_size + j] = u_pars(i, k * ss_size + j);
-                                        }
-                                    }
-                                }
-
-                                // Run the evaluation.
-                                fptr_batch(buf_out_ptr, buf_in_ptr, buf_par_ptr);
-
-                                // Write the outputs.
-                                for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nouts); ++i) {
-                                    for (py::ssize_t j = 0; j < ss_size; ++j) {
-                                        u_outputs(i, k * ss_size + j) = buf_out_ptr[i * ss_size + j];
-                                    }
-                                }
-                            }
+        if constexpr (std::is_same_v<T, mppp::real>) {
+            pyreal_ensure_array(ret, boost::numeric_cast<mpfr_prec_t>(prec));
+        }
 
-                            // Handle the remainder, if present.
-                            for (auto k = n_simd_blocks * ss_size; k < nevals; ++k) {
-                                for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nvars); ++i) {
-                                    buf_in_ptr[i] = u_inputs(i, k);
-                                }
+#endif
 
-                                if (pars) {
-                                    auto u_pars = pars->template unchecked<T, 2>();
+        auto u_ret = ret.template mutable_unchecked<T, 1>();
+        for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nouts); ++i) {
+            u_ret(i) = std::move(acc[static_cast<std::size_t>(i * nlanes)]);
+        }
 
-                                    for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nparams); ++i) {
-                                        buf_par_ptr[i] = u_pars(i, k);
-                                    }
-                                }
+        return ret;
+    }
+};
 
-                                fptr_scal(buf_out_ptr, buf_in_ptr, buf_par_ptr);
+// Compile the function fn with respect to the variables vars.
+template <typename T>
+cfunc_obj<T> compile_cfunc(std::vector<hey::expression> fn, std::vector<hey::expression> vars, bool high_accuracy,
+                           bool compact_mode, bool parallel_mode, unsigned opt_level, bool force_avx512,
+                           std::uint32_t simd_size, bool fast_math, long long prec)
+{
+    namespace kw = hey::kw;
 
-                                for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nouts); ++i) {
-                                    u_outputs(i, k) = buf_out_ptr[i];
-                                }
-                            }
-                        }
-                    } else {
-                        if (zero_copy) {
-                            fptr_scal(static_cast<T *>(outputs.mutable_data()), static_cast<const T *>(inputs.data()),
-                                      pars ? static_cast<const T *>(pars->data()) : nullptr);
-                        } else {
-                            // Copy over the input data.
-                            auto u_inputs = inputs.template unchecked<T, 1>();
-                            for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nvars); ++i) {
-                                buf_in_ptr[i] = u_inputs(i);
-                            }
+    // Add the compiled functions.
+    using ptr_t = typename cfunc_obj<T>::ptr_t;
+    ptr_t fptr_scal = nullptr, fptr_batch = nullptr;
+    using ptr_s_t = typename cfunc_obj<T>::ptr_s_t;
+    ptr_s_t fptr_scal_s = nullptr, fptr_batch_s = nullptr;
+
+    hey::llvm_state s_scal{kw::opt_level = opt_level, kw::force_avx512 = force_avx512, kw::fast_math = fast_math},
+        s_batch{kw::opt_level = opt_level, kw::force_avx512 = force_avx512, kw::fast_math = fast_math};
+
+    {
+        // NOTE: release the GIL during compilation.
+        py::gil_scoped_release release;
+
+        oneapi::tbb::parallel_invoke(
+            [&]() {
+                // Scalar.
+                hey::add_cfunc<T>(s_scal, "cfunc", fn, kw::vars = vars, kw::high_accuracy = high_accuracy,
+                                  kw::compact_mode = compact_mode, kw::parallel_mode = parallel_mode,
+                                  kw::prec = prec);
+
+                s_scal.compile();
+
+                fptr_scal = reinterpret_cast<ptr_t>(s_scal.jit_lookup("cfunc"));
+                fptr_scal_s = reinterpret_cast<ptr_s_t>(s_scal.jit_lookup("cfunc.strided"));
+            },
+            [&]() {
+                // Batch.
+                hey::add_cfunc<T>(s_batch, "cfunc", fn, kw::vars = vars, kw::batch_size = simd_size,
+                                  kw::high_accuracy = high_accuracy, kw::compact_mode = compact_mode,
+                                  kw::parallel_mode = parallel_mode, kw::prec = prec);
+
+                s_batch.compile();
+
+                fptr_batch = reinterpret_cast<ptr_t>(s_batch.jit_lookup("cfunc"));
+                fptr_batch_s = reinterpret_cast<ptr_s_t>(s_batch.jit_lookup("cfunc.strided"));
+            });
+    }
+
+    // Let's figure out if fn contains params.
+    std::uint32_t nparams = 0;
+    for (const auto &ex : fn) {
+        nparams = std::max<std::uint32_t>(nparams, hey::get_param_size(ex));
+    }
+
+    cfunc_obj<T> ret;
+    ret.s_scal = std::move(s_scal);
+    ret.s_batch = std::move(s_batch);
+    ret.simd_size = simd_size;
+    ret.nparams = nparams;
+    // NOTE: static casts are fine, because add_cfunc()
+    // succeeded and that guarantees that the number of vars and outputs
+    // fits in a 32-bit int.
+    ret.nouts = static_cast<std::uint32_t>(fn.size());
+    ret.nvars = static_cast<std::uint32_t>(vars.size());
+    ret.fptr_scal = fptr_scal;
+    ret.fptr_batch = fptr_batch;
+    ret.fptr_scal_s = fptr_scal_s;
+    ret.fptr_batch_s = fptr_batch_s;
+    ret.prec = prec;
+    ret.fn = std::move(fn);
+    ret.vars = std::move(vars);
+    ret.high_accuracy = high_accuracy;
+    ret.compact_mode = compact_mode;
+    ret.parallel_mode = parallel_mode;
+    ret.opt_level = opt_level;
+    ret.force_avx512 = force_avx512;
+    ret.fast_math = fast_math;
+
+    return ret;
+}
 
-                            // Copy over the pars.
-                            if (pars) {
-                                auto u_pars = pars->template unchecked<T, 1>();
+// NOTE: c_type is the name of the C type corresponding
+// to T, which is reported in the signature of the compiled functions.
+template <typename T>
+void expose_add_cfunc_impl(py::module &m, const char *suffix, const char *c_type)
+{
+    using namespace pybind11::literals;
 
-                                for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nparams); ++i) {
-                                    buf_par_ptr[i] = u_pars(i);
-                                }
-                            }
+    // Expose the compiled function class.
+    py::class_<cfunc_obj<T>> cf_cl(m, fmt::format("_cfunc_{}", suffix).c_str(), py::dynamic_attr{});
+    cf_cl.def("__call__", &cfunc_obj<T>::operator(), "inputs"_a, "outputs"_a = py::none{}, "pars"_a = py::none{},
+              "reduce"_a = py::none{}, "weights"_a = py::none{}, "out_idx"_a = py::none{});
+    cf_cl.def("eval_csr", &cfunc_obj<T>::eval_csr, "inputs"_a, "shape"_a, "pars"_a = py::none{});
+    cf_cl.def_property_readonly("nz_outputs", [](cfunc_obj<T> &cf) { return cf.nz_outputs(); });
+    cf_cl.def_property_readonly("nvars", [](const cfunc_obj<T> &cf) { return cf.nvars; });
+    cf_cl.def_property_readonly("nouts", [](const cfunc_obj<T> &cf) { return cf.nouts; });
+    cf_cl.def_property_readonly("nparams", [](const cfunc_obj<T> &cf) { return cf.nparams; });
+    cf_cl.def_property_readonly("batch_size", [](const cfunc_obj<T> &cf) { return cf.simd_size; });
+
+    // The addresses of the JIT-compiled functions, for use from
+    // native code (e.g., via ctypes, cffi or Numba).
+    // NOTE: the addresses remain valid as long as the compiled
+    // function object is alive.
+    cf_cl.def_property_readonly(
+        "fptr_scal", [](const cfunc_obj<T> &cf) { return reinterpret_cast<std::uintptr_t>(cf.fptr_scal); });
+    cf_cl.def_property_readonly(
+        "fptr_scal_s", [](const cfunc_obj<T> &cf) { return reinterpret_cast<std::uintptr_t>(cf.fptr_scal_s); });
+    cf_cl.def_property_readonly(
+        "fptr_batch", [](const cfunc_obj<T> &cf) { return reinterpret_cast<std::uintptr_t>(cf.fptr_batch); });
+    cf_cl.def_property_readonly(
+        "fptr_batch_s", [](const cfunc_obj<T> &cf) { return reinterpret_cast<std::uintptr_t>(cf.fptr_batch_s); });
+
+    // Machine-readable description of the calling convention
+    // of the compiled functions. The plain functions have the signature
+    // void(out, in, pars), the strided functions have the signature
+    // void(out, in, pars, stride). In the batch functions, the inputs,
+    // outputs and pars are stored in row-major arrays of shape (n, batch_size)
+    // (or with a row stride of "stride" elements in the strided variants).
+    cf_cl.def_property_readonly("signature", [c_type](const cfunc_obj<T> &cf) {
+        py::dict ret;
+
+        ret["dtype"] = py::dtype(get_dtype<T>());
+        ret["c_type"] = c_type;
+        ret["restype"] = "void";
+        ret["argtypes"] = py::make_tuple(fmt::format("{} *", c_type), fmt::format("const {} *", c_type),
+                                         fmt::format("const {} *", c_type));
+        ret["argtypes_s"] = py::make_tuple(fmt::format("{} *", c_type), fmt::format("const {} *", c_type),
+                                           fmt::format("const {} *", c_type), "size_t");
+        ret["argnames"] = py::make_tuple("out", "in", "pars");
+        ret["argnames_s"] = py::make_tuple("out", "in", "pars", "stride");
+        ret["nvars"] = cf.nvars;
+        ret["nouts"] = cf.nouts;
+        ret["nparams"] = cf.nparams;
+        ret["batch_size"] = cf.simd_size;
+
+        return ret;
+    });
+
+    // Copy/deepcopy.
+    cf_cl.def("__copy__", copy_wrapper<cfunc_obj<T>>);
+    cf_cl.def("__deepcopy__", deepcopy_wrapper<cfunc_obj<T>>, "memo"_a);
 
-                            // Run the evaluation.
-                            fptr_scal(buf_out_ptr, buf_in_ptr, buf_par_ptr);
+    m.def(
+        fmt::format("_add_cfunc_{}", suffix).c_str(),
+        [](const std::vector<hey::expression> &fn, const std::optional<std::vector<hey::expression>> &vars,
+           bool high_accuracy, bool compact_mode, bool parallel_mode, unsigned opt_level, bool force_avx512,
+           std::optional<std::uint32_t> batch_size, bool fast_math, long long prec) {
+            // Compute the SIMD size.
+            const auto simd_size = batch_size ? *batch_size : hey::recommended_simd_size<T>();
 
-                            // Write the outputs.
-                            auto u_outputs = outputs.template mutable_unchecked<T, 1>();
-                            for (py::ssize_t i = 0; i < static_cast<py::ssize_t>(nouts); ++i) {
-                                u_outputs(i) = buf_out_ptr[i];
-                            }
-                        }
+            // Forbid batch sizes > 1 for everything but double.
+            if (!std::is_same_v<T, double> && simd_size > 1u) {
+                py_throw(PyExc_ValueError, "Batch sizes greater than 1 are not supported for this floating-point type");
+            }
+
+            // Determine the list of variables.
+            std::vector<hey::expression> vars_list;
+            if (vars) {
+                vars_list = *vars;
+            } else {
+                // NOTE: this is a bit of repetition from add_cfunc(),
+                // which orders the variables alphabetically.
+                // If this becomes an issue, we can consider in the
+                // future changing add_cfunc() to return also the list
+                // of detected variables.
+                std::set<std::string> dvars;
+                for (const auto &ex : fn) {
+                    for (const auto &var : hey::get_variables(ex)) {
+                        dvars.emplace(var);
                     }
+                }
+
+                for (const auto &var : dvars) {
+                    vars_list.emplace_back(hey::variable{var});
+                }
+            }
 
-                    return outputs;
-                },
-                "inputs"_a, "outputs"_a = py::none{}, "pars"_a = py::none{});
+            return compile_cfunc<T>(fn, std::move(vars_list), high_accuracy, compact_mode, parallel_mode, opt_level,
+                                    force_avx512, simd_size, fast_math, prec);
         },
         "fn"_a, "vars"_a = py::none{}, "high_accuracy"_a = false, "compact_mode"_a = default_cm<T>,
         "parallel_mode"_a = false, "opt_level"_a.noconvert() = 3, "force_avx512"_a.noconvert() = false,
@@ -561,19 +1147,19 @@ void expose_add_cfunc_impl(py::module &m, const char *name)
 
 void expose_add_cfunc_dbl(py::module &m)
 {
-    detail::expose_add_cfunc_impl<double>(m, "_add_cfunc_dbl");
+    detail::expose_add_cfunc_impl<double>(m, "dbl", "double");
 }
 
 void expose_add_cfunc_ldbl(py::module &m)
 {
-    detail::expose_add_cfunc_impl<long double>(m, "_add_cfunc_ldbl");
+    detail::expose_add_cfunc_impl<long double>(m, "ldbl", "long double");
 }
 
 #if defined(HEYOKA_HAVE_REAL128)
 
 void expose_add_cfunc_f128(py::module &m)
 {
-    detail::expose_add_cfunc_impl<mppp::real128>(m, "_add_cfunc_f128");
+    detail::expose_add_cfunc_impl<mppp::real128>(m, "f128", "__float128");
 }
 
 #endif
@@ -582,7 +1168,7 @@ void expose_add_cfunc_f128(py::module &m)
 
 void expose_add_cfunc_real(py::module &m)
 {
-    detail::expose_add_cfunc_impl<mppp::real>(m, "_add_cfunc_real");
+    detail::expose_add_cfunc_impl<mppp::real>(m, "real", "mppp::real");
 }
 
 #endif
@@ -9,8 +9,13 @@
 #include <heyoka/config.hpp>
 
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <string>
+#include <vector>
+
+#include <fmt/format.h>
 
 #include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
@@ -111,6 +116,59 @@ bool is_npy_array_carray(const py::array &arr, bool writeable)
     }
 }
 
+// Helper to validate a list of indices selecting a subset of
+// the components of a state vector of size dim. The string
+// argument describes the calling context and it is used
+// to build the error message.
+void check_state_components(const std::vector<std::uint32_t> &comps, std::size_t dim, const char *ctx)
+{
+    if (comps.empty()) {
+        py_throw(PyExc_ValueError, fmt::format("The list of components passed to {} cannot be empty", ctx).c_str());
+    }
+
+    for (const auto idx : comps) {
+        if (idx >= dim) {
+            py_throw(PyExc_ValueError,
+                     fmt::format("Invalid list of components passed to {}: the component index {} is not less "
+                                 "than the dimension of the state vector ({})",
+                                 ctx, idx, dim)
+                         .c_str());
+        }
+    }
+}
+
+// Helper to convert the string name of a layout into a batch_layout.
+// The string argument describes the calling context and it is
+// used to build the error message.
+batch_layout parse_batch_layout(const std::string &name, const char *ctx)
+{
+    if (name == "component") {
+        return batch_layout::component;
+    }
+
+    if (name == "lane") {
+        return batch_layout::lane;
+    }
+
+    py_throw(PyExc_ValueError,
+             fmt::format("Invalid layout '{}' passed to {}: the layout must be either 'component' or 'lane'", name, ctx)
+                 .c_str());
+}
+
+// Helper to convert an object supporting the DLPack protocol
+// (e.g., a PyTorch tensor or a JAX array) into a NumPy array.
+// NOTE: the conversion is zero-copy, and the returned array keeps
+// the original object alive. If o is already a NumPy array or it
+// does not support the DLPack protocol, o is returned unchanged.
+py::object from_dlpack(const py::handle &o)
+{
+    if (PyArray_Check(o.ptr()) || !py::hasattr(o, "__dlpack__")) {
+        return py::reinterpret_borrow<py::object>(o);
+    }
+
+    return py::module_::import("numpy").attr("from_dlpack")(o);
+}
+
 namespace detail
 {
 
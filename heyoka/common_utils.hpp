@@ -11,9 +11,12 @@
 
 #include <array>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <optional>
 #include <string>
 #include <utility>
+#include <vector>
 
 #if defined(__GLIBCXX__)
 
@@ -203,6 +206,51 @@ bool may_share_memory(const py::array &a, const py::array &b, const Args &...arg
 // the array must also be writeable or not.
 bool is_npy_array_carray(const py::array &, bool = false);
 
+// Helper to validate a list of indices selecting a subset of
+// the components of a state vector of size dim. The string
+// argument describes the calling context and it is used
+// to build the error message.
+void check_state_components(const std::vector<std::uint32_t> &, std::size_t, const char *);
+
+// The memory layouts of the arrays returned by the batch integrators
+// and by the batch continuous output objects:
+// - component: the batch lanes are the fastest-varying dimension, e.g., (n, dim, batch_size)
+//   (this is the internal layout used by heyoka),
+// - lane: the batch lanes are the slowest-varying dimension, e.g., (batch_size, n, dim),
+//   so that the data pertaining to each lane is contiguous.
+enum class batch_layout { component, lane };
+
+// Helper to convert the string name of a layout into a batch_layout.
+// The string argument describes the calling context and it is
+// used to build the error message.
+batch_layout parse_batch_layout(const std::string &, const char *);
+
+// Helper to write the i-th of n (nrows, bs) blocks of data stored
+// in component layout at src into the lane layout array dst, whose shape
+// is (bs, n, ncomps). If comps is provided, only the selected rows are
+// written (ncomps = comps->size()), otherwise all rows are written (ncomps = nrows).
+// NOTE: this does not call into the Python interpreter, so it is safe
+// to invoke it with the GIL released.
+template <typename T>
+inline void write_lane_block(T *dst, const T *src, std::size_t i, std::size_t n, std::size_t nrows, std::size_t bs,
+                             const std::optional<std::vector<std::uint32_t>> &comps)
+{
+    const auto ncomps = comps ? comps->size() : nrows;
+
+    for (std::size_t lane = 0; lane < bs; ++lane) {
+        auto *out_ptr = dst + (lane * n + i) * ncomps;
+
+        for (std::size_t k = 0; k < ncomps; ++k) {
+            const auto row = comps ? static_cast<std::size_t>((*comps)[k]) : k;
+            out_ptr[k] = src[row * bs + lane];
+        }
+    }
+}
+
+// Helper to convert an object supporting the DLPack protocol
+// into a NumPy array sharing its memory.
+py::object from_dlpack(const py::handle &);
+
 namespace detail
 {
 
@@ -0,0 +1,421 @@
+// Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+//
+// This file is part of the heyoka.py library.
+//
+// This Source Code Form is subject to the terms of the Mozilla
+// Public License v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <boost/math/tools/toms748_solve.hpp>
+#include <boost/numeric/conversion/cast.hpp>
+
+#include <fmt/format.h>
+
+#include <oneapi/tbb/blocked_range.h>
+#include <oneapi/tbb/parallel_for.h>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <Python.h>
+
+#include <heyoka/taylor.hpp>
+
+#include "common_utils.hpp"
+#include "conjunctions.hpp"
+#include "custom_casters.hpp"
+
+namespace heyoka_py
+{
+
+namespace py = pybind11;
+namespace hey = heyoka;
+
+namespace detail
+{
+
+namespace
+{
+
+// Lightweight view on the data of a continuous output object.
+struct c_out_view {
+    const double *tcs = nullptr;
+    const double *times = nullptr;
+    std::size_t n_steps = 0;
+    std::size_t nvars = 0;
+    std::size_t ncoeffs = 0;
+
+    // Index of the step containing the time coordinate t.
+    // NOTE: t is clamped to the time range of the object.
+    std::size_t step_index(double t) const
+    {
+        assert(n_steps > 0u);
+
+        const auto it = std::upper_bound(times, times + n_steps + 1u, t);
+        const auto idx = static_cast<std::size_t>(it - times);
+
+        return idx == 0u ? std::size_t(0) : std::min(idx - 1u, n_steps - 1u);
+    }
+
+    // Pointer to the Taylor coefficients of the state variable var in the step s.
+    const double *coeffs(std::size_t s, std::uint32_t var) const
+    {
+        return tcs + (s * nvars + var) * ncoeffs;
+    }
+};
+
+// Evaluate the Taylor polynomial cf with n coefficients and its
+// derivative at h via Horner's scheme.
+std::pair<double, double> poly_eval_d(const double *cf, std::size_t n, double h)
+{
+    double p = cf[n - 1u], dp = 0;
+
+    for (auto k = n - 1u; k > 0u; --k) {
+        dp = dp * h + p;
+        p = p * h + cf[k - 1u];
+    }
+
+    return {p, dp};
+}
+
+// Compute an enclosure of the range of the Taylor polynomial cf
+// with n coefficients over the interval [ha, hb] via interval Horner.
+std::pair<double, double> poly_enclosure(const double *cf, std::size_t n, double ha, double hb)
+{
+    double lo = cf[n - 1u], hi = lo;
+
+    for (auto k = n - 1u; k > 0u; --k) {
+        const std::array prods = {lo * ha, lo * hb, hi * ha, hi * hb};
+        const auto [mn, mx] = std::minmax_element(prods.begin(), prods.end());
+
+        lo = *mn + cf[k - 1u];
+        hi = *mx + cf[k - 1u];
+    }
+
+    return {lo, hi};
+}
+
+// Axis-aligned bounding box.
+struct aabb {
+    std::array<double, 3> lo, hi;
+};
+
+// A conjunction between the objects i and j, at time tca with distance dca.
+using conj_t = std::tuple<std::size_t, std::size_t, double, double>;
+
+// Screen the conjunctions within the time window [wa, wb].
+// The screening is done in two phases:
+// - in the broad phase, the bounding box of the trajectory of each object
+//   within the window is computed from the Taylor coefficients via interval
+//   arithmetic, and the pairs whose boxes (inflated by thresh) overlap are
+//   identified via sweep and prune along the x axis;
+// - in the narrow phase, for each candidate pair the minima of the distance
+//   are located by finding the sign changes (from negative to positive) of the
+//   derivative of the squared distance via sampling and TOMS 748.
+void screen_window(std::vector<conj_t> &out, const std::vector<c_out_view> &views, double wa, double wb,
+                   double thresh, const std::array<std::uint32_t, 3> &pos_idx, std::uint32_t nsamples)
+{
+    const auto nobjs = views.size();
+
+    // Broad phase: compute the bounding boxes.
+    std::vector<aabb> boxes(nobjs);
+    for (std::size_t k = 0; k < nobjs; ++k) {
+        const auto &v = views[k];
+        auto &box = boxes[k];
+
+        box.lo.fill(std::numeric_limits<double>::infinity());
+        box.hi.fill(-std::numeric_limits<double>::infinity());
+
+        for (auto s = v.step_index(wa); s < v.n_steps && v.times[s] <= wb; ++s) {
+            const auto a = std::max(v.times[s], wa), b = std::min(v.times[s + 1u], wb);
+            if (b < a) {
+                continue;
+            }
+
+            for (auto c = 0u; c < 3u; ++c) {
+                const auto [lo, hi]
+                    = poly_enclosure(v.coeffs(s, pos_idx[c]), v.ncoeffs, a - v.times[s], b - v.times[s]);
+
+                box.lo[c] = std::min(box.lo[c], lo);
+                box.hi[c] = std::max(box.hi[c], hi);
+            }
+        }
+
+        // NOTE: inflate each box by half the threshold, so that
+        // the distance between two objects can be less than thresh
+        // only if their boxes overlap.
+        for (auto c = 0u; c < 3u; ++c) {
+            box.lo[c] -= thresh / 2;
+            box.hi[c] += thresh / 2;
+        }
+    }
+
+    // Broad phase: sweep and prune along the x axis.
+    std::vector<std::size_t> order(nobjs);
+    for (std::size_t k = 0; k < nobjs; ++k) {
+        order[k] = k;
+    }
+    std::sort(order.begin(), order.end(),
+              [&boxes](std::size_t a, std::size_t b) { return boxes[a].lo[0] < boxes[b].lo[0]; });
+
+    std::vector<std::pair<std::size_t, std::size_t>> cands;
+    std::vector<std::size_t> active;
+    for (const auto k : order) {
+        const auto &box = boxes[k];
+
+        // Remove from the active list the boxes which
+        // cannot overlap with the current one along x.
+        active.erase(std::remove_if(active.begin(), active.end(),
+                                    [&](std::size_t a) { return boxes[a].hi[0] < box.lo[0]; }),
+                     active.end());
+
+        for (const auto a : active) {
+            const auto &other = boxes[a];
+
+            if (other.lo[1] <= box.hi[1] && box.lo[1] <= other.hi[1] && other.lo[2] <= box.hi[2]
+                && box.lo[2] <= other.hi[2]) {
+                cands.emplace_back(std::min(a, k), std::max(a, k));
+            }
+        }
+
+        active.push_back(k);
+    }
+
+    // Narrow phase.
+    std::vector<double> bps;
+    for (const auto &[i, j] : cands) {
+        const auto &vi = views[i], &vj = views[j];
+
+        // Build the list of breakpoints, that is, the window
+        // boundaries and the step boundaries of both objects within the window.
+        bps.clear();
+        bps.push_back(wa);
+        bps.push_back(wb);
+        for (const auto *v : {&vi, &vj}) {
+            for (auto s = v->step_index(wa) + 1u; s < v->n_steps && v->times[s] < wb; ++s) {
+                if (v->times[s] > wa) {
+                    bps.push_back(v->times[s]);
+                }
+            }
+        }
+        std::sort(bps.begin(), bps.end());
+        bps.erase(std::unique(bps.begin(), bps.end()), bps.end());
+
+        for (std::size_t b = 0; b + 1u < bps.size(); ++b) {
+            const auto ta = bps[b], tb = bps[b + 1u];
+
+            const auto si = vi.step_index((ta + tb) / 2), sj = vj.step_index((ta + tb) / 2);
+
+            // Helper to compute the derivative of the
+            // squared distance (halved) and the squared distance at t.
+            auto dist_eval = [&](double t) {
+                double g = 0, d2 = 0;
+
+                for (auto c = 0u; c < 3u; ++c) {
+                    const auto [pi, dpi] = poly_eval_d(vi.coeffs(si, pos_idx[c]), vi.ncoeffs, t - vi.times[si]);
+                    const auto [pj, dpj] = poly_eval_d(vj.coeffs(sj, pos_idx[c]), vj.ncoeffs, t - vj.times[sj]);
+
+                    g += (pi - pj) * (dpi - dpj);
+                    d2 += (pi - pj) * (pi - pj);
+                }
+
+                return std::make_pair(g, d2);
+            };
+
+            // NOTE: a minimum is detected when the derivative goes from negative
+            // to non-negative, i.e., in the half-open interval (t_prev, t_cur].
+            // This ensures that a minimum falling exactly on a breakpoint
+            // or on a window boundary is reported only once.
+            auto t_prev = ta;
+            auto g_prev = dist_eval(t_prev).first;
+
+            for (std::uint32_t k = 1; k <= nsamples; ++k) {
+                const auto t_cur = k == nsamples ? tb : ta + (tb - ta) * k / nsamples;
+                const auto g_cur = dist_eval(t_cur).first;
+
+                if (g_prev < 0 && g_cur >= 0) {
+                    double tca = t_cur;
+
+                    if (g_cur != 0) {
+                        std::uintmax_t max_iter = 100;
+                        const auto [r_lb, r_ub] = boost::math::tools::toms748_solve(
+                            [&](double t) { return dist_eval(t).first; }, t_prev, t_cur, g_prev, g_cur,
+                            boost::math::tools::eps_tolerance<double>(), max_iter);
+
+                        tca = (r_lb + r_ub) / 2;
+                    }
+
+                    const auto dca = std::sqrt(dist_eval(tca).second);
+
+                    if (dca < thresh) {
+                        out.emplace_back(i, j, tca, dca);
+                    }
+                }
+
+                t_prev = t_cur;
+                g_prev = g_cur;
+            }
+        }
+    }
+}
+
+} // namespace
+
+} // namespace detail
+
+void expose_conjunctions(py::module_ &m)
+{
+    using namespace pybind11::literals;
+
+    using c_output_t = hey::continuous_output<double>;
+
+    m.def(
+        "screen_conjunctions",
+        [](const py::iterable &c_outs_ob, double thresh, std::optional<double> window,
+           std::array<std::uint32_t, 3> pos_idx, std::uint32_t nsamples) {
+            // NOTE: keep references to the continuous output objects,
+            // so that they stay alive while the GIL is released.
+            std::vector<py::object> c_outs;
+            std::vector<detail::c_out_view> views;
+
+            for (auto ob : c_outs_ob) {
+                const auto &c_out = py::cast<const c_output_t &>(ob);
+
+                if (c_out.get_tcs().empty()) {
+                    py_throw(PyExc_ValueError, "Cannot screen conjunctions with a default-constructed "
+                                               "continuous_output object");
+                }
+
+                const auto nvars = c_out.get_output().size();
+                for (const auto idx : pos_idx) {
+                    if (idx >= nvars) {
+                        py_throw(PyExc_ValueError,
+                                 fmt::format("Invalid position index {} passed to screen_conjunctions(): the index "
+                                             "must be less than the dimension of the state vector ({})",
+                                             idx, nvars)
+                                     .c_str());
+                    }
+                }
+
+                const auto &times = c_out.get_times();
+                const auto n_steps = c_out.get_n_steps();
+                assert(times.size() == n_steps + 1u);
+
+                if (!(times.front() < times.back())) {
+                    py_throw(PyExc_ValueError,
+                             "screen_conjunctions() supports only continuous_output objects produced "
+                             "by forward integrations");
+                }
+
+                detail::c_out_view v;
+                v.tcs = c_out.get_tcs().data();
+                v.times = times.data();
+                v.n_steps = n_steps;
+                v.nvars = nvars;
+                v.ncoeffs = c_out.get_tcs().size() / (n_steps * nvars);
+
+                views.push_back(v);
+                c_outs.emplace_back(py::reinterpret_borrow<py::object>(ob));
+            }
+
+            if (views.size() < 2u) {
+                py_throw(PyExc_ValueError,
+                         "At least 2 continuous_output objects are needed to screen conjunctions");
+            }
+
+            if (!std::isfinite(thresh) || thresh <= 0) {
+                py_throw(PyExc_ValueError,
+                         fmt::format("The conjunction threshold must be finite and positive, but it is {} instead",
+                                     thresh)
+                             .c_str());
+            }
+
+            if (nsamples == 0u) {
+                py_throw(PyExc_ValueError,
+                         "The number of samples per step in screen_conjunctions() cannot be zero");
+            }
+
+            // Determine the common time interval.
+            auto t_begin = -std::numeric_limits<double>::infinity(), t_end = std::numeric_limits<double>::infinity();
+            for (const auto &v : views) {
+                t_begin = std::max(t_begin, v.times[0]);
+                t_end = std::min(t_end, v.times[v.n_steps]);
+            }
+
+            if (!(t_begin < t_end)) {
+                py_throw(PyExc_ValueError,
+                         "The continuous_output objects passed to screen_conjunctions() have no time "
+                         "interval in common");
+            }
+
+            // Determine the window size. By default, use the average
+            // step size, so that the bounding boxes are computed over
+            // time intervals comparable to the validity range of
+            // the Taylor polynomials.
+            if (!window) {
+                double tot_time = 0, tot_steps = 0;
+                for (const auto &v : views) {
+                    tot_time += v.times[v.n_steps] - v.times[0];
+                    tot_steps += static_cast<double>(v.n_steps);
+                }
+
+                window = tot_time / tot_steps;
+            }
+
+            if (!std::isfinite(*window) || *window <= 0) {
+                py_throw(PyExc_ValueError,
+                         fmt::format("The window size must be finite and positive, but it is {} instead", *window)
+                             .c_str());
+            }
+
+            const auto n_win = boost::numeric_cast<std::size_t>(std::ceil((t_end - t_begin) / *window));
+
+            std::vector<std::vector<detail::conj_t>> win_res(n_win);
+
+            {
+                py::gil_scoped_release release;
+
+                oneapi::tbb::parallel_for(oneapi::tbb::blocked_range<std::size_t>(0, n_win), [&](const auto &range) {
+                    for (auto w = range.begin(); w != range.end(); ++w) {
+                        const auto wa = t_begin + static_cast<double>(w) * *window;
+                        const auto wb = w + 1u == n_win ? t_end : t_begin + static_cast<double>(w + 1u) * *window;
+
+                        detail::screen_window(win_res[w], views, wa, wb, thresh, pos_idx, nsamples);
+                    }
+                });
+            }
+
+            // Concatenate and sort the results.
+            std::vector<detail::conj_t> res;
+            for (const auto &wr : win_res) {
+                res.insert(res.end(), wr.begin(), wr.end());
+            }
+            std::sort(res.begin(), res.end(), [](const auto &a, const auto &b) {
+                return std::make_tuple(std::get<2>(a), std::get<0>(a), std::get<1>(a))
+                       < std::make_tuple(std::get<2>(b), std::get<0>(b), std::get<1>(b));
+            });
+
+            py::list ret;
+            for (const auto &[i, j, tca, dca] : res) {
+                ret.append(py::make_tuple(i, j, tca, dca));
+            }
+
+            return ret;
+        },
+        "c_outs"_a, "thresh"_a, "window"_a = py::none{}, "pos_idx"_a = std::array<std::uint32_t, 3>{0, 1, 2},
+        "nsamples"_a = 8u);
+}
+
+} // namespace heyoka_py
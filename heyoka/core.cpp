@@ -14,6 +14,7 @@
 #include <exception>
 #include <initializer_list>
 #include <iostream>
+#include <mutex>
 #include <optional>
 #include <sstream>
 #include <type_traits>
@@ -56,19 +57,25 @@
 #include <heyoka/taylor.hpp>
 
 #include "cfunc.hpp"
+#include "conjunctions.hpp"
 #include "custom_casters.hpp"
 #include "dtypes.hpp"
 #include "expose_batch_integrators.hpp"
 #include "expose_expression.hpp"
+#include "expression_builders.hpp"
 #include "expose_real.hpp"
 #include "expose_real128.hpp"
 #include "logging.hpp"
+#include "parareal.hpp"
 #include "pickle_wrappers.hpp"
 #include "setup_sympy.hpp"
 #include "taylor_add_jet.hpp"
 #include "taylor_expose_c_output.hpp"
 #include "taylor_expose_events.hpp"
 #include "taylor_expose_integrator.hpp"
+#include "taylor_expose_tiered.hpp"
+#include "variational.hpp"
+#include "vsop2013_ephemeris.hpp"
 
 namespace py = pybind11;
 namespace hey = heyoka;
@@ -83,6 +90,10 @@ namespace
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
 std::optional<oneapi::tbb::global_control> tbb_gc;
 
+// Mutex to synchronise access to tbb_gc.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::mutex tbb_gc_mutex;
+
 // Helper to import the NumPy API bits.
 PyObject *import_numpy(PyObject *m)
 {
@@ -104,6 +115,11 @@ PyObject *import_numpy(PyObject *m)
 
 #endif
 
+// NOTE: the module does not declare that it can run without the GIL
+// (py::mod_gil_not_used()) in free-threaded Python builds. Although the
+// global state is thread-safe, stateful objects such as the integrators and
+// the continuous output objects write into internal buffers and return views
+// of them, hence they cannot be safely shared among threads without the GIL.
 PYBIND11_MODULE(core, m)
 {
     using namespace pybind11::literals;
@@ -193,6 +209,9 @@ PYBIND11_MODULE(core, m)
     // Expression.
     heypy::expose_expression(m);
 
+    // Expose the bulk expression builders.
+    heypy::expose_expression_builders(m);
+
     // N-body builders.
     m.def(
         "make_nbody_sys",
@@ -235,6 +254,12 @@ PYBIND11_MODULE(core, m)
         },
         "n"_a, "Gconst"_a = 1., "masses"_a = py::none{});
 
+    // NOTE: make_nbody_par_sys() already shares the r**-3 terms between
+    // the two bodies of each pair (Newton's third law) and skips the
+    // interactions between massless bodies. For large N (hundreds or
+    // thousands of bodies), the size of the compiled code is kept
+    // manageable by constructing the integrator in compact mode,
+    // which turns the parameter-indexed pairwise terms into loops.
     m.def(
         "make_nbody_par_sys",
         [](std::uint32_t n, const py::object &Gconst, std::optional<std::uint32_t> n_massive) {
@@ -248,6 +273,10 @@ PYBIND11_MODULE(core, m)
         },
         "n"_a, "Gconst"_a = 1., "n_massive"_a = py::none{});
 
+    // Variational equations builder.
+    m.def("make_variational_sys", &heypy::make_variational_sys, "sys"_a, "stm"_a = true,
+          "pars"_a = std::vector<std::uint32_t>{});
+
     // mascon dynamics builder
     m.def(
         "make_mascon_system",
@@ -413,6 +442,10 @@ PYBIND11_MODULE(core, m)
 
 #endif
 
+    // Tolerance-tiered integrator pairs.
+    heypy::expose_taylor_tiered_dbl(m);
+    heypy::expose_taylor_tiered_ldbl(m);
+
     // Batch integrators.
     heypy::expose_batch_integrators(m);
 
@@ -443,13 +476,24 @@ PYBIND11_MODULE(core, m)
         "pl_idx"_a, "time"_a = hey::time, "thresh"_a.noconvert() = 1e-9);
     m.def("get_vsop2013_mus", &hey::get_vsop2013_mus);
 
+    // Expose the vsop2013 ephemeris class.
+    heypy::expose_vsop2013_ephemeris(m);
+
     // Expose the continuous output function objects.
     heypy::taylor_expose_c_output(m);
 
+    // Expose the conjunction screening function.
+    heypy::expose_conjunctions(m);
+
+    // Expose the parareal driver.
+    heypy::expose_parareal(m);
+
     // Expose the helpers to get/set the number of threads in use by heyoka.py.
-    // NOTE: these are not thread-safe themselves. Should they be? If not, their
-    // thread unsafety must be highlighted in the docs.
     m.def("set_nthreads", [](std::size_t n) {
+        // NOTE: tbb_gc may also be accessed concurrently
+        // by the atexit cleanup.
+        std::lock_guard lock(heypy::detail::tbb_gc_mutex);
+
         if (n == 0u) {
             heypy::detail::tbb_gc.reset();
         } else {
@@ -468,6 +512,8 @@ PYBIND11_MODULE(core, m)
 #if !defined(NDEBUG)
         std::cout << "Cleaning up the TBB control structure" << std::endl;
 #endif
+        std::lock_guard lock(heypy::detail::tbb_gc_mutex);
+
         heypy::detail::tbb_gc.reset();
     }));
 }
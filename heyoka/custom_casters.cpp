@@ -9,8 +9,14 @@
 #include <heyoka/config.hpp>
 
 #include <cassert>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include <boost/numeric/conversion/cast.hpp>
 
 #include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
 
 #define NO_IMPORT_ARRAY
 #define NO_IMPORT_UFUNC
@@ -36,6 +42,7 @@
 
 #include "common_utils.hpp"
 #include "custom_casters.hpp"
+#include "dtypes.hpp"
 
 #if defined(HEYOKA_HAVE_REAL128)
 
@@ -142,6 +149,78 @@ handle type_caster<mppp::real>::cast(const mppp::real &src, return_value_policy,
 
 #endif
 
+template <typename T>
+bool npy_vector_caster<T>::load(handle src, bool convert)
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    // Objects supporting the DLPack protocol are converted
+    // to NumPy arrays first, so that they can take the fast path.
+    // NOTE: if the conversion fails (e.g., because the tensor lives
+    // on a non-CPU device), signal that the load failed rather than
+    // letting the Python exception escape from the caster.
+    if (!PyArray_Check(src.ptr()) && hasattr(src, "__dlpack__")) {
+        object arr;
+
+        try {
+            arr = heyoka_py::from_dlpack(src);
+        } catch (const error_already_set &) {
+            return false;
+        }
+
+        return load(arr, convert);
+    }
+
+    if (PyArray_Check(src.ptr())) {
+        auto *arr = reinterpret_cast<PyArrayObject *>(src.ptr());
+
+        // NOTE: the fast path is taken only for one-dimensional
+        // arrays with matching dtype in native byte order. In all
+        // other cases, we fall back to the list caster, which will
+        // take care of conversions (if allowed) and error reporting.
+        if (PyArray_NDIM(arr) == 1 && PyArray_TYPE(arr) == heyoka_py::get_dtype<T>() && PyArray_ISNOTSWAPPED(arr)) {
+            auto &vec = this->value;
+
+            const auto size = boost::numeric_cast<decltype(vec.size())>(PyArray_DIM(arr, 0));
+            vec.resize(size);
+
+            if (size == 0u) {
+                return true;
+            }
+
+            const auto *data = static_cast<const char *>(PyArray_DATA(arr));
+
+            if (PyArray_IS_C_CONTIGUOUS(arr)) {
+                // Contiguous array: copy the data in one go.
+                std::memcpy(vec.data(), data, sizeof(T) * size);
+            } else {
+                // Strided array: copy the data element by element.
+                // NOTE: use memcpy in order to deal with
+                // possibly misaligned data.
+                const auto stride = PyArray_STRIDE(arr, 0);
+
+                for (decltype(vec.size()) i = 0; i < size; ++i) {
+                    std::memcpy(vec.data() + i, data + static_cast<npy_intp>(i) * stride, sizeof(T));
+                }
+            }
+
+            return true;
+        }
+    }
+
+    return list_caster<std::vector<T>, T>::load(src, convert);
+}
+
+// Explicit instantiations.
+template struct npy_vector_caster<double>;
+template struct npy_vector_caster<long double>;
+
+#if defined(HEYOKA_HAVE_REAL128)
+
+template struct npy_vector_caster<mppp::real128>;
+
+#endif
+
 } // namespace pybind11::detail
 
 #if defined(__GNUC__)
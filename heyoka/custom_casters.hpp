@@ -11,7 +11,10 @@
 
 #include <heyoka/config.hpp>
 
+#include <vector>
+
 #include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
 
 #if defined(HEYOKA_HAVE_REAL128)
 
@@ -57,6 +60,36 @@ struct type_caster<mppp::real> {
 
 #endif
 
+// Casters for std::vector of floating-point types, implementing
+// a fast path for the conversion from one-dimensional NumPy arrays
+// with matching dtype (the array data is copied directly into the vector
+// without going through the Python objects representing the elements).
+// If the fast path cannot be taken, the generic list caster is used.
+// NOTE: these are full specialisations of the caster defined in
+// pybind11/stl.h, hence this header must be included in every translation
+// unit including pybind11/stl.h.
+// NOTE: mppp::real is not included here as it is not trivially copyable.
+template <typename T>
+struct npy_vector_caster : list_caster<std::vector<T>, T> {
+    bool load(handle, bool);
+};
+
+template <>
+struct type_caster<std::vector<double>> : npy_vector_caster<double> {
+};
+
+template <>
+struct type_caster<std::vector<long double>> : npy_vector_caster<long double> {
+};
+
+#if defined(HEYOKA_HAVE_REAL128)
+
+template <>
+struct type_caster<std::vector<mppp::real128>> : npy_vector_caster<mppp::real128> {
+};
+
+#endif
+
 } // namespace pybind11::detail
 
 #endif
@@ -9,6 +9,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <optional>
 #include <sstream>
 #include <string>
@@ -32,9 +33,11 @@
 #include <heyoka/taylor.hpp>
 
 #include "common_utils.hpp"
+#include "custom_casters.hpp"
 #include "dtypes.hpp"
 #include "expose_batch_integrators.hpp"
 #include "pickle_wrappers.hpp"
+#include "state_outputs.hpp"
 
 namespace heyoka_py
 {
@@ -72,7 +75,7 @@ void expose_batch_integrator_impl(py::module_ &m, const std::string &suffix)
 
         // Convert state and pars to std::vector, after checking
         // dimensions and shape.
-        py::array state_ = state_ob;
+        py::array state_ = from_dlpack(state_ob);
         if (state_.ndim() != 2) {
             py_throw(PyExc_ValueError,
                      fmt::format("Invalid state vector passed to the constructor of a batch integrator: "
@@ -95,7 +98,7 @@ void expose_batch_integrator_impl(py::module_ &m, const std::string &suffix)
         // If pars is none, an empty vector will be fine.
         std::vector<T> pars;
         if (pars_ob) {
-            py::array pars_arr = *pars_ob;
+            py::array pars_arr = from_dlpack(*pars_ob);
 
             if (pars_arr.ndim() != 2 || boost::numeric_cast<std::uint32_t>(pars_arr.shape(1)) != batch_size) {
                 py_throw(PyExc_ValueError,
@@ -116,7 +119,7 @@ void expose_batch_integrator_impl(py::module_ &m, const std::string &suffix)
 
         if (time_ob) {
             // Times provided.
-            py::array time_arr = *time_ob;
+            py::array time_arr = from_dlpack(*time_ob);
             if (time_arr.ndim() != 1 || boost::numeric_cast<std::uint32_t>(time_arr.shape(0)) != batch_size) {
                 py_throw(PyExc_ValueError,
                          fmt::format("Invalid time vector passed to the constructor of a batch integrator: "
@@ -248,7 +251,21 @@ void expose_batch_integrator_impl(py::module_ &m, const std::string &suffix)
         .def(
             "propagate_grid",
             [](hey::taylor_adaptive_batch<T> &ta, const py::iterable &grid_ob, std::size_t max_steps,
-               std::variant<T, std::vector<T>> max_delta_t, const prop_cb_t &cb_) {
+               std::variant<T, std::vector<T>> max_delta_t, const prop_cb_t &cb_,
+               const std::optional<std::vector<std::uint32_t>> &components,
+               const std::optional<py::object> &outputs, const std::string &layout_name) {
+                if (components && outputs) {
+                    py_throw(PyExc_ValueError,
+                             "The 'components' and 'outputs' arguments of propagate_grid() cannot be used together");
+                }
+
+                const auto layout = parse_batch_layout(layout_name, "propagate_grid()");
+
+                // Validate the components, if provided.
+                if (components) {
+                    check_state_components(*components, ta.get_dim(), "propagate_grid()");
+                }
+
                 return std::visit(
                     [&](auto max_dts) {
                         // Attempt to convert grid_ob to an array.
@@ -287,6 +304,15 @@ void expose_batch_integrator_impl(py::module_ &m, const std::string &suffix)
                         const auto grid_v_size = grid_v.size();
 #endif
 
+                        // Compile the output expressions (or fetch the precompiled
+                        // outputs), if provided.
+                        // NOTE: do it before the propagation, so that
+                        // errors are raised without altering the state of ta.
+                        std::shared_ptr<const state_outputs<T>> s_outs;
+                        if (outputs) {
+                            s_outs = fetch_state_outputs<T>(ta, *outputs);
+                        }
+
                         // Create the callback wrapper.
                         auto cb = make_prop_cb(cb_);
 
@@ -294,25 +320,95 @@ void expose_batch_integrator_impl(py::module_ &m, const std::string &suffix)
                         // NOTE: for batch integrators, ret is guaranteed to always have
                         // the same size regardless of errors.
                         decltype(ta.propagate_grid(grid_v, max_steps)) ret;
+                        std::vector<T> outs_v;
                         {
                             py::gil_scoped_release release;
                             ret = ta.propagate_grid(std::move(grid_v), kw::max_steps = max_steps,
                                                     kw::max_delta_t = std::move(max_dts), kw::callback = cb);
+
+                            // Evaluate the outputs on the state vectors.
+                            if (s_outs) {
+                                outs_v = (*s_outs)(ret, ta.get_pars());
+                            }
                         }
 
-                        // Create the output array.
                         assert(ret.size() == grid_v_size * ta.get_dim());
-                        py::array a_ret(grid.dtype(),
-                                        py::array::ShapeContainer{grid.shape(0),
-                                                                  boost::numeric_cast<py::ssize_t>(ta.get_dim()),
-                                                                  grid.shape(1)},
-                                        ret.data());
+
+                        if (layout == batch_layout::lane) {
+                            // Lane layout: write the (n, ncomps, batch_size) output blocks
+                            // directly into a (batch_size, n, ncomps) array, projecting
+                            // onto the requested components on the fly.
+                            const auto npoints = boost::numeric_cast<std::size_t>(grid.shape(0));
+                            const auto bs = static_cast<std::size_t>(ta.get_batch_size());
+                            const auto nrows = static_cast<std::size_t>(s_outs ? s_outs->get_nouts() : ta.get_dim());
+                            const auto ncomps = components ? components->size() : nrows;
+                            const auto *src = s_outs ? outs_v.data() : ret.data();
+
+                            py::array a_ret(grid.dtype(),
+                                            py::array::ShapeContainer{grid.shape(1), grid.shape(0),
+                                                                      boost::numeric_cast<py::ssize_t>(ncomps)});
+                            auto *dst = static_cast<T *>(a_ret.mutable_data());
+
+                            {
+                                py::gil_scoped_release release;
+
+                                for (std::size_t i = 0; i < npoints; ++i) {
+                                    write_lane_block(dst, src + i * nrows * bs, i, npoints, nrows, bs, components);
+                                }
+                            }
+
+                            return a_ret;
+                        }
+
+                        if (s_outs) {
+                            // Return the outputs in place of the state vectors.
+                            py::array a_ret(grid.dtype(),
+                                            py::array::ShapeContainer{
+                                                grid.shape(0), boost::numeric_cast<py::ssize_t>(s_outs->get_nouts()),
+                                                grid.shape(1)},
+                                            outs_v.data());
+
+                            return a_ret;
+                        }
+
+                        // Project the state vectors onto the requested components, if needed.
+                        // NOTE: each grid point corresponds to a (dim, batch_size) block
+                        // in ret, and each component to a contiguous row of batch_size elements
+                        // in the block.
+                        std::vector<T> proj;
+                        if (components) {
+                            const auto dim = ta.get_dim();
+                            const auto bs = ta.get_batch_size();
+                            const auto npoints = ret.size() / (dim * bs);
+
+                            proj.reserve(npoints * components->size() * bs);
+
+                            for (decltype(ret.size()) i = 0; i < npoints; ++i) {
+                                for (const auto idx : *components) {
+                                    const auto *row_ptr = ret.data() + (i * dim + idx) * bs;
+                                    proj.insert(proj.end(), row_ptr, row_ptr + bs);
+                                }
+                            }
+                        }
+
+                        // Create the output array.
+                        const auto ncomps
+                            = boost::numeric_cast<py::ssize_t>(components ? components->size() : ta.get_dim());
+                        py::array a_ret(grid.dtype(), py::array::ShapeContainer{grid.shape(0), ncomps, grid.shape(1)},
+                                        components ? proj.data() : ret.data());
 
                         return a_ret;
                     },
                     std::move(max_delta_t));
             },
-            "grid"_a, "max_steps"_a = 0, "max_delta_t"_a.noconvert() = std::vector<T>{}, "callback"_a = prop_cb_t{})
+            "grid"_a, "max_steps"_a = 0, "max_delta_t"_a.noconvert() = std::vector<T>{}, "callback"_a = prop_cb_t{},
+            "components"_a = py::none{}, "outputs"_a = py::none{}, "layout"_a = "component")
+        .def(
+            "compile_outputs",
+            [](const hey::taylor_adaptive_batch<T> &ta, const std::vector<hey::expression> &outputs) {
+                return std::make_shared<state_outputs<T>>(ta, outputs);
+            },
+            "outputs"_a)
         .def_property_readonly("propagate_res",
                                [](const hey::taylor_adaptive_batch<T> &ta) { return ta.get_propagate_res(); })
         .def_property_readonly(
@@ -382,6 +478,72 @@ void expose_batch_integrator_impl(py::module_ &m, const std::string &suffix)
                                    return py::array(py::dtype(get_dtype<T>()), py::array::ShapeContainer{nvars, bs},
                                                     ta->get_state_data(), o);
                                })
+        .def(
+            "get_state",
+            [](py::object &o, const std::string &layout_name) {
+                auto *ta = py::cast<hey::taylor_adaptive_batch<T> *>(o);
+
+                const auto layout = parse_batch_layout(layout_name, "get_state()");
+
+                const auto dim = ta->get_dim();
+                const auto bs = ta->get_batch_size();
+
+                if (layout == batch_layout::component) {
+                    // NOTE: in component layout, return
+                    // a view on the state data.
+                    return py::array(py::dtype(get_dtype<T>()),
+                                     py::array::ShapeContainer{boost::numeric_cast<py::ssize_t>(dim),
+                                                               boost::numeric_cast<py::ssize_t>(bs)},
+                                     ta->get_state_data(), o);
+                }
+
+                // NOTE: in lane layout, return a contiguous copy.
+                py::array ret(py::dtype(get_dtype<T>()),
+                              py::array::ShapeContainer{boost::numeric_cast<py::ssize_t>(bs),
+                                                        boost::numeric_cast<py::ssize_t>(dim)});
+                write_lane_block(static_cast<T *>(ret.mutable_data()), ta->get_state_data(), 0, 1, dim, bs,
+                                 std::nullopt);
+
+                return ret;
+            },
+            "layout"_a = "component")
+        .def(
+            "set_state",
+            [](hey::taylor_adaptive_batch<T> &ta, const py::iterable &state_ob, const std::string &layout_name) {
+                const auto layout = parse_batch_layout(layout_name, "set_state()");
+
+                const auto dim = boost::numeric_cast<py::ssize_t>(ta.get_dim());
+                const auto bs = boost::numeric_cast<py::ssize_t>(ta.get_batch_size());
+                const auto lane = layout == batch_layout::lane;
+
+                py::array state_arr = from_dlpack(state_ob);
+
+                if (state_arr.ndim() != 2 || state_arr.shape(0) != (lane ? bs : dim)
+                    || state_arr.shape(1) != (lane ? dim : bs)) {
+                    py_throw(PyExc_ValueError,
+                             fmt::format("Invalid state array passed to the set_state() method of a batch integrator: "
+                                         "the expected array shape is ({}, {}), but the input array has either the "
+                                         "wrong number of dimensions or the wrong shape",
+                                         lane ? bs : dim, lane ? dim : bs)
+                                 .c_str());
+                }
+
+                // Enforce the correct dtype.
+                const auto dt = get_dtype<T>();
+                if (state_arr.dtype().num() != dt) {
+                    state_arr = state_arr.attr("astype")(py::dtype(dt), "casting"_a = "safe");
+                }
+
+                auto u_st = state_arr.template unchecked<T, 2>();
+                auto *st_ptr = ta.get_state_data();
+
+                for (py::ssize_t i = 0; i < dim; ++i) {
+                    for (py::ssize_t j = 0; j < bs; ++j) {
+                        st_ptr[i * bs + j] = lane ? u_st(j, i) : u_st(i, j);
+                    }
+                }
+            },
+            "state"_a, "layout"_a = "component")
         .def_property_readonly("pars",
                                [](py::object &o) {
                                    auto *ta = py::cast<hey::taylor_adaptive_batch<T> *>(o);
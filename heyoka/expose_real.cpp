@@ -2240,6 +2240,62 @@ void pyreal_ensure_array(py::array &arr, mpfr_prec_t prec)
     }
 }
 
+// Thread-local arena of scratch real values, keyed by precision and slot index.
+// The function returns a pointer to an array of at least n reals with precision
+// prec, which is reused in subsequent invocations with the same precision and slot
+// index. Because the reals are constructed only when the arena needs to grow,
+// repeated invocations do not allocate memory for the limbs of the values.
+// The slot index allows to fetch multiple independent arrays with the same precision.
+// NOTE: each slot holds the arrays of at most real_scratch_max_precs precisions,
+// ordered from the most to the least recently used. When a new precision is requested
+// and the slot is full, the least recently used array is recycled (and its values are
+// reset to the new precision). Thus, interleaving a few precisions does not reallocate
+// the limbs, and the memory usage does not grow with the number of precisions in use.
+// NOTE: the returned pointer is invalidated by a subsequent invocation
+// with the same slot index from the same thread.
+mppp::real *real_scratch(mpfr_prec_t prec, std::size_t n, unsigned slot)
+{
+    constexpr std::size_t real_scratch_max_precs = 4;
+
+    using entry_t = std::pair<mpfr_prec_t, std::vector<mppp::real>>;
+    thread_local std::array<std::vector<entry_t>, 3> arena;
+
+    assert(slot < arena.size());
+    auto &entries = arena[slot];
+
+    auto it = std::find_if(entries.begin(), entries.end(), [prec](const auto &e) { return e.first == prec; });
+
+    if (it == entries.end()) {
+        if (entries.size() < real_scratch_max_precs) {
+            entries.emplace_back(prec, std::vector<mppp::real>{});
+        } else {
+            // Recycle the least recently used array.
+            auto &vals = entries.back().second;
+            for (auto &val : vals) {
+                val.set_prec(prec);
+            }
+            entries.back().first = prec;
+        }
+
+        it = entries.end() - 1;
+    }
+
+    // Move the entry to the front.
+    std::rotate(entries.begin(), it, it + 1);
+
+    auto &vec = entries.front().second;
+
+    if (vec.size() < n) {
+        vec.reserve(n);
+
+        while (vec.size() < n) {
+            vec.emplace_back(0, prec);
+        }
+    }
+
+    return vec.data();
+}
+
 void expose_real(py::module_ &m)
 {
     // Install the custom NumPy memory management functions.
@@ -15,6 +15,8 @@
 
 #if defined(HEYOKA_HAVE_REAL)
 
+#include <cstddef>
+
 #include <pybind11/numpy.h>
 
 #include <Python.h>
@@ -50,6 +52,8 @@ PyObject *pyreal_from_real(mppp::real &&);
 void pyreal_check_array(const py::array &, mpfr_prec_t = 0);
 void pyreal_ensure_array(py::array &, mpfr_prec_t);
 
+mppp::real *real_scratch(mpfr_prec_t, std::size_t, unsigned);
+
 #endif
 
 void expose_real(py::module_ &);
@@ -0,0 +1,394 @@
+// Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+//
+// This file is part of the heyoka.py library.
+//
+// This Source Code Form is subject to the terms of the Mozilla
+// Public License v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <boost/numeric/conversion/cast.hpp>
+
+#include <fmt/format.h>
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <Python.h>
+
+#include <heyoka/expression.hpp>
+#include <heyoka/math.hpp>
+#include <heyoka/param.hpp>
+
+#include "common_utils.hpp"
+#include "custom_casters.hpp"
+#include "expression_builders.hpp"
+
+namespace heyoka_py
+{
+
+namespace py = pybind11;
+namespace hey = heyoka;
+
+namespace detail
+{
+
+namespace
+{
+
+using coeff_arr_t = py::array_t<double, py::array::c_style | py::array::forcecast>;
+
+// Helper to convert the coefficients ob passed to the builder fname
+// into a contiguous array of doubles with ndim dimensions.
+coeff_arr_t coeff_array(const py::handle &ob, py::ssize_t ndim, const char *fname)
+{
+    coeff_arr_t arr(from_dlpack(ob));
+
+    if (arr.ndim() != ndim) {
+        py_throw(PyExc_ValueError, fmt::format("The array of coefficients passed to {}() must have {} dimension(s), "
+                                               "but it has {} dimension(s) instead",
+                                               fname, ndim, arr.ndim())
+                                       .c_str());
+    }
+
+    const auto *data = arr.data();
+    for (py::ssize_t i = 0; i < arr.size(); ++i) {
+        if (!std::isfinite(data[i])) {
+            py_throw(PyExc_ValueError,
+                     fmt::format("The array of coefficients passed to {}() contains the non-finite value {}", fname,
+                                 data[i])
+                         .c_str());
+        }
+    }
+
+    return arr;
+}
+
+// Helper to check that the n coefficients passed to the builder fname
+// can be mapped to the runtime parameters starting from the index par_offset.
+void check_par_range(std::optional<std::uint32_t> par_offset, std::size_t n, const char *fname)
+{
+    if (par_offset && n > 0u && n - 1u > std::numeric_limits<std::uint32_t>::max() - *par_offset) {
+        py_throw(PyExc_ValueError,
+                 fmt::format("Cannot map {} coefficients to runtime parameters starting from the index {} in {}(): "
+                             "the parameter indices would overflow",
+                             n, *par_offset, fname)
+                     .c_str());
+    }
+}
+
+// Helper to build the expression of the coefficient with index i and value c.
+// If par_offset is provided, the coefficient is represented by the runtime parameter
+// with index par_offset + i, so that its value can be changed without recompiling.
+// Otherwise, the coefficient is represented by its numerical value. In such case,
+// an empty optional is returned for zero coefficients, so that the corresponding
+// terms can be pruned.
+std::optional<hey::expression> coeff_ex(double c, std::optional<std::uint32_t> par_offset, std::size_t i)
+{
+    if (par_offset) {
+        return hey::par[static_cast<std::uint32_t>(*par_offset + i)];
+    }
+
+    if (c == 0) {
+        return {};
+    }
+
+    return hey::expression{c};
+}
+
+// Helper to sum a list of terms, returning zero
+// if the list is empty.
+hey::expression sum_or_zero(std::vector<hey::expression> terms)
+{
+    if (terms.empty()) {
+        return hey::expression{0.};
+    }
+
+    return hey::sum(std::move(terms));
+}
+
+// Linear combination of exprs with the coefficients in coeffs.
+hey::expression dot(const py::iterable &coeffs_ob, const std::vector<hey::expression> &exprs,
+                    std::optional<std::uint32_t> par_offset)
+{
+    const auto coeffs = coeff_array(coeffs_ob, 1, "dot");
+    const auto n = boost::numeric_cast<std::size_t>(coeffs.shape(0));
+
+    if (n != exprs.size()) {
+        py_throw(PyExc_ValueError,
+                 fmt::format("The number of coefficients passed to dot() ({}) must be equal to the number of "
+                             "expressions ({})",
+                             n, exprs.size())
+                     .c_str());
+    }
+
+    check_par_range(par_offset, n, "dot");
+
+    std::vector<hey::expression> terms;
+    terms.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        if (auto c = coeff_ex(coeffs.data()[i], par_offset, i)) {
+            terms.push_back(std::move(*c) * exprs[i]);
+        }
+    }
+
+    return sum_or_zero(std::move(terms));
+}
+
+// Polynomial in x with the coefficients in coeffs (in ascending order
+// of degree), in Horner form.
+hey::expression horner(const py::iterable &coeffs_ob, const hey::expression &x,
+                       std::optional<std::uint32_t> par_offset)
+{
+    const auto coeffs = coeff_array(coeffs_ob, 1, "horner");
+    const auto n = boost::numeric_cast<std::size_t>(coeffs.shape(0));
+
+    check_par_range(par_offset, n, "horner");
+
+    // NOTE: an empty optional represents zero.
+    std::optional<hey::expression> acc;
+    for (auto k = n; k > 0u; --k) {
+        auto c = coeff_ex(coeffs.data()[k - 1u], par_offset, k - 1u);
+
+        if (acc) {
+            acc = c ? std::move(*c) + x * std::move(*acc) : x * std::move(*acc);
+        } else {
+            acc = std::move(c);
+        }
+    }
+
+    return acc ? std::move(*acc) : hey::expression{0.};
+}
+
+// Chebyshev series in x with the coefficients in coeffs, evaluated via
+// the Clenshaw recurrence. If domain is provided, x is first mapped from
+// the interval domain to [-1, 1].
+hey::expression chebyshev_series(const py::iterable &coeffs_ob, const hey::expression &x,
+                                 std::optional<std::pair<double, double>> domain,
+                                 std::optional<std::uint32_t> par_offset)
+{
+    const auto coeffs = coeff_array(coeffs_ob, 1, "chebyshev_series");
+    const auto n = boost::numeric_cast<std::size_t>(coeffs.shape(0));
+
+    check_par_range(par_offset, n, "chebyshev_series");
+
+    auto u = x;
+    if (domain) {
+        const auto [a, b] = *domain;
+
+        if (!std::isfinite(a) || !std::isfinite(b) || !(a < b)) {
+            py_throw(PyExc_ValueError,
+                     fmt::format("Invalid domain [{}, {}] passed to chebyshev_series(): the bounds must be finite and "
+                                 "the lower bound must be less than the upper bound",
+                                 a, b)
+                         .c_str());
+        }
+
+        u = x * hey::expression{2. / (b - a)} - hey::expression{(a + b) / (b - a)};
+    }
+
+    // Clenshaw recurrence:
+    // b_k = c_k + 2*u*b_{k+1} - b_{k+2},
+    // result = c_0 + u*b_1 - b_2.
+    // NOTE: empty optionals represent zero.
+    const auto two_u = hey::expression{2.} * u;
+    std::optional<hey::expression> b1, b2;
+    for (auto k = n; k > 1u; --k) {
+        std::vector<hey::expression> terms;
+
+        if (auto c = coeff_ex(coeffs.data()[k - 1u], par_offset, k - 1u)) {
+            terms.push_back(std::move(*c));
+        }
+        if (b1) {
+            terms.push_back(two_u * *b1);
+        }
+        if (b2) {
+            terms.push_back(-*b2);
+        }
+
+        std::optional<hey::expression> bk;
+        if (terms.size() == 1u) {
+            bk = std::move(terms[0]);
+        } else if (terms.size() > 1u) {
+            bk = hey::sum(std::move(terms));
+        }
+
+        b2 = std::move(b1);
+        b1 = std::move(bk);
+    }
+
+    std::vector<hey::expression> terms;
+    if (n > 0u) {
+        if (auto c = coeff_ex(coeffs.data()[0], par_offset, 0)) {
+            terms.push_back(std::move(*c));
+        }
+    }
+    if (b1) {
+        terms.push_back(u * *b1);
+    }
+    if (b2) {
+        terms.push_back(-*b2);
+    }
+
+    return sum_or_zero(std::move(terms));
+}
+
+// Gravitational potential of a body with gravitational parameter mu and
+// reference radius R, expanded in spherical harmonics up to the degree and order
+// nmax with the fully-normalised coefficients C and S (arrays of shape (nmax + 1, nmax + 1),
+// only the lower triangle is used). The potential is returned with the sign convention
+// U = mu / r + ..., so that the acceleration is the gradient of U. The potential is
+// built from the solid harmonics in cartesian coordinates via the recurrences in
+// Montenbruck & Gill, "Satellite orbits", section 3.2.4, with the normalisation
+// factors folded into the coefficients of the recurrences.
+// If par_offset is provided, C[n, m] is represented by the runtime parameter
+// par_offset + n*(n+1)/2 + m, and S[n, m] by the runtime parameter
+// par_offset + T + n*(n+1)/2 + m, where T = (nmax+1)*(nmax+2)/2.
+hey::expression sph_harm_potential(const std::vector<hey::expression> &r, double mu, double R,
+                                   const py::iterable &C_ob, const py::iterable &S_ob,
+                                   std::optional<std::uint32_t> par_offset)
+{
+    if (r.size() != 3u) {
+        py_throw(PyExc_ValueError, fmt::format("The position vector passed to sph_harm_potential() must have 3 "
+                                               "components, but it has {} component(s) instead",
+                                               r.size())
+                                       .c_str());
+    }
+
+    if (!std::isfinite(mu) || !std::isfinite(R) || !(R > 0)) {
+        py_throw(PyExc_ValueError,
+                 fmt::format("Invalid gravitational parameter ({}) and/or reference radius ({}) passed to "
+                             "sph_harm_potential(): both values must be finite, and the reference radius "
+                             "must be positive",
+                             mu, R)
+                     .c_str());
+    }
+
+    const auto C = coeff_array(C_ob, 2, "sph_harm_potential");
+    const auto S = coeff_array(S_ob, 2, "sph_harm_potential");
+
+    if (C.shape(0) == 0 || C.shape(0) != C.shape(1) || S.shape(0) != C.shape(0) || S.shape(1) != C.shape(1)) {
+        py_throw(PyExc_ValueError,
+                 "The arrays of coefficients passed to sph_harm_potential() must both have a shape "
+                 "(nmax + 1, nmax + 1)");
+    }
+
+    const auto nmax = boost::numeric_cast<std::size_t>(C.shape(0)) - 1u;
+    const auto ntri = (nmax + 1u) * (nmax + 2u) / 2u;
+    const auto C_at = [&](std::size_t n, std::size_t m) { return C.data()[n * (nmax + 1u) + m]; };
+    const auto S_at = [&](std::size_t n, std::size_t m) { return S.data()[n * (nmax + 1u) + m]; };
+
+    check_par_range(par_offset, 2u * ntri, "sph_harm_potential");
+
+    const auto &x = r[0], &y = r[1], &z = r[2];
+
+    // The common subexpressions.
+    const auto r2 = hey::sum_sq({x, y, z});
+    const auto q = hey::expression{R} / r2;
+    const auto xq = x * q, yq = y * q, zq = z * q;
+    const auto rq = hey::expression{R * R} / r2;
+
+    // The normalised solid harmonics V[n][m] and W[n][m].
+    // NOTE: empty optionals represent zero (W[n][0] = 0).
+    std::vector<std::vector<std::optional<hey::expression>>> V(nmax + 1u), W(nmax + 1u);
+    for (std::size_t n = 0; n <= nmax; ++n) {
+        V[n].resize(n + 1u);
+        W[n].resize(n + 1u);
+    }
+
+    V[0][0] = hey::expression{R} / hey::sqrt(r2);
+
+    for (std::size_t m = 0; m <= nmax; ++m) {
+        const auto dm = static_cast<double>(m);
+
+        if (m > 0u) {
+            // Sectoral terms.
+            // NOTE: the extra factor of 2 for m == 1 comes
+            // from the normalisation of the zonal terms.
+            const auto ratio = std::sqrt((m == 1u ? 2. : 1.) * (2 * dm + 1) / ((2 * dm - 1) * (2 * dm - 1) * 2 * dm));
+            const auto f = hey::expression{(2 * dm - 1) * ratio};
+
+            const auto &Vp = *V[m - 1u][m - 1u];
+            const auto &Wp = W[m - 1u][m - 1u];
+
+            if (Wp) {
+                V[m][m] = f * (xq * Vp - yq * *Wp);
+                W[m][m] = f * (xq * *Wp + yq * Vp);
+            } else {
+                V[m][m] = f * (xq * Vp);
+                W[m][m] = f * (yq * Vp);
+            }
+        }
+
+        // Tesseral/zonal terms.
+        for (auto n = m + 1u; n <= nmax; ++n) {
+            const auto dn = static_cast<double>(n);
+
+            const auto a = (2 * dn - 1) / (dn - dm) * std::sqrt((2 * dn + 1) * (dn - dm) / ((2 * dn - 1) * (dn + dm)));
+            const auto fa = hey::expression{a};
+
+            if (n >= m + 2u) {
+                const auto b = (dn + dm - 1) / (dn - dm)
+                               * std::sqrt((2 * dn + 1) * (dn - dm) * (dn - dm - 1)
+                                           / ((2 * dn - 3) * (dn + dm) * (dn + dm - 1)));
+                const auto fb = hey::expression{b};
+
+                V[n][m] = fa * (zq * *V[n - 1u][m]) - fb * (rq * *V[n - 2u][m]);
+                if (m > 0u) {
+                    W[n][m] = fa * (zq * *W[n - 1u][m]) - fb * (rq * *W[n - 2u][m]);
+                }
+            } else {
+                V[n][m] = fa * (zq * *V[n - 1u][m]);
+                if (m > 0u) {
+                    W[n][m] = fa * (zq * *W[n - 1u][m]);
+                }
+            }
+        }
+    }
+
+    // Assemble the potential.
+    std::vector<hey::expression> terms;
+    for (std::size_t n = 0; n <= nmax; ++n) {
+        for (std::size_t m = 0; m <= n; ++m) {
+            const auto idx = n * (n + 1u) / 2u + m;
+
+            if (auto c = coeff_ex(C_at(n, m), par_offset, idx)) {
+                terms.push_back(std::move(*c) * *V[n][m]);
+            }
+
+            if (m > 0u) {
+                if (auto s = coeff_ex(S_at(n, m), par_offset, ntri + idx)) {
+                    terms.push_back(std::move(*s) * *W[n][m]);
+                }
+            }
+        }
+    }
+
+    return hey::expression{mu / R} * sum_or_zero(std::move(terms));
+}
+
+} // namespace
+
+} // namespace detail
+
+void expose_expression_builders(py::module_ &m)
+{
+    using namespace pybind11::literals;
+
+    m.def("dot", &detail::dot, "coeffs"_a, "exprs"_a, "par_offset"_a = py::none{});
+    m.def("horner", &detail::horner, "coeffs"_a, "x"_a, "par_offset"_a = py::none{});
+    m.def("chebyshev_series", &detail::chebyshev_series, "coeffs"_a, "x"_a, "domain"_a = py::none{},
+          "par_offset"_a = py::none{});
+    m.def("sph_harm_potential", &detail::sph_harm_potential, "r"_a, "mu"_a, "R"_a, "C"_a, "S"_a,
+          "par_offset"_a = py::none{});
+}
+
+} // namespace heyoka_py
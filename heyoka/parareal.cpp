@@ -0,0 +1,251 @@
+// Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+//
+// This file is part of the heyoka.py library.
+//
+// This Source Code Form is subject to the terms of the Mozilla
+// Public License v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include <boost/numeric/conversion/cast.hpp>
+
+#include <fmt/format.h>
+
+#include <oneapi/tbb/blocked_range.h>
+#include <oneapi/tbb/parallel_for.h>
+#include <oneapi/tbb/task_arena.h>
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <Python.h>
+
+#include <heyoka/taylor.hpp>
+
+#include "common_utils.hpp"
+#include "custom_casters.hpp"
+#include "parareal.hpp"
+
+namespace heyoka_py
+{
+
+namespace py = pybind11;
+namespace hey = heyoka;
+
+namespace detail
+{
+
+namespace
+{
+
+using ta_t = hey::taylor_adaptive<double>;
+
+// Propagate ta from the state st at the time t0 up to the time t1,
+// writing the final state into out. which is a string describing
+// the integrator (for error reporting) and k the segment index.
+// NOTE: this is run without holding the GIL, hence errors
+// are signalled via standard exceptions.
+void prop_segment(ta_t &ta, const double *st, double t0, double t1, double *out, const char *which, std::uint32_t k)
+{
+    const auto dim = ta.get_dim();
+
+    std::copy(st, st + dim, ta.get_state_data());
+    ta.set_time(t0);
+    ta.reset_cooldowns();
+
+    const auto oc = std::get<0>(ta.propagate_until(t1));
+
+    if (oc != hey::taylor_outcome::time_limit) {
+        throw std::invalid_argument(
+            fmt::format("The {} propagation of the segment {} in parareal() stopped before reaching the end of the "
+                        "segment",
+                        which, k));
+    }
+
+    std::copy(ta.get_state().begin(), ta.get_state().end(), out);
+}
+
+// Time-parallel propagation of the fine integrator ta up to the time t_final
+// via the parareal algorithm. The time interval is split into nsegs segments.
+// The coarse (cheaper and less accurate) integrator is used to predict
+// sequentially the states at the boundaries between the segments. The fine integrator
+// then propagates in parallel from the predicted boundary states, and the
+// predictions are corrected via the parareal update
+//
+// U_{k+1} <- G(U_k) + F(U_k^old) - G(U_k^old),
+//
+// where F and G are the fine and coarse propagators. The iterations stop
+// when the boundary states change by less than tol (in a mixed absolute/relative
+// sense). After j iterations, the first j segments coincide with the fine sequential
+// solution, hence at most nsegs iterations are needed and the fine propagations
+// are not re-run on the converged segments.
+// NOTE: the coarse integrator is used as a workspace, and its state/time
+// are modified. Both integrators are supposed to represent the same
+// dynamics (i.e., the same ODEs with the same parameter values).
+py::tuple parareal(ta_t &ta, ta_t &coarse, double t_final, std::uint32_t nsegs, std::optional<std::uint32_t> max_iter,
+                   std::optional<double> tol)
+{
+    if (!std::isfinite(t_final)) {
+        py_throw(PyExc_ValueError,
+                 fmt::format("The final time passed to parareal() must be finite, but it is {} instead", t_final)
+                     .c_str());
+    }
+
+    const auto dim = ta.get_dim();
+
+    if (coarse.get_dim() != dim) {
+        py_throw(PyExc_ValueError, fmt::format("The coarse integrator passed to parareal() has a dimension of {}, but "
+                                               "it must have the same dimension as the fine integrator ({})",
+                                               coarse.get_dim(), dim)
+                                       .c_str());
+    }
+
+    if (nsegs == 0u) {
+        // NOTE: by default, use one segment per thread.
+        nsegs = boost::numeric_cast<std::uint32_t>(std::max(oneapi::tbb::this_task_arena::max_concurrency(), 1));
+    }
+
+    const auto n_iter_max = max_iter ? *max_iter : nsegs;
+    if (n_iter_max == 0u) {
+        py_throw(PyExc_ValueError, "The maximum number of iterations in parareal() must be positive");
+    }
+
+    const auto rtol = tol ? *tol : ta.get_tol();
+    if (!std::isfinite(rtol) || !(rtol > 0)) {
+        py_throw(PyExc_ValueError,
+                 fmt::format("The tolerance in parareal() must be positive and finite, but it is {} instead", rtol)
+                     .c_str());
+    }
+
+    const auto t0 = ta.get_time();
+
+    // The boundaries of the segments.
+    std::vector<double> tb(static_cast<std::size_t>(nsegs) + 1u);
+    for (std::uint32_t k = 0; k < nsegs; ++k) {
+        tb[k] = t0 + (t_final - t0) * (static_cast<double>(k) / nsegs);
+    }
+    tb[nsegs] = t_final;
+
+    // The states at the boundaries, the coarse predictions
+    // and the fine solutions over each segment.
+    std::vector<double> U((static_cast<std::size_t>(nsegs) + 1u) * dim), G_old(static_cast<std::size_t>(nsegs) * dim),
+        F(static_cast<std::size_t>(nsegs) * dim), G_new(dim);
+    std::copy(ta.get_state().begin(), ta.get_state().end(), U.begin());
+
+    // The fine integrators (one per segment) and the
+    // wall-clock times of the fine propagations.
+    // NOTE: the copies must be created while holding the GIL,
+    // as copying the events invokes the copy machinery
+    // of the Python callbacks.
+    std::vector<ta_t> fine_tas(nsegs, ta);
+    std::vector<double> fine_times(nsegs);
+
+    std::uint32_t niter = 0;
+    bool converged = false;
+
+    const auto wall_start = std::chrono::steady_clock::now();
+
+    {
+        // NOTE: release the GIL during the propagations.
+        py::gil_scoped_release release;
+
+        // Initial coarse prediction.
+        for (std::uint32_t k = 0; k < nsegs; ++k) {
+            auto *gk = G_old.data() + static_cast<std::size_t>(k) * dim;
+
+            prop_segment(coarse, U.data() + static_cast<std::size_t>(k) * dim, tb[k], tb[k + 1u], gk, "coarse", k);
+            std::copy(gk, gk + dim, U.data() + (static_cast<std::size_t>(k) + 1u) * dim);
+        }
+
+        for (std::uint32_t j = 0; j < n_iter_max; ++j) {
+            // Run the fine propagations on the segments
+            // which have not converged yet.
+            oneapi::tbb::parallel_for(oneapi::tbb::blocked_range<std::uint32_t>(j, nsegs, 1),
+                                      [&](const auto &range) {
+                                          for (auto k = range.begin(); k != range.end(); ++k) {
+                                              const auto start = std::chrono::steady_clock::now();
+
+                                              prop_segment(fine_tas[k], U.data() + static_cast<std::size_t>(k) * dim,
+                                                           tb[k], tb[k + 1u],
+                                                           F.data() + static_cast<std::size_t>(k) * dim, "fine", k);
+
+                                              fine_times[k] = std::chrono::duration<double>(
+                                                                  std::chrono::steady_clock::now() - start)
+                                                                  .count();
+                                          }
+                                      });
+
+            ++niter;
+
+            // Sequential correction sweep.
+            double max_diff = 0;
+            for (std::uint32_t k = j; k < nsegs; ++k) {
+                const auto off = static_cast<std::size_t>(k) * dim;
+
+                prop_segment(coarse, U.data() + off, tb[k], tb[k + 1u], G_new.data(), "coarse", k);
+
+                for (std::size_t i = 0; i < dim; ++i) {
+                    const auto new_val = G_new[i] + F[off + i] - G_old[off + i];
+                    auto &cur_val = U[off + dim + i];
+
+                    max_diff = std::max(max_diff, std::abs(new_val - cur_val) / std::max(1., std::abs(new_val)));
+                    cur_val = new_val;
+                }
+
+                std::copy(G_new.begin(), G_new.end(), G_old.begin() + static_cast<std::ptrdiff_t>(off));
+            }
+
+            // NOTE: after the last possible iteration, the
+            // solution coincides with the sequential fine solution.
+            if (max_diff <= rtol || j + 1u == nsegs) {
+                converged = true;
+                break;
+            }
+        }
+    }
+
+    const auto wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+    // Estimate the speedup with respect to a sequential fine propagation,
+    // whose cost is approximated by the total time of the latest fine
+    // propagations of all the segments.
+    double serial_time = 0;
+    for (const auto t : fine_times) {
+        serial_time += t;
+    }
+
+    // Update the fine integrator.
+    std::copy(U.end() - static_cast<std::ptrdiff_t>(dim), U.end(), ta.get_state_data());
+    ta.set_time(t_final);
+
+    // Assemble the boundary states.
+    py::array_t<double> states(
+        py::array::ShapeContainer{boost::numeric_cast<py::ssize_t>(nsegs) + 1, boost::numeric_cast<py::ssize_t>(dim)});
+    std::copy(U.begin(), U.end(), states.mutable_data());
+
+    return py::make_tuple(std::move(states), niter, converged, wall_time > 0 ? serial_time / wall_time : 1.);
+}
+
+} // namespace
+
+} // namespace detail
+
+void expose_parareal(py::module_ &m)
+{
+    using namespace pybind11::literals;
+
+    m.def("parareal", &detail::parareal, "ta"_a, "coarse"_a, "t"_a, "nsegs"_a = 0u, "max_iter"_a = py::none{},
+          "tol"_a = py::none{});
+}
+
+} // namespace heyoka_py
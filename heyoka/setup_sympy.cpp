@@ -8,11 +8,13 @@
 
 #include <heyoka/config.hpp>
 
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <functional>
 #include <iostream>
 #include <limits>
+#include <mutex>
 #include <optional>
 #include <pybind11/pytypes.h>
 #include <stdexcept>
@@ -178,8 +180,192 @@ py::object to_sympy_impl(std::unordered_map<const void *, py::object> &func_map,
     return std::visit([&func_map](const auto &v) { return to_sympy_impl(func_map, v); }, ex.value());
 }
 
+// Flag signalling whether the initialisation of the
+// sympy integration bits has been completed.
+std::atomic<bool> sympy_init_done = false;
+
+// Mutex to serialise the initialisation of the sympy integration bits.
+// NOTE: the GIL alone is not enough for this purpose, as the import
+// of sympy may release it (and there is no GIL at all in free-threaded
+// Python builds).
+std::mutex sympy_init_mutex;
+
+// Helper to setup the sympy integration bits.
+// NOTE: this is invoked lazily on the first call
+// to to_sympy(), so that importing heyoka does not
+// require importing sympy. If sympy is not available,
+// spy will remain empty.
+void init_sympy()
+{
+    if (sympy_init_done.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    // NOTE: lock the mutex with the GIL released, otherwise we could
+    // deadlock with a thread holding the mutex and waiting
+    // for the GIL during the import of sympy.
+    std::unique_lock lock(sympy_init_mutex, std::defer_lock);
+    {
+        py::gil_scoped_release release;
+        lock.lock();
+    }
+
+    // NOTE: another thread might have completed the
+    // initialisation while we were waiting for the mutex.
+    if (sympy_init_done.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::optional<py::object> tmp_spy;
+    try {
+        tmp_spy = py::module_::import("sympy");
+    } catch (const py::error_already_set &eas) {
+        if (!eas.matches(PyExc_ImportError)) {
+            throw;
+        }
+    }
+
+    if (!tmp_spy) {
+        // sympy is not available.
+        sympy_init_done.store(true, std::memory_order_release);
+
+        return;
+    }
+
+    spy = std::move(tmp_spy);
+
+    // Fill in the function map.
+    fmap[typeid(hy::detail::acos_impl)] = py::object(spy->attr("acos"));
+    fmap[typeid(hy::detail::acosh_impl)] = py::object(spy->attr("acosh"));
+    fmap[typeid(hy::detail::asin_impl)] = py::object(spy->attr("asin"));
+    fmap[typeid(hy::detail::asinh_impl)] = py::object(spy->attr("asinh"));
+    fmap[typeid(hy::detail::atan_impl)] = py::object(spy->attr("atan"));
+    fmap[typeid(hy::detail::atan2_impl)] = py::object(spy->attr("atan2"));
+    fmap[typeid(hy::detail::atanh_impl)] = py::object(spy->attr("atanh"));
+    fmap[typeid(hy::detail::cos_impl)] = py::object(spy->attr("cos"));
+    fmap[typeid(hy::detail::cosh_impl)] = py::object(spy->attr("cosh"));
+    fmap[typeid(hy::detail::erf_impl)] = py::object(spy->attr("erf"));
+    fmap[typeid(hy::detail::exp_impl)] = py::object(spy->attr("exp"));
+    fmap[typeid(hy::detail::log_impl)] = py::object(spy->attr("log"));
+    fmap[typeid(hy::detail::sin_impl)] = py::object(spy->attr("sin"));
+    fmap[typeid(hy::detail::sinh_impl)] = py::object(spy->attr("sinh"));
+    fmap[typeid(hy::detail::sqrt_impl)] = py::object(spy->attr("sqrt"));
+    fmap[typeid(hy::detail::tan_impl)] = py::object(spy->attr("tan"));
+    fmap[typeid(hy::detail::tanh_impl)] = py::object(spy->attr("tanh"));
+    fmap[typeid(hy::detail::pow_impl)] = py::object(spy->attr("Pow"));
+    fmap[typeid(hy::detail::sum_impl)] = py::object(spy->attr("Add"));
+
+    // sum_sq.
+    fmap[typeid(hy::detail::sum_sq_impl)]
+        = [](std::unordered_map<const void *, py::object> &func_map, const hy::func &f) {
+              // Convert all arguments to Python objects.
+              py::list py_args;
+              for (const auto &arg : f.args()) {
+                  auto tmp = to_sympy_impl(func_map, arg);
+                  py_args.append(tmp * tmp);
+              }
+
+              return py::object(spy->attr("Add"))(*py_args);
+          };
+
+    // Binary op.
+    fmap[typeid(hy::detail::binary_op)]
+        = [](std::unordered_map<const void *, py::object> &func_map, const hy::func &f) {
+              assert(f.args().size() == 2u);
+
+              auto op0 = to_sympy_impl(func_map, f.args()[0]);
+              auto op1 = to_sympy_impl(func_map, f.args()[1]);
+
+              const auto op_type = f.extract<hy::detail::binary_op>()->op();
+
+              switch (op_type) {
+                  case hy::detail::binary_op::type::add:
+                      return op0 + op1;
+                  case hy::detail::binary_op::type::sub:
+                      return op0 - op1;
+                  case hy::detail::binary_op::type::mul:
+                      return op0 * op1;
+                  default:
+                      assert(op_type == hy::detail::binary_op::type::div);
+                      return op0 / op1;
+              }
+          };
+
+    // kepE.
+    // NOTE: this will remain an unevaluated binary function.
+    auto sympy_kepE = py::object(spy->attr("Function")("heyoka_kepE"));
+    fmap[typeid(hy::detail::kepE_impl)] = sympy_kepE;
+
+    // neg.
+    fmap[typeid(hy::detail::neg_impl)]
+        = [](std::unordered_map<const void *, py::object> &func_map, const hy::func &f) {
+              assert(f.args().size() == 1u);
+
+              return -to_sympy_impl(func_map, f.args()[0]);
+          };
+
+    // sigmoid.
+    fmap[typeid(hy::detail::sigmoid_impl)]
+        = [](std::unordered_map<const void *, py::object> &func_map, const hy::func &f) {
+              assert(f.args().size() == 1u);
+
+              return py::cast(1.) / (py::cast(1.) + spy->attr("exp")(-to_sympy_impl(func_map, f.args()[0])));
+          };
+
+    // square.
+    fmap[typeid(hy::detail::square_impl)]
+        = [](std::unordered_map<const void *, py::object> &func_map, const hy::func &f) {
+              assert(f.args().size() == 1u);
+
+              auto op = to_sympy_impl(func_map, f.args()[0]);
+              return op * op;
+          };
+
+    // time.
+    // NOTE: this will remain an unevaluated nullary function.
+    auto sympy_time = py::object(spy->attr("Function")("heyoka_time"));
+    fmap[typeid(hy::detail::time_impl)] = sympy_time;
+
+    // tpoly.
+    // NOTE: this will remain an unevaluated binary function.
+    auto sympy_tpoly = py::object(spy->attr("Function")("heyoka_tpoly"));
+    fmap[typeid(hy::detail::tpoly_impl)] = sympy_tpoly;
+
+    // Constants.
+    fmap[typeid(hy::constant)] = [](std::unordered_map<const void *, py::object> &, const hy::func &f) {
+        const auto *cptr = f.extract<hy::constant>();
+        assert(cptr != nullptr);
+
+        if (cptr->get_str_func_t() == typeid(hy::detail::pi_constant_func)) {
+            return py::object(spy->attr("pi"));
+        }
+
+        // Translate other constants as unevaluated nullary functions.
+        return py::object(spy->attr("Function")(f.get_name().c_str()));
+    };
+
+    // Register a cleanup function to destroy the global variables at shutdown.
+    auto atexit = py::module_::import("atexit");
+    atexit.attr("register")(py::cpp_function([]() {
+#if !defined(NDEBUG)
+        std::cout << "Cleaning up sympy conversion data." << std::endl;
+#endif
+
+        spy.reset();
+        fmap.clear();
+    }));
+
+    sympy_init_done.store(true, std::memory_order_release);
+}
+
 py::object to_sympy(const hy::expression &ex)
 {
+    init_sympy();
+
+    if (!spy) {
+        py_throw(PyExc_ImportError, "The 'to_sympy()' function is not available because sympy is not installed");
+    }
+
     std::unordered_map<const void *, py::object> func_map;
 
     return to_sympy_impl(func_map, ex);
@@ -191,146 +377,11 @@ py::object to_sympy(const hy::expression &ex)
 
 // Helper to setup the sympy integration bits
 // on the C++ side.
+// NOTE: the actual setup is performed lazily
+// on the first invocation of to_sympy().
 void setup_sympy(py::module &m)
 {
-    bool has_sympy = true;
-
-    try {
-        detail::spy = py::module_::import("sympy");
-    } catch (...) {
-        has_sympy = false;
-    }
-
-    if (has_sympy) {
-        // Fill in the function map.
-        detail::fmap[typeid(hy::detail::acos_impl)] = py::object(detail::spy->attr("acos"));
-        detail::fmap[typeid(hy::detail::acosh_impl)] = py::object(detail::spy->attr("acosh"));
-        detail::fmap[typeid(hy::detail::asin_impl)] = py::object(detail::spy->attr("asin"));
-        detail::fmap[typeid(hy::detail::asinh_impl)] = py::object(detail::spy->attr("asinh"));
-        detail::fmap[typeid(hy::detail::atan_impl)] = py::object(detail::spy->attr("atan"));
-        detail::fmap[typeid(hy::detail::atan2_impl)] = py::object(detail::spy->attr("atan2"));
-        detail::fmap[typeid(hy::detail::atanh_impl)] = py::object(detail::spy->attr("atanh"));
-        detail::fmap[typeid(hy::detail::cos_impl)] = py::object(detail::spy->attr("cos"));
-        detail::fmap[typeid(hy::detail::cosh_impl)] = py::object(detail::spy->attr("cosh"));
-        detail::fmap[typeid(hy::detail::erf_impl)] = py::object(detail::spy->attr("erf"));
-        detail::fmap[typeid(hy::detail::exp_impl)] = py::object(detail::spy->attr("exp"));
-        detail::fmap[typeid(hy::detail::log_impl)] = py::object(detail::spy->attr("log"));
-        detail::fmap[typeid(hy::detail::sin_impl)] = py::object(detail::spy->attr("sin"));
-        detail::fmap[typeid(hy::detail::sinh_impl)] = py::object(detail::spy->attr("sinh"));
-        detail::fmap[typeid(hy::detail::sqrt_impl)] = py::object(detail::spy->attr("sqrt"));
-        detail::fmap[typeid(hy::detail::tan_impl)] = py::object(detail::spy->attr("tan"));
-        detail::fmap[typeid(hy::detail::tanh_impl)] = py::object(detail::spy->attr("tanh"));
-        detail::fmap[typeid(hy::detail::pow_impl)] = py::object(detail::spy->attr("Pow"));
-        detail::fmap[typeid(hy::detail::sum_impl)] = py::object(detail::spy->attr("Add"));
-
-        // sum_sq.
-        detail::fmap[typeid(hy::detail::sum_sq_impl)]
-            = [](std::unordered_map<const void *, py::object> &func_map, const hy::func &f) {
-                  // Convert all arguments to Python objects.
-                  py::list py_args;
-                  for (const auto &arg : f.args()) {
-                      auto tmp = detail::to_sympy_impl(func_map, arg);
-                      py_args.append(tmp * tmp);
-                  }
-
-                  return py::object(detail::spy->attr("Add"))(*py_args);
-              };
-
-        // Binary op.
-        detail::fmap[typeid(hy::detail::binary_op)]
-            = [](std::unordered_map<const void *, py::object> &func_map, const hy::func &f) {
-                  assert(f.args().size() == 2u);
-
-                  auto op0 = detail::to_sympy_impl(func_map, f.args()[0]);
-                  auto op1 = detail::to_sympy_impl(func_map, f.args()[1]);
-
-                  const auto op_type = f.extract<hy::detail::binary_op>()->op();
-
-                  switch (op_type) {
-                      case hy::detail::binary_op::type::add:
-                          return op0 + op1;
-                      case hy::detail::binary_op::type::sub:
-                          return op0 - op1;
-                      case hy::detail::binary_op::type::mul:
-                          return op0 * op1;
-                      default:
-                          assert(op_type == hy::detail::binary_op::type::div);
-                          return op0 / op1;
-                  }
-              };
-
-        // kepE.
-        // NOTE: this will remain an unevaluated binary function.
-        auto sympy_kepE = py::object(detail::spy->attr("Function")("heyoka_kepE"));
-        detail::fmap[typeid(hy::detail::kepE_impl)] = sympy_kepE;
-
-        // neg.
-        detail::fmap[typeid(hy::detail::neg_impl)]
-            = [](std::unordered_map<const void *, py::object> &func_map, const hy::func &f) {
-                  assert(f.args().size() == 1u);
-
-                  return -detail::to_sympy_impl(func_map, f.args()[0]);
-              };
-
-        // sigmoid.
-        detail::fmap[typeid(hy::detail::sigmoid_impl)]
-            = [](std::unordered_map<const void *, py::object> &func_map, const hy::func &f) {
-                  assert(f.args().size() == 1u);
-
-                  return py::cast(1.)
-                         / (py::cast(1.) + detail::spy->attr("exp")(-detail::to_sympy_impl(func_map, f.args()[0])));
-              };
-
-        // square.
-        detail::fmap[typeid(hy::detail::square_impl)]
-            = [](std::unordered_map<const void *, py::object> &func_map, const hy::func &f) {
-                  assert(f.args().size() == 1u);
-
-                  auto op = detail::to_sympy_impl(func_map, f.args()[0]);
-                  return op * op;
-              };
-
-        // time.
-        // NOTE: this will remain an unevaluated nullary function.
-        auto sympy_time = py::object(detail::spy->attr("Function")("heyoka_time"));
-        detail::fmap[typeid(hy::detail::time_impl)] = sympy_time;
-
-        // tpoly.
-        // NOTE: this will remain an unevaluated binary function.
-        auto sympy_tpoly = py::object(detail::spy->attr("Function")("heyoka_tpoly"));
-        detail::fmap[typeid(hy::detail::tpoly_impl)] = sympy_tpoly;
-
-        // Constants.
-        detail::fmap[typeid(hy::constant)] = [](std::unordered_map<const void *, py::object> &, const hy::func &f) {
-            const auto *cptr = f.extract<hy::constant>();
-            assert(cptr != nullptr);
-
-            if (cptr->get_str_func_t() == typeid(hy::detail::pi_constant_func)) {
-                return py::object(detail::spy->attr("pi"));
-            }
-
-            // Translate other constants as unevaluated nullary functions.
-            return py::object(detail::spy->attr("Function")(f.get_name().c_str()));
-        };
-
-        // Expose the conversion function.
-        m.def("to_sympy", &detail::to_sympy);
-
-        // Register a cleanup function to destroy the global variables at shutdown.
-        auto atexit = py::module_::import("atexit");
-        atexit.attr("register")(py::cpp_function([]() {
-#if !defined(NDEBUG)
-            std::cout << "Cleaning up sympy conversion data." << std::endl;
-#endif
-
-            detail::spy.reset();
-            detail::fmap.clear();
-        }));
-    } else {
-        m.def("to_sympy", [](const hy::expression &) {
-            py_throw(PyExc_ImportError, "The 'to_sympy()' function is not available because sympy is not installed");
-        });
-    }
+    m.def("to_sympy", &detail::to_sympy);
 }
 
 } // namespace heyoka_py
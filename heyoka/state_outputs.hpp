@@ -0,0 +1,277 @@
+// Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+//
+// This file is part of the heyoka.py library.
+//
+// This Source Code Form is subject to the terms of the Mozilla
+// Public License v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef HEYOKA_PY_STATE_OUTPUTS_HPP
+#define HEYOKA_PY_STATE_OUTPUTS_HPP
+
+#include <heyoka/config.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+
+#include <boost/numeric/conversion/cast.hpp>
+
+#include <fmt/format.h>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <Python.h>
+
+#if defined(HEYOKA_HAVE_REAL)
+
+#include <mp++/real.hpp>
+
+#endif
+
+#include <heyoka/expression.hpp>
+#include <heyoka/llvm_state.hpp>
+#include <heyoka/taylor.hpp>
+
+#include "common_utils.hpp"
+
+namespace heyoka_py
+{
+
+namespace py = pybind11;
+
+// A compiled function evaluating a list of output expressions
+// on the state vectors produced by an integrator. The variables
+// of the compiled function are the state variables of the integrator
+// and its runtime parameters are the runtime parameters of the integrator.
+// For batch integrators, the function is compiled in batch mode with
+// the batch size of the integrator, so that the (dim, batch_size) blocks
+// of state data and the (npars, batch_size) block of parameter values
+// can be fed directly to the compiled function.
+// NOTE: the constructor must be invoked with the GIL held. The GIL
+// is released during the compilation of the function.
+// NOTE: the object can be compiled once via the compile_outputs()
+// method of the integrators and then reused in multiple propagations
+// (also with other integrators, as long as they are compatible).
+template <typename T>
+class state_outputs
+{
+    using ptr_t = void (*)(T *, const T *, const T *) noexcept;
+
+    heyoka::llvm_state m_s;
+    ptr_t m_fptr = nullptr;
+    // The state variables of the integrator, in the
+    // order in which they appear in the state vector.
+    std::vector<heyoka::expression> m_vars;
+    std::uint32_t m_dim = 0;
+    std::uint32_t m_nouts = 0;
+    std::uint32_t m_nparams = 0;
+    std::uint32_t m_batch_size = 1;
+    long long m_prec = 0;
+
+public:
+    template <typename TA>
+    explicit state_outputs(const TA &ta, const std::vector<heyoka::expression> &outs)
+        : m_s{heyoka::kw::opt_level = ta.get_llvm_state().opt_level(),
+              heyoka::kw::force_avx512 = ta.get_llvm_state().force_avx512(),
+              heyoka::kw::fast_math = ta.get_llvm_state().fast_math()},
+          m_dim(ta.get_dim())
+    {
+        namespace hey = heyoka;
+        namespace kw = hey::kw;
+
+        if constexpr (std::is_same_v<TA, hey::taylor_adaptive_batch<T>>) {
+            m_batch_size = ta.get_batch_size();
+        }
+
+#if defined(HEYOKA_HAVE_REAL)
+
+        if constexpr (std::is_same_v<T, mppp::real>) {
+            m_prec = boost::numeric_cast<long long>(ta.get_prec());
+        }
+
+#endif
+
+        if (outs.empty()) {
+            py_throw(PyExc_ValueError, "The list of output expressions cannot be empty");
+        }
+
+        for (const auto &ex : outs) {
+            m_nparams = std::max<std::uint32_t>(m_nparams, hey::get_param_size(ex));
+        }
+
+        m_vars = get_state_vars(ta);
+
+        check_compatible(ta);
+
+        {
+            // NOTE: release the GIL during compilation.
+            py::gil_scoped_release release;
+
+            hey::add_cfunc<T>(m_s, "outputs", outs, kw::vars = m_vars, kw::batch_size = m_batch_size,
+                              kw::high_accuracy = ta.get_high_accuracy(), kw::compact_mode = ta.get_compact_mode(),
+                              kw::prec = m_prec);
+
+            m_s.compile();
+
+            m_fptr = reinterpret_cast<ptr_t>(m_s.jit_lookup("outputs"));
+        }
+
+        // NOTE: static cast is fine, add_cfunc() checks
+        // that the number of outputs fits in a 32-bit int.
+        m_nouts = static_cast<std::uint32_t>(outs.size());
+    }
+
+    std::uint32_t get_nouts() const
+    {
+        return m_nouts;
+    }
+
+    // Fetch the state variables of the integrator ta from its decomposition.
+    // NOTE: the first dim entries of the decomposition
+    // are the state variables of the system.
+    template <typename TA>
+    static std::vector<heyoka::expression> get_state_vars(const TA &ta)
+    {
+        const auto &dc = ta.get_decomposition();
+        assert(dc.size() >= ta.get_dim());
+
+        std::vector<heyoka::expression> ret;
+        ret.reserve(ta.get_dim());
+        for (decltype(ta.get_dim()) i = 0; i < ta.get_dim(); ++i) {
+            ret.push_back(dc[i].first);
+        }
+
+        return ret;
+    }
+
+    // Check that the outputs can be evaluated on the
+    // state vectors produced by the integrator ta.
+    template <typename TA>
+    void check_compatible(const TA &ta) const
+    {
+        namespace hey = heyoka;
+
+        std::uint32_t batch_size = 1;
+        if constexpr (std::is_same_v<TA, hey::taylor_adaptive_batch<T>>) {
+            batch_size = ta.get_batch_size();
+        }
+
+        if (ta.get_dim() != m_dim || batch_size != m_batch_size) {
+            py_throw(PyExc_ValueError,
+                     fmt::format("The compiled outputs were created for an integrator with dimension {} and batch "
+                                 "size {}, but they are being used with an integrator with dimension {} and batch "
+                                 "size {}",
+                                 m_dim, m_batch_size, ta.get_dim(), batch_size)
+                         .c_str());
+        }
+
+        // NOTE: the state components are read by position, hence the state
+        // variables must be the same (and in the same order).
+        if (const auto vars = get_state_vars(ta); vars != m_vars) {
+            auto vars_str = [](const std::vector<heyoka::expression> &v) {
+                std::ostringstream oss;
+                oss << '[';
+                for (decltype(v.size()) i = 0; i < v.size(); ++i) {
+                    oss << v[i] << (i + 1u == v.size() ? "" : ", ");
+                }
+                oss << ']';
+
+                return oss.str();
+            };
+
+            py_throw(PyExc_ValueError,
+                     fmt::format("The compiled outputs were created for an integrator with state variables {}, but "
+                                 "they are being used with an integrator with state variables {}",
+                                 vars_str(m_vars), vars_str(vars))
+                         .c_str());
+        }
+
+#if defined(HEYOKA_HAVE_REAL)
+
+        if constexpr (std::is_same_v<T, mppp::real>) {
+            if (boost::numeric_cast<long long>(ta.get_prec()) != m_prec) {
+                py_throw(PyExc_ValueError,
+                         fmt::format("The compiled outputs were created for an integrator with precision {}, but "
+                                     "they are being used with an integrator with precision {}",
+                                     m_prec, ta.get_prec())
+                             .c_str());
+            }
+        }
+
+#endif
+
+        // The output expressions cannot contain more
+        // parameters than the integrator.
+        assert(ta.get_pars().size() % m_batch_size == 0u);
+        if (m_nparams > ta.get_pars().size() / m_batch_size) {
+            py_throw(PyExc_ValueError,
+                     fmt::format("The list of output expressions contains {} parameter(s), but the integrator "
+                                 "has only {} parameter(s)",
+                                 m_nparams, ta.get_pars().size() / m_batch_size)
+                         .c_str());
+        }
+    }
+
+    // Evaluate the outputs for the state vectors stored contiguously
+    // in states, using the parameter values in pars. The returned
+    // vector contains one (nouts, batch_size) block for each state vector.
+    // NOTE: this does not call into the Python interpreter, so it is safe
+    // to invoke it with the GIL released.
+    std::vector<T> operator()(const std::vector<T> &states, const std::vector<T> &pars) const
+    {
+        const auto block_size = static_cast<decltype(states.size())>(m_dim) * m_batch_size;
+        assert(block_size > 0u);
+        assert(states.size() % block_size == 0u);
+        const auto nstates = states.size() / block_size;
+
+        const auto out_block_size = static_cast<decltype(states.size())>(m_nouts) * m_batch_size;
+
+        std::vector<T> ret;
+        ret.resize(boost::numeric_cast<decltype(ret.size())>(nstates * out_block_size));
+
+#if defined(HEYOKA_HAVE_REAL)
+
+        if constexpr (std::is_same_v<T, mppp::real>) {
+            // For mppp::real, ensure that the output values
+            // have the correct precision.
+            for (auto &val : ret) {
+                val.set_prec(boost::numeric_cast<mpfr_prec_t>(m_prec));
+            }
+        }
+
+#endif
+
+        for (decltype(states.size()) i = 0; i < nstates; ++i) {
+            m_fptr(ret.data() + i * out_block_size, states.data() + i * block_size, pars.data());
+        }
+
+        return ret;
+    }
+};
+
+// Fetch the compiled outputs from the outputs argument of the propagation
+// functions of ta, which can be either a list of expressions (compiled on
+// the fly) or an object returned by compile_outputs() (reused without
+// recompilation, after checking that it is compatible with ta).
+template <typename T, typename TA>
+std::shared_ptr<const state_outputs<T>> fetch_state_outputs(const TA &ta, const py::object &outputs)
+{
+    if (py::isinstance<state_outputs<T>>(outputs)) {
+        auto ret = py::cast<std::shared_ptr<state_outputs<T>>>(outputs);
+        ret->check_compatible(ta);
+
+        return ret;
+    }
+
+    return std::make_shared<const state_outputs<T>>(ta, py::cast<std::vector<heyoka::expression>>(outputs));
+}
+
+} // namespace heyoka_py
+
+#endif
@@ -10,14 +10,25 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
+#include <boost/math/tools/toms748_solve.hpp>
 #include <boost/numeric/conversion/cast.hpp>
 
 #include <fmt/format.h>
 
+#include <oneapi/tbb/blocked_range.h>
+#include <oneapi/tbb/parallel_for.h>
+
 #include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
@@ -36,6 +47,8 @@
 
 #endif
 
+#include <heyoka/expression.hpp>
+#include <heyoka/llvm_state.hpp>
 #include <heyoka/taylor.hpp>
 
 #include "common_utils.hpp"
@@ -62,6 +75,229 @@ namespace detail
 namespace
 {
 
+template <typename T>
+using c_out_root_fptr_t = void (*)(T *, const T *, const T *) noexcept;
+
+// A function of the state variables compiled for use in the root finding
+// functions of the continuous output classes. It can be compiled once via
+// the compile_root_fn() method of the continuous output classes and then
+// reused in multiple root searches.
+template <typename T>
+struct c_out_root_fn {
+    hey::llvm_state s;
+    c_out_root_fptr_t<T> fptr = nullptr;
+    // The number of state variables and the number
+    // of parameters required by the function.
+    std::size_t nvars = 0, npars = 0;
+};
+
+// Helper to compile the function fn of the state variables vars, for use in the root
+// finding functions of the continuous output classes. nvars is the number
+// of state variables in the continuous output object.
+// NOTE: this must be invoked with the GIL held, the GIL is released during compilation.
+template <typename T>
+std::shared_ptr<c_out_root_fn<T>> c_out_compile_root_fn(const hey::expression &fn,
+                                                        const std::vector<hey::expression> &vars, std::size_t nvars)
+{
+    if (vars.size() != nvars) {
+        py_throw(PyExc_ValueError, fmt::format("The number of variables passed to find_roots() ({}) must be equal "
+                                               "to the number of state variables ({})",
+                                               vars.size(), nvars)
+                                       .c_str());
+    }
+
+    auto ret = std::make_shared<c_out_root_fn<T>>();
+    ret->nvars = nvars;
+    ret->npars = hey::get_param_size(fn);
+
+    // NOTE: release the GIL during compilation.
+    py::gil_scoped_release release;
+
+    hey::add_cfunc<T>(ret->s, "fn", {fn}, hey::kw::vars = vars);
+
+    ret->s.compile();
+
+    ret->fptr = reinterpret_cast<c_out_root_fptr_t<T>>(ret->s.jit_lookup("fn"));
+
+    return ret;
+}
+
+// Helper to fetch the compiled function from the fn argument of find_roots(),
+// which can be either an expression (compiled on the fly with respect to vars)
+// or a function returned by compile_root_fn() (reused without recompilation).
+// nvars is the number of state variables in the continuous output object, npars
+// the number of parameter values provided.
+// NOTE: this must be invoked with the GIL held.
+template <typename T>
+std::shared_ptr<c_out_root_fn<T>> c_out_fetch_root_fn(const py::object &fn,
+                                                      const std::optional<std::vector<hey::expression>> &vars,
+                                                      std::size_t nvars, std::size_t npars)
+{
+    std::shared_ptr<c_out_root_fn<T>> ret;
+
+    if (py::isinstance<c_out_root_fn<T>>(fn)) {
+        if (vars) {
+            py_throw(PyExc_ValueError,
+                     "The list of variables cannot be passed to find_roots() together with a precompiled function");
+        }
+
+        ret = py::cast<std::shared_ptr<c_out_root_fn<T>>>(fn);
+
+        if (ret->nvars != nvars) {
+            py_throw(PyExc_ValueError,
+                     fmt::format("The precompiled function passed to find_roots() has {} variable(s), but the "
+                                 "continuous output object has {} state variable(s)",
+                                 ret->nvars, nvars)
+                         .c_str());
+        }
+    } else {
+        if (!vars) {
+            py_throw(PyExc_ValueError, "The list of variables must be passed to find_roots() when the function "
+                                       "is not precompiled");
+        }
+
+        ret = c_out_compile_root_fn<T>(py::cast<hey::expression>(fn), *vars, nvars);
+    }
+
+    if (ret->npars > npars) {
+        py_throw(PyExc_ValueError,
+                 fmt::format("The function passed to find_roots() requires at least {} parameter value(s), but only {} "
+                             "value(s) were provided",
+                             ret->npars, npars)
+                     .c_str());
+    }
+
+    return ret;
+}
+
+// Helper to find the roots of the function fptr of the state variables within the
+// steps of a continuous output object. tcs and times are the Taylor coefficients and
+// the time coordinates stored in the continuous output object and bs is its batch size.
+// lane_pars contains the npars parameter values for each batch lane, stored contiguously
+// lane after lane. The function is composed with the Taylor polynomials of the state
+// variables and evaluated at nsamples + 1 equispaced points within each step. The sign
+// changes are then refined via TOMS 748. The (lane, step) pairs are processed in
+// parallel, and the roots of each lane are returned in the chronological order
+// of the integration.
+// NOTE: roots of even multiplicity and pairs of roots falling between
+// two consecutive sampling points are not detected.
+template <typename T>
+std::vector<std::vector<T>> c_out_find_roots(const std::vector<T> &tcs, const std::vector<T> &times,
+                                             std::size_t n_steps, std::size_t nvars, std::uint32_t bs,
+                                             c_out_root_fptr_t<T> fptr, const std::vector<T> &lane_pars,
+                                             std::size_t npars, std::uint32_t nsamples)
+{
+    assert(n_steps > 0u);
+    assert(nvars > 0u);
+    assert(bs > 0u);
+    assert(nsamples > 0u);
+    assert(times.size() >= (n_steps + 1u) * bs);
+    assert(tcs.size() % (n_steps * nvars * bs) == 0u);
+    assert(lane_pars.size() == npars * bs);
+
+    // The number of Taylor coefficients per state variable.
+    const auto ncoeffs = tcs.size() / (n_steps * nvars * bs);
+    assert(ncoeffs > 0u);
+
+    // The roots found in each (lane, step) pair, stored lane after lane.
+    std::vector<std::vector<T>> step_roots(n_steps * bs);
+
+    oneapi::tbb::parallel_for(oneapi::tbb::blocked_range<std::size_t>(0, n_steps * bs), [&](const auto &range) {
+        // Local buffer for the state vector.
+        std::vector<T> state(nvars);
+
+        for (auto idx = range.begin(); idx != range.end(); ++idx) {
+            const auto lane = idx / n_steps;
+            const auto i = idx % n_steps;
+
+            const auto t0 = times[i * bs + lane];
+            const auto t1 = times[(i + 1u) * bs + lane];
+            const auto hmax = t1 - t0;
+
+            using std::isfinite;
+
+            // NOTE: skip empty steps, which may
+            // result from the padding in batch mode.
+            if (!isfinite(hmax) || hmax == 0) {
+                continue;
+            }
+
+            const auto *pars_ptr = lane_pars.data() + lane * npars;
+
+            // The function of the time coordinate
+            // relative to the beginning of the step.
+            auto fh = [&](const T &h) {
+                for (std::size_t j = 0; j < nvars; ++j) {
+                    // Evaluate the Taylor polynomial of
+                    // the j-th state variable via Horner's scheme.
+                    const auto *cf = tcs.data() + (i * nvars + j) * ncoeffs * bs + lane;
+
+                    T acc = cf[(ncoeffs - 1u) * bs];
+                    for (std::size_t k = ncoeffs - 1u; k > 0u; --k) {
+                        acc = acc * h + cf[(k - 1u) * bs];
+                    }
+
+                    state[j] = acc;
+                }
+
+                T ret{};
+                fptr(&ret, state.data(), pars_ptr);
+
+                return ret;
+            };
+
+            auto &roots = step_roots[idx];
+
+            // NOTE: the right endpoint of a step is the left endpoint of the
+            // next one, thus exact zeroes at the right endpoint are considered
+            // only for the last step.
+            T h_prev = 0, f_prev = fh(h_prev);
+            if (f_prev == 0) {
+                roots.push_back(t0);
+            }
+
+            for (std::uint32_t k = 1; k <= nsamples; ++k) {
+                const auto h_cur = k == nsamples ? hmax : hmax * static_cast<T>(k) / static_cast<T>(nsamples);
+                const auto f_cur = fh(h_cur);
+
+                if (f_cur == 0) {
+                    if (k < nsamples || i + 1u == n_steps) {
+                        roots.push_back(t0 + h_cur);
+                    }
+                } else if (f_prev != 0 && (f_prev > 0) != (f_cur > 0)) {
+                    // Sign change, refine the root.
+                    // NOTE: toms748_solve() requires the bracket
+                    // to be ordered, which is not the case for
+                    // backward integrations.
+                    auto lb = h_prev, ub = h_cur, f_lb = f_prev, f_ub = f_cur;
+                    if (hmax < 0) {
+                        std::swap(lb, ub);
+                        std::swap(f_lb, f_ub);
+                    }
+
+                    std::uintmax_t max_iter = 100;
+                    const auto [r_lb, r_ub] = boost::math::tools::toms748_solve(
+                        fh, lb, ub, f_lb, f_ub, boost::math::tools::eps_tolerance<T>(), max_iter);
+
+                    roots.push_back(t0 + (r_lb + r_ub) / 2);
+                }
+
+                h_prev = h_cur;
+                f_prev = f_cur;
+            }
+        }
+    });
+
+    // Concatenate the roots of each lane.
+    std::vector<std::vector<T>> retval(bs);
+    for (std::size_t idx = 0; idx < step_roots.size(); ++idx) {
+        auto &lane_roots = retval[idx / n_steps];
+        lane_roots.insert(lane_roots.end(), step_roots[idx].begin(), step_roots[idx].end());
+    }
+
+    return retval;
+}
+
 // Exposition for the scalar continuous output.
 template <typename T>
 void expose_c_output_impl(py::module &m, const std::string &suffix)
@@ -97,7 +333,8 @@ void expose_c_output_impl(py::module &m, const std::string &suffix)
             "time"_a.noconvert())
         .def(
             "__call__",
-            [](py::object &o, const py::iterable &tm_ob) {
+            [](py::object &o, const py::iterable &tm_ob,
+               const std::optional<std::vector<std::uint32_t>> &components) {
                 // Convert the input iterable into an array of the correct type.
                 py::array tm = tm_ob;
                 const auto dt = get_dtype<T>();
@@ -107,8 +344,15 @@ void expose_c_output_impl(py::module &m, const std::string &suffix)
 
                 auto *c_out = py::cast<c_output_t *>(o);
 
+                // Validate the components, if provided.
+                if (components) {
+                    check_state_components(*components, c_out->get_output().size(),
+                                           "the call operator of a continuous_output object");
+                }
+
                 // Number of columns in the return value.
-                const auto ncols = boost::numeric_cast<py::ssize_t>(c_out->get_output().size());
+                const auto ncols
+                    = boost::numeric_cast<py::ssize_t>(components ? components->size() : c_out->get_output().size());
 
                 // NOTE: investigate about GIL release here. Can we use unchecked
                 // access to tm without holding the GIL?
@@ -165,12 +409,20 @@ void expose_c_output_impl(py::module &m, const std::string &suffix)
                 for (py::ssize_t i = 0; i < nrows; ++i) {
                     (*c_out)(u_tm(i));
 
-                    std::copy(c_out->get_output().begin(), c_out->get_output().end(), ret_ptr + i * ncols);
+                    const auto &output = c_out->get_output();
+
+                    if (components) {
+                        // Copy only the selected components.
+                        std::transform(components->begin(), components->end(), ret_ptr + i * ncols,
+                                       [&output](auto idx) { return output[idx]; });
+                    } else {
+                        std::copy(output.begin(), output.end(), ret_ptr + i * ncols);
+                    }
                 }
 
                 return ret;
             },
-            "time"_a)
+            "time"_a, "components"_a = py::none{})
         .def_property_readonly("output",
                                [](const py::object &o) -> py::object {
                                    auto *c_out = py::cast<const c_output_t *>(o);
@@ -254,6 +506,60 @@ void expose_c_output_impl(py::module &m, const std::string &suffix)
 
     // Expose the llvm state getter.
     expose_llvm_state_property(c_out_c);
+
+    // Root finding.
+    // NOTE: this is available only for the floating-point
+    // types supported by the root-finding algorithm.
+    if constexpr (std::is_same_v<T, double> || std::is_same_v<T, long double>) {
+        // The precompiled root functions.
+        py::class_<c_out_root_fn<T>, std::shared_ptr<c_out_root_fn<T>>>(
+            m, fmt::format("_c_out_root_fn_{}", suffix).c_str());
+
+        c_out_c.def(
+            "compile_root_fn",
+            [](const c_output_t &c_out, const hey::expression &fn, const std::vector<hey::expression> &vars) {
+                if (c_out.get_tcs().empty()) {
+                    py_throw(PyExc_ValueError,
+                             "Cannot compile a root function for a default-constructed continuous_output object");
+                }
+
+                return c_out_compile_root_fn<T>(fn, vars, c_out.get_output().size());
+            },
+            "fn"_a, "vars"_a);
+
+        c_out_c.def(
+            "find_roots",
+            [](const c_output_t &c_out, const py::object &fn, const std::optional<std::vector<hey::expression>> &vars,
+               std::vector<T> pars, std::uint32_t nsamples) {
+                if (c_out.get_tcs().empty()) {
+                    py_throw(PyExc_ValueError, "Cannot find roots in a default-constructed continuous_output object");
+                }
+
+                if (nsamples == 0u) {
+                    py_throw(PyExc_ValueError, "The number of samples per step in find_roots() cannot be zero");
+                }
+
+                const auto nvars = c_out.get_output().size();
+                const auto n_steps = c_out.get_n_steps();
+                const auto npars = pars.size();
+
+                const auto root_fn = c_out_fetch_root_fn<T>(fn, vars, nvars, npars);
+
+                std::vector<T> roots;
+
+                {
+                    py::gil_scoped_release release;
+
+                    roots = std::move(c_out_find_roots(c_out.get_tcs(), c_out.get_times(), n_steps, nvars, 1,
+                                                       root_fn->fptr, pars, npars, nsamples)[0]);
+                }
+
+                return py::array(py::dtype(get_dtype<T>()),
+                                 py::array::ShapeContainer{boost::numeric_cast<py::ssize_t>(roots.size())},
+                                 roots.data());
+            },
+            "fn"_a, "vars"_a = py::none{}, "pars"_a = py::list{}, "nsamples"_a = 16u);
+    }
 }
 
 // Exposition for the batch continuous output.
@@ -296,7 +602,11 @@ void expose_c_output_batch_impl(py::module &m, const std::string &suffix)
              })
         .def(
             "__call__",
-            [](py::object &o, const py::iterable &tm_ob) {
+            [](py::object &o, const py::iterable &tm_ob, const std::optional<std::vector<std::uint32_t>> &components,
+               const std::string &layout_name) {
+                const auto layout
+                    = parse_batch_layout(layout_name, "the call operator of a continuous_output_batch object");
+
                 // Convert the input iterable into an array of the correct type.
                 py::array tm = tm_ob;
                 const auto dt = get_dtype<T>();
@@ -315,6 +625,30 @@ void expose_c_output_batch_impl(py::module &m, const std::string &suffix)
                 assert(c_out->get_output().size() % batch_size == 0u);
                 const auto dim = c_out->get_output().size() / batch_size;
 
+                // Validate the components, if provided.
+                if (components) {
+                    check_state_components(*components, dim,
+                                           "the call operator of a continuous_output_batch object");
+                }
+
+                // Number of components in the return value.
+                const auto ncomps = components ? components->size() : dim;
+
+                // Helper to copy the selected components of the output
+                // of c_out into the buffer starting at out_ptr.
+                auto copy_output = [&](T *out_ptr) {
+                    const auto &output = c_out->get_output();
+
+                    if (components) {
+                        for (decltype(components->size()) k = 0; k < components->size(); ++k) {
+                            const auto *row_ptr = output.data() + (*components)[k] * batch_size;
+                            std::copy(row_ptr, row_ptr + batch_size, out_ptr + k * batch_size);
+                        }
+                    } else {
+                        std::copy(output.begin(), output.end(), out_ptr);
+                    }
+                };
+
                 // The shape of tm must be either
                 // - (batch_size, ) (i.e., compute for a single time batch), or
                 // - (n, batch_size) (i.e., compute for a n time batches).
@@ -349,6 +683,28 @@ void expose_c_output_batch_impl(py::module &m, const std::string &suffix)
                         (*c_out)(tm_copy);
                     }
 
+                    if (layout == batch_layout::lane) {
+                        // NOTE: in lane layout, return a (batch_size, ncomps) copy.
+                        auto ret = py::array(tm.dtype(),
+                                             py::array::ShapeContainer{boost::numeric_cast<py::ssize_t>(batch_size),
+                                                                       boost::numeric_cast<py::ssize_t>(ncomps)});
+                        write_lane_block(static_cast<T *>(ret.mutable_data()), c_out->get_output().data(), 0, 1, dim,
+                                         batch_size, components);
+
+                        return ret;
+                    }
+
+                    if (components) {
+                        // NOTE: when projecting, we cannot return a view
+                        // on the output of c_out. Return a copy instead.
+                        auto ret = py::array(tm.dtype(),
+                                             py::array::ShapeContainer{boost::numeric_cast<py::ssize_t>(ncomps),
+                                                                       boost::numeric_cast<py::ssize_t>(batch_size)});
+                        copy_output(static_cast<T *>(ret.mutable_data()));
+
+                        return ret;
+                    }
+
                     auto ret = py::array(tm.dtype(),
                                          py::array::ShapeContainer{boost::numeric_cast<py::ssize_t>(dim),
                                                                    boost::numeric_cast<py::ssize_t>(batch_size)},
@@ -372,9 +728,11 @@ void expose_c_output_batch_impl(py::module &m, const std::string &suffix)
                     const auto nrows = tm.shape(0);
 
                     // Setup the return value.
-                    auto ret = py::array(tm.dtype(),
-                                         py::array::ShapeContainer{nrows, boost::numeric_cast<py::ssize_t>(dim),
-                                                                   boost::numeric_cast<py::ssize_t>(batch_size)});
+                    const auto lane = layout == batch_layout::lane;
+                    const auto ncomps_s = boost::numeric_cast<py::ssize_t>(ncomps);
+                    const auto bs_s = boost::numeric_cast<py::ssize_t>(batch_size);
+                    auto ret = py::array(tm.dtype(), lane ? py::array::ShapeContainer{bs_s, nrows, ncomps_s}
+                                                          : py::array::ShapeContainer{nrows, ncomps_s, bs_s});
 
                     // Fetch a pointer for writing.
                     auto *ret_ptr = static_cast<T *>(ret.mutable_data());
@@ -400,16 +758,20 @@ void expose_c_output_batch_impl(py::module &m, const std::string &suffix)
                         (*c_out)(tmp_buffer);
 
                         // Copy over to ret.
-                        std::copy(c_out->get_output().begin(), c_out->get_output().end(),
-                                  ret_ptr
-                                      + i * boost::numeric_cast<py::ssize_t>(dim)
-                                            * boost::numeric_cast<py::ssize_t>(batch_size));
+                        if (lane) {
+                            write_lane_block(ret_ptr, c_out->get_output().data(), static_cast<std::size_t>(i),
+                                             static_cast<std::size_t>(nrows), dim, batch_size, components);
+                        } else {
+                            copy_output(ret_ptr
+                                        + i * boost::numeric_cast<py::ssize_t>(ncomps)
+                                              * boost::numeric_cast<py::ssize_t>(batch_size));
+                        }
                     }
 
                     return ret;
                 }
             },
-            "time"_a)
+            "time"_a, "components"_a = py::none{}, "layout"_a = "component")
         .def_property_readonly("output",
                                [](const py::object &o) -> py::object {
                                    auto *c_out = py::cast<const c_output_t *>(o);
@@ -523,6 +885,96 @@ void expose_c_output_batch_impl(py::module &m, const std::string &suffix)
 
     // Expose the llvm state getter.
     expose_llvm_state_property(c_out_c);
+
+    // Root finding.
+    // NOTE: the root functions are compiled in scalar mode and
+    // evaluated lane by lane, hence they are shared with the scalar
+    // continuous output class.
+    c_out_c.def(
+        "compile_root_fn",
+        [](const c_output_t &c_out, const hey::expression &fn, const std::vector<hey::expression> &vars) {
+            if (c_out.get_tcs().empty()) {
+                py_throw(PyExc_ValueError,
+                         "Cannot compile a root function for a default-constructed continuous_output_batch object");
+            }
+
+            const auto batch_size = c_out.get_batch_size();
+            assert(batch_size > 0u);
+            assert(c_out.get_output().size() % batch_size == 0u);
+
+            return c_out_compile_root_fn<T>(fn, vars, c_out.get_output().size() / batch_size);
+        },
+        "fn"_a, "vars"_a);
+    c_out_c.def(
+        "find_roots",
+        [](const c_output_t &c_out, const py::object &fn, const std::optional<std::vector<hey::expression>> &vars,
+           std::optional<py::iterable> pars_ob, std::uint32_t nsamples) {
+            if (c_out.get_tcs().empty()) {
+                py_throw(PyExc_ValueError,
+                         "Cannot find roots in a default-constructed continuous_output_batch object");
+            }
+
+            if (nsamples == 0u) {
+                py_throw(PyExc_ValueError, "The number of samples per step in find_roots() cannot be zero");
+            }
+
+            const auto batch_size = c_out.get_batch_size();
+            assert(batch_size > 0u);
+            assert(c_out.get_output().size() % batch_size == 0u);
+            const auto nvars = c_out.get_output().size() / batch_size;
+            const auto n_steps = c_out.get_n_steps();
+
+            // Convert the parameter values, if provided. The expected
+            // shape is (npars, batch_size).
+            std::size_t npars = 0;
+            std::vector<T> pars;
+            if (pars_ob) {
+                py::array pars_arr = from_dlpack(*pars_ob);
+
+                if (pars_arr.ndim() != 2 || boost::numeric_cast<std::uint32_t>(pars_arr.shape(1)) != batch_size) {
+                    py_throw(PyExc_ValueError,
+                             fmt::format("Invalid parameter array passed to find_roots(): the expected array shape "
+                                         "is (n, {}), but the input array has either the wrong number of "
+                                         "dimensions or the wrong shape",
+                                         batch_size)
+                                 .c_str());
+                }
+
+                npars = boost::numeric_cast<std::size_t>(pars_arr.shape(0));
+                pars = py::cast<std::vector<T>>(pars_arr.attr("flatten")());
+            }
+
+            const auto root_fn = c_out_fetch_root_fn<T>(fn, vars, nvars, npars);
+
+            std::vector<std::vector<T>> roots;
+
+            {
+                py::gil_scoped_release release;
+
+                // Transpose the parameter values, so that
+                // the values of each lane are contiguous.
+                std::vector<T> lane_pars(npars * batch_size);
+                for (std::uint32_t lane = 0; lane < batch_size; ++lane) {
+                    for (std::size_t j = 0; j < npars; ++j) {
+                        lane_pars[lane * npars + j] = pars[j * batch_size + lane];
+                    }
+                }
+
+                roots = c_out_find_roots(c_out.get_tcs(), c_out.get_times(), n_steps, nvars, batch_size,
+                                         root_fn->fptr, lane_pars, npars, nsamples);
+            }
+
+            // Return a list of arrays, one per lane.
+            py::list ret;
+            for (const auto &r : roots) {
+                ret.append(py::array(py::dtype(get_dtype<T>()),
+                                     py::array::ShapeContainer{boost::numeric_cast<py::ssize_t>(r.size())},
+                                     r.data()));
+            }
+
+            return ret;
+        },
+        "fn"_a, "vars"_a = py::none{}, "pars"_a = py::none{}, "nsamples"_a = 16u);
 }
 
 } // namespace
@@ -11,8 +11,11 @@
 #include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <initializer_list>
+#include <memory>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <tuple>
@@ -47,10 +50,12 @@
 #include <heyoka/expression.hpp>
 #include <heyoka/taylor.hpp>
 
+#include "adaptive_grid.hpp"
 #include "common_utils.hpp"
 #include "custom_casters.hpp"
 #include "dtypes.hpp"
 #include "pickle_wrappers.hpp"
+#include "state_outputs.hpp"
 #include "taylor_expose_integrator.hpp"
 
 namespace heyoka_py
@@ -238,33 +243,87 @@ void expose_taylor_integrator_impl(py::module &m, const std::string &suffix)
         .def(
             "propagate_grid",
             [](hey::taylor_adaptive<T> &ta, std::vector<T> grid, std::size_t max_steps, T max_delta_t,
-               const prop_cb_t &cb_) {
+               const prop_cb_t &cb_, const std::optional<std::vector<std::uint32_t>> &components,
+               const std::optional<py::object> &outputs) {
+                if (components && outputs) {
+                    py_throw(PyExc_ValueError,
+                             "The 'components' and 'outputs' arguments of propagate_grid() cannot be used together");
+                }
+
+                // Validate the components, if provided.
+                if (components) {
+                    check_state_components(*components, ta.get_dim(), "propagate_grid()");
+                }
+
+                // Compile the output expressions (or fetch the precompiled
+                // outputs), if provided.
+                // NOTE: do it before the propagation, so that
+                // errors are raised without altering the state of ta.
+                std::shared_ptr<const state_outputs<T>> s_outs;
+                if (outputs) {
+                    s_outs = fetch_state_outputs<T>(ta, *outputs);
+                }
+
                 // Create the callback wrapper.
                 auto cb = make_prop_cb(cb_);
 
                 decltype(ta.propagate_grid(grid, max_steps)) ret;
+                std::vector<T> outs_v;
 
                 {
                     py::gil_scoped_release release;
                     ret = ta.propagate_grid(std::move(grid), kw::max_steps = max_steps, kw::max_delta_t = max_delta_t,
                                             kw::callback = cb);
+
+                    // Evaluate the outputs on the state vectors.
+                    if (s_outs) {
+                        outs_v = (*s_outs)(std::get<4>(ret), ta.get_pars());
+                    }
                 }
 
                 // Determine the number of state vectors returned
                 // (could be < grid.size() if errors arise).
-                assert(std::get<4>(ret).size() % ta.get_dim() == 0u);
-                const auto nrows = boost::numeric_cast<py::ssize_t>(std::get<4>(ret).size() / ta.get_dim());
-                const auto ncols = boost::numeric_cast<py::ssize_t>(ta.get_dim());
+                const auto dim = ta.get_dim();
+                auto &states = std::get<4>(ret);
+                assert(states.size() % dim == 0u);
+                const auto nrows = states.size() / dim;
+
+                if (s_outs) {
+                    // Return the outputs in place of the state vectors.
+                    py::array a_ret(py::dtype(get_dtype<T>()),
+                                    py::array::ShapeContainer{boost::numeric_cast<py::ssize_t>(nrows),
+                                                              boost::numeric_cast<py::ssize_t>(s_outs->get_nouts())},
+                                    outs_v.data());
+
+                    return py::make_tuple(std::get<0>(ret), std::get<1>(ret), std::get<2>(ret), std::get<3>(ret),
+                                          std::move(a_ret));
+                }
+
+                // Project the state vectors onto the requested components, if needed.
+                std::vector<T> proj;
+                if (components) {
+                    proj.reserve(nrows * components->size());
+
+                    for (decltype(states.size()) i = 0; i < nrows; ++i) {
+                        for (const auto idx : *components) {
+                            proj.push_back(states[i * dim + idx]);
+                        }
+                    }
+                }
+
+                const auto ncols = boost::numeric_cast<py::ssize_t>(components ? components->size() : dim);
 
                 // Convert the output to a NumPy array.
-                py::array a_ret(py::dtype(get_dtype<T>()), py::array::ShapeContainer{nrows, ncols},
-                                std::get<4>(ret).data());
+                py::array a_ret(py::dtype(get_dtype<T>()),
+                                py::array::ShapeContainer{boost::numeric_cast<py::ssize_t>(nrows), ncols},
+                                components ? proj.data() : states.data());
 
                 return py::make_tuple(std::get<0>(ret), std::get<1>(ret), std::get<2>(ret), std::get<3>(ret),
                                       std::move(a_ret));
             },
             "grid"_a.noconvert(), "max_steps"_a = 0,
-            "max_delta_t"_a.noconvert() = hey::detail::taylor_default_max_delta_t<T>(), "callback"_a = prop_cb_t{})
+            "max_delta_t"_a.noconvert() = hey::detail::taylor_default_max_delta_t<T>(), "callback"_a = prop_cb_t{},
+            "components"_a = py::none{}, "outputs"_a = py::none{})
         // Repr.
         .def("__repr__",
              [](const hey::taylor_adaptive<T> &ta) {
@@ -296,6 +355,27 @@ void expose_taylor_integrator_impl(py::module &m, const std::string &suffix)
     // Expose the llvm state getter.
     expose_llvm_state_property(cl);
 
+    // The compiled outputs, which can be passed to the propagation
+    // functions in place of the list of output expressions.
+    py::class_<state_outputs<T>, std::shared_ptr<state_outputs<T>>>(
+        m, (fmt::format("_state_outputs_{}", suffix)).c_str())
+        .def_property_readonly("nouts", &state_outputs<T>::get_nouts);
+
+    cl.def(
+        "compile_outputs",
+        [](const hey::taylor_adaptive<T> &ta, const std::vector<hey::expression> &outputs) {
+            return std::make_shared<state_outputs<T>>(ta, outputs);
+        },
+        "outputs"_a);
+
+    if constexpr (std::is_floating_point_v<T>) {
+        // Propagation with adaptive grid output.
+        cl.def("propagate_adaptive_grid", &propagate_adaptive_grid<T>, "t"_a.noconvert(), "dt"_a.noconvert(),
+               "refine"_a = 10u, "window"_a.noconvert() = py::none{}, "max_change"_a.noconvert() = py::none{},
+               "outputs"_a = py::none{}, "events"_a = py::none{}, "max_steps"_a = 0,
+               "max_delta_t"_a.noconvert() = hey::detail::taylor_default_max_delta_t<T>());
+    }
+
 #if defined(HEYOKA_HAVE_REAL)
 
     if constexpr (std::is_same_v<T, mppp::real>) {
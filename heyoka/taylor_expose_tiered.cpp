@@ -0,0 +1,305 @@
+// Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+//
+// This file is part of the heyoka.py library.
+//
+// This Source Code Form is subject to the terms of the Mozilla
+// Public License v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <heyoka/config.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <oneapi/tbb/parallel_invoke.h>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <Python.h>
+
+#if defined(HEYOKA_HAVE_REAL)
+
+#include <mp++/real.hpp>
+
+#endif
+
+#include <heyoka/expression.hpp>
+#include <heyoka/s11n.hpp>
+#include <heyoka/taylor.hpp>
+
+#include "common_utils.hpp"
+#include "custom_casters.hpp"
+#include "pickle_wrappers.hpp"
+#include "taylor_expose_tiered.hpp"
+
+namespace heyoka_py
+{
+
+namespace py = pybind11;
+namespace hey = heyoka;
+
+namespace detail
+{
+
+namespace
+{
+
+template <typename T>
+constexpr bool default_cm =
+#if defined(HEYOKA_HAVE_REAL)
+    std::is_same_v<T, mppp::real>
+#else
+    false
+#endif
+    ;
+
+// A pair of integrators for the same ODE system, differing only
+// in the tolerance (and thus in the Taylor order): a loose-tolerance
+// integrator for fast screening, and an accurate integrator for refinement.
+// Only one integrator (the active tier) is in use at any given time. When
+// switching tier, the time, state and parameters are transferred from
+// the previously-active integrator, so that the propagation can switch
+// precision on demand without reconstructing/recompiling anything.
+template <typename T>
+struct taylor_tiered {
+    // NOTE: index 0 is the loose tier, index 1 the accurate tier.
+    std::array<hey::taylor_adaptive<T>, 2> tas;
+    unsigned tier = 0;
+
+    // Serialisation.
+    template <typename Archive>
+    void serialize(Archive &ar, unsigned)
+    {
+        ar &tas[0];
+        ar &tas[1];
+        ar &tier;
+    }
+
+    static unsigned tier_index(const std::string &name)
+    {
+        if (name == "loose") {
+            return 0;
+        }
+
+        if (name == "accurate") {
+            return 1;
+        }
+
+        py_throw(PyExc_ValueError,
+                 fmt::format("Invalid tier '{}' for a tiered integrator: the tier must be either 'loose' or 'accurate'",
+                             name)
+                     .c_str());
+    }
+
+    std::string get_tier() const
+    {
+        return tier == 0u ? "loose" : "accurate";
+    }
+
+    void set_tier(const std::string &name)
+    {
+        const auto new_tier = tier_index(name);
+
+        if (new_tier == tier) {
+            return;
+        }
+
+        const auto &src = tas[tier];
+        auto &dst = tas[new_tier];
+
+        // NOTE: transfer the time in double-length format,
+        // so that no precision is lost in long propagations.
+        const auto [hi, lo] = src.get_dtime();
+        dst.set_dtime(hi, lo);
+        std::copy(src.get_state().begin(), src.get_state().end(), dst.get_state_data());
+        std::copy(src.get_pars().begin(), src.get_pars().end(), dst.get_pars_data());
+        dst.reset_cooldowns();
+
+        tier = new_tier;
+    }
+
+    hey::taylor_adaptive<T> &active()
+    {
+        return tas[tier];
+    }
+};
+
+// Helper to fetch the active integrator of the tiered integrator
+// o as a Python object, whose lifetime is tied to o.
+template <typename T>
+py::object active_ta(py::object &o)
+{
+    auto &tt = py::cast<taylor_tiered<T> &>(o);
+
+    return py::cast(&tt.active(), py::return_value_policy::reference_internal, o);
+}
+
+// Helper to forward the invocation of the method name to the active
+// integrator. If the "tier" keyword argument is present, the tier is
+// switched before the invocation.
+template <typename T>
+py::object forward_call(const char *name, py::object &o, const py::args &args, py::kwargs kwargs)
+{
+    if (kwargs.contains("tier")) {
+        const auto tier = kwargs["tier"].template cast<std::string>();
+        PyDict_DelItemString(kwargs.ptr(), "tier");
+
+        py::cast<taylor_tiered<T> &>(o).set_tier(tier);
+    }
+
+    return active_ta<T>(o).attr(name)(*args, **kwargs);
+}
+
+template <typename T>
+void expose_taylor_tiered_impl(py::module &m, const std::string &suffix)
+{
+    using namespace py::literals;
+    namespace kw = heyoka::kw;
+
+    using t_ev_t = hey::t_event<T>;
+    using nt_ev_t = hey::nt_event<T>;
+    using tt_t = taylor_tiered<T>;
+
+    // Union of ODE system types, used in the ctor.
+    using sys_t = std::variant<std::vector<std::pair<hey::expression, hey::expression>>, std::vector<hey::expression>>;
+
+    py::class_<tt_t> cl(m, (fmt::format("taylor_adaptive_tiered_{}", suffix)).c_str(), py::dynamic_attr{});
+    cl.def(py::init([](const sys_t &sys, std::vector<T> state, T time, std::vector<T> pars, T loose_tol, T tol,
+                       bool high_accuracy, bool compact_mode, std::vector<t_ev_t> tes, std::vector<nt_ev_t> ntes,
+                       bool parallel_mode, unsigned opt_level, bool force_avx512, bool fast_math,
+                       const std::string &tier) {
+               using std::isfinite;
+
+               if (!isfinite(loose_tol) || !(loose_tol > 0)) {
+                   py_throw(PyExc_ValueError,
+                            fmt::format("The loose tolerance of a tiered integrator must be positive and finite, "
+                                        "but it is {} instead",
+                                        loose_tol)
+                                .c_str());
+               }
+
+               const auto init_tier = tt_t::tier_index(tier);
+
+               // NOTE: the events may contain Python callbacks, hence
+               // they need to be copied while holding the GIL. Afterwards,
+               // they are only moved around.
+               auto tes_copy = tes;
+               auto ntes_copy = ntes;
+               auto state_copy = state;
+               auto pars_copy = pars;
+
+               std::optional<hey::taylor_adaptive<T>> loose_ta, accurate_ta;
+
+               std::visit(
+                   [&](const auto &val) {
+                       // NOTE: release the GIL while the two integrators
+                       // are being constructed (and compiled) concurrently.
+                       py::gil_scoped_release release;
+
+                       auto make_ta = [&](auto &out, std::vector<T> st, std::vector<T> ps, T t,
+                                          std::vector<t_ev_t> te, std::vector<nt_ev_t> nte) {
+                           out.emplace(val, std::move(st), kw::time = time, kw::tol = t,
+                                       kw::high_accuracy = high_accuracy, kw::compact_mode = compact_mode,
+                                       kw::pars = std::move(ps), kw::t_events = std::move(te),
+                                       kw::nt_events = std::move(nte), kw::parallel_mode = parallel_mode,
+                                       kw::opt_level = opt_level, kw::force_avx512 = force_avx512,
+                                       kw::fast_math = fast_math);
+                       };
+
+                       oneapi::tbb::parallel_invoke(
+                           [&]() {
+                               make_ta(loose_ta, std::move(state_copy), std::move(pars_copy), loose_tol,
+                                       std::move(tes_copy), std::move(ntes_copy));
+                           },
+                           [&]() {
+                               make_ta(accurate_ta, std::move(state), std::move(pars), tol, std::move(tes),
+                                       std::move(ntes));
+                           });
+                   },
+                   sys);
+
+               if (loose_ta->get_tol() < accurate_ta->get_tol()) {
+                   py_throw(PyExc_ValueError,
+                            fmt::format("The loose tolerance of a tiered integrator ({}) cannot be smaller than the "
+                                        "accurate tolerance ({})",
+                                        loose_ta->get_tol(), accurate_ta->get_tol())
+                                .c_str());
+               }
+
+               return tt_t{{std::move(*loose_ta), std::move(*accurate_ta)}, init_tier};
+           }),
+           "sys"_a, "state"_a.noconvert(), "time"_a.noconvert() = static_cast<T>(0), "pars"_a.noconvert() = py::list{},
+           "loose_tol"_a.noconvert() = static_cast<T>(1e-6), "tol"_a.noconvert() = static_cast<T>(0),
+           "high_accuracy"_a = false, "compact_mode"_a = default_cm<T>, "t_events"_a = py::list{}, "nt_events"_a = py::list{},
+           "parallel_mode"_a = false, "opt_level"_a.noconvert() = 3, "force_avx512"_a.noconvert() = false,
+           "fast_math"_a.noconvert() = false, "tier"_a = "loose");
+
+    // The tiers.
+    cl.def_property("tier", &tt_t::get_tier, &tt_t::set_tier);
+    cl.def_property_readonly("active", &active_ta<T>);
+    cl.def_property_readonly(
+        "loose", [](tt_t &tt) -> hey::taylor_adaptive<T> & { return tt.tas[0]; },
+        py::return_value_policy::reference_internal);
+    cl.def_property_readonly(
+        "accurate", [](tt_t &tt) -> hey::taylor_adaptive<T> & { return tt.tas[1]; },
+        py::return_value_policy::reference_internal);
+
+    // The state, parameters and time of the active tier.
+    cl.def_property_readonly("state", [](py::object &o) { return active_ta<T>(o).attr("state"); });
+    cl.def_property_readonly("pars", [](py::object &o) { return active_ta<T>(o).attr("pars"); });
+    cl.def_property(
+        "time", [](tt_t &tt) { return tt.active().get_time(); },
+        [](tt_t &tt, T t) { tt.active().set_time(t); });
+
+    // The stepping/propagation functions of the active tier. They accept
+    // the same arguments as the corresponding methods of the integrators,
+    // plus an optional "tier" argument to switch tier before the invocation.
+    for (const auto *name : {"step", "step_backward", "propagate_until", "propagate_for", "propagate_grid",
+                              "propagate_adaptive_grid"}) {
+        cl.def(name, [name](py::object &o, const py::args &args, const py::kwargs &kwargs) {
+            return forward_call<T>(name, o, args, kwargs);
+        });
+    }
+
+    cl.def("__repr__", [](const tt_t &tt) {
+        std::ostringstream oss;
+        oss << "Tiered integrator (active tier: " << tt.get_tier() << ")\n\nLoose tier:\n"
+            << tt.tas[0] << "\nAccurate tier:\n"
+            << tt.tas[1];
+        return oss.str();
+    });
+
+    // Copy/deepcopy.
+    cl.def("__copy__", copy_wrapper<tt_t>);
+    cl.def("__deepcopy__", deepcopy_wrapper<tt_t>, "memo"_a);
+
+    // Pickle support.
+    cl.def(py::pickle(&pickle_getstate_wrapper<tt_t>, &pickle_setstate_wrapper<tt_t>));
+}
+
+} // namespace
+
+} // namespace detail
+
+void expose_taylor_tiered_dbl(py::module &m)
+{
+    detail::expose_taylor_tiered_impl<double>(m, "dbl");
+}
+
+void expose_taylor_tiered_ldbl(py::module &m)
+{
+    detail::expose_taylor_tiered_impl<long double>(m, "ldbl");
+}
+
+} // namespace heyoka_py
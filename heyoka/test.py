@@ -1833,6 +1833,150 @@ class scalar_integrator_test_case(_ut.TestCase):
         self.test_copy()
         self.test_dtime()
         self.test_type_conversions()
+        self.test_propagate_grid_components()
+        self.test_propagate_grid_outputs()
+
+    def test_propagate_grid_outputs(self):
+        from . import taylor_adaptive, make_vars, sin, cos, par
+        import numpy as np
+
+        x, v = make_vars("x", "v")
+
+        sys = [(x, v), (v, -par[0] * sin(x))]
+
+        ta = taylor_adaptive(sys=sys, state=[0.0, 0.25], pars=[9.8])
+
+        grid = np.linspace(0, 10, 100)
+
+        full = ta.propagate_grid(grid)[4]
+
+        ta.time = 0.0
+        ta.state[:] = [0.0, 0.25]
+
+        # Energy and a simple function of the state.
+        res = ta.propagate_grid(grid, outputs=[v * v / 2.0 - par[0] * cos(x), x + v])[4]
+        self.assertEqual(res.shape, (100, 2))
+
+        en = full[:, 1] ** 2 / 2.0 - 9.8 * np.cos(full[:, 0])
+        self.assertTrue(np.allclose(res[:, 0], en, rtol=1e-14, atol=1e-14))
+        self.assertTrue(np.allclose(res[:, 1], full[:, 0] + full[:, 1], rtol=1e-14))
+
+        # Error modes.
+        with self.assertRaises(ValueError) as cm:
+            ta.propagate_grid(grid, outputs=[])
+        self.assertTrue(
+            "The list of output expressions cannot be empty" in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            ta.propagate_grid(grid, outputs=[x + par[1]])
+        self.assertTrue(
+            "The list of output expressions contains 2 parameter(s), but the integrator has only 1 parameter(s)"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            ta.propagate_grid(grid, outputs=[x], components=[0])
+        self.assertTrue(
+            "The 'components' and 'outputs' arguments of propagate_grid() cannot be used together"
+            in str(cm.exception)
+        )
+
+        # Precompiled outputs, reused across propagations
+        # and with other compatible integrators.
+        c_outs = ta.compile_outputs([v * v / 2.0 - par[0] * cos(x), x + v])
+        self.assertEqual(c_outs.nouts, 2)
+
+        for _ in range(2):
+            ta.time = 0.0
+            ta.state[:] = [0.0, 0.25]
+            self.assertTrue(
+                np.array_equal(ta.propagate_grid(grid, outputs=c_outs)[4], res)
+            )
+
+        ta2 = taylor_adaptive(sys=sys, state=[0.0, 0.25], pars=[9.8], tol=1e-12)
+        res2 = ta2.propagate_grid(grid, outputs=c_outs)[4]
+        self.assertTrue(np.allclose(res2, res, rtol=1e-10, atol=1e-10))
+
+        ta.time = 0.0
+        ta.state[:] = [0.0, 0.25]
+        res_ag = ta.propagate_adaptive_grid(10.0, 0.5, outputs=c_outs)
+        self.assertEqual(res_ag[5].shape[1], 2)
+
+        with self.assertRaises(ValueError) as cm:
+            ta.compile_outputs([])
+        self.assertTrue(
+            "The list of output expressions cannot be empty" in str(cm.exception)
+        )
+
+        # Incompatible integrators.
+        y = make_vars("y")
+        ta3 = taylor_adaptive(sys=sys + [(y, x)], state=[0.0, 0.25, 0.0], pars=[9.8])
+        with self.assertRaises(ValueError) as cm:
+            ta3.propagate_grid(grid, outputs=c_outs)
+        self.assertTrue(
+            "The compiled outputs were created for an integrator with dimension 2 and batch size 1, but they "
+            "are being used with an integrator with dimension 3 and batch size 1"
+            in str(cm.exception)
+        )
+
+        # Same dimension, but different state variables.
+        ta5 = taylor_adaptive(
+            sys=[(v, -par[0] * sin(x)), (x, v)], state=[0.25, 0.0], pars=[9.8]
+        )
+        with self.assertRaises(ValueError) as cm:
+            ta5.propagate_grid(grid, outputs=c_outs)
+        self.assertTrue(
+            "The compiled outputs were created for an integrator with state variables [x, v], but they "
+            "are being used with an integrator with state variables [v, x]"
+            in str(cm.exception)
+        )
+
+        ta4 = taylor_adaptive(sys=[(x, v), (v, -sin(x))], state=[0.0, 0.25])
+        with self.assertRaises(ValueError) as cm:
+            ta4.propagate_grid(grid, outputs=c_outs)
+        self.assertTrue(
+            "The list of output expressions contains 1 parameter(s), but the integrator has only 0 parameter(s)"
+            in str(cm.exception)
+        )
+
+    def test_propagate_grid_components(self):
+        from . import taylor_adaptive, make_vars, sin
+        import numpy as np
+
+        x, v = make_vars("x", "v")
+
+        sys = [(x, v), (v, -9.8 * sin(x))]
+
+        ta = taylor_adaptive(sys=sys, state=[0.0, 0.25])
+
+        grid = np.linspace(0, 10, 100)
+
+        full = ta.propagate_grid(grid)[4]
+
+        # Check the projections against the full output.
+        for comps in [[0], [1], [1, 0], [0, 0, 1]]:
+            ta.time = 0.0
+            ta.state[:] = [0.0, 0.25]
+
+            res = ta.propagate_grid(grid, components=comps)[4]
+            self.assertEqual(res.shape, (100, len(comps)))
+            self.assertTrue(np.all(res == full[:, comps]))
+
+        # Error modes.
+        with self.assertRaises(ValueError) as cm:
+            ta.propagate_grid(grid, components=[])
+        self.assertTrue(
+            "The list of components passed to propagate_grid() cannot be empty"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            ta.propagate_grid(grid, components=[0, 2])
+        self.assertTrue(
+            "Invalid list of components passed to propagate_grid(): the component index 2 is "
+            "not less than the dimension of the state vector (2)" in str(cm.exception)
+        )
 
     def test_type_conversions(self):
         # Test to check automatic conversions of std::vector<T>
@@ -1853,6 +1997,39 @@ class scalar_integrator_test_case(_ut.TestCase):
         ta = taylor_adaptive(sys=sys, state=np.array([0.0, 0.25]), tol=1e-4)
         self.assertTrue(np.all(ta.state == [0.0, 0.25]))
 
+        # Non-contiguous and non-native byte order arrays.
+        ta = taylor_adaptive(
+            sys=sys, state=np.array([0.0, 1.0, 0.25, 2.0])[::2], tol=1e-4
+        )
+        self.assertTrue(np.all(ta.state == [0.0, 0.25]))
+        ta = taylor_adaptive(
+            sys=sys,
+            state=np.array([0.0, 0.25], dtype=np.double)
+            .byteswap()
+            .view(np.dtype(np.double).newbyteorder()),
+            tol=1e-4,
+        )
+        self.assertTrue(np.all(ta.state == [0.0, 0.25]))
+
+        # Long grids.
+        grid = np.linspace(0.0, 1.0, 1000)
+        res = ta.propagate_grid(grid)[4]
+        ta.time = 0.0
+        ta.state[:] = [0.0, 0.25]
+        self.assertTrue(np.all(ta.propagate_grid(list(grid))[4] == res))
+        ta.time = 0.0
+        ta.state[:] = [0.0, 0.25]
+        self.assertTrue(np.all(ta.propagate_grid(np.repeat(grid, 2)[::2])[4] == res))
+
+        # Long double.
+        ta = taylor_adaptive(
+            sys=sys,
+            state=np.array([0.0, 1.0, 0.25, 2.0], dtype=np.longdouble)[::2],
+            tol=np.longdouble(1e-4),
+            fp_type=np.longdouble,
+        )
+        self.assertTrue(np.all(ta.state == [0.0, 0.25]))
+
         if d_digs == ld_digs:
             return
 
@@ -2748,6 +2925,58 @@ class batch_integrator_test_case(_ut.TestCase):
         ta.set_time(0.0)
         ta.propagate_grid(grid, callback=cb_inst)
 
+        # Test the projection onto a subset of the components.
+        ta.set_time(0.0)
+        ta.state[:] = [x_ic, v_ic]
+        bres = ta.propagate_grid(grid)
+
+        for comps in [[0], [1], [1, 0], [0, 0, 1]]:
+            ta.set_time(0.0)
+            ta.state[:] = [x_ic, v_ic]
+
+            pres = ta.propagate_grid(grid, components=comps)
+            self.assertEqual(pres.shape, (4, len(comps), 4))
+            self.assertTrue(np.all(pres == bres[:, comps, :]))
+
+        with self.assertRaises(ValueError) as cm:
+            ta.propagate_grid(grid, components=[])
+        self.assertTrue(
+            "The list of components passed to propagate_grid() cannot be empty"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            ta.propagate_grid(grid, components=[3])
+        self.assertTrue(
+            "Invalid list of components passed to propagate_grid(): the component index 3 is "
+            "not less than the dimension of the state vector (2)" in str(cm.exception)
+        )
+
+        # Test the evaluation of output expressions.
+        ta.set_time(0.0)
+        ta.state[:] = [x_ic, v_ic]
+
+        ores = ta.propagate_grid(grid, outputs=[x * v, x - v])
+        self.assertEqual(ores.shape, (4, 2, 4))
+        self.assertTrue(
+            np.allclose(ores[:, 0, :], bres[:, 0, :] * bres[:, 1, :], rtol=1e-14)
+        )
+        self.assertTrue(
+            np.allclose(ores[:, 1, :], bres[:, 0, :] - bres[:, 1, :], rtol=1e-14)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            ta.propagate_grid(grid, outputs=[])
+        self.assertTrue(
+            "The list of output expressions cannot be empty" in str(cm.exception)
+        )
+
+        # Precompiled outputs.
+        c_outs = ta.compile_outputs([x * v, x - v])
+        ta.set_time(0.0)
+        ta.state[:] = [x_ic, v_ic]
+        self.assertTrue(np.array_equal(ta.propagate_grid(grid, outputs=c_outs), ores))
+
 
 class kepE_test_case(_ut.TestCase):
     def runTest(self):
@@ -3441,6 +3670,248 @@ class c_output_test_case(_ut.TestCase):
     def runTest(self):
         self.test_scalar()
         self.test_batch()
+        self.test_components()
+        self.test_find_roots()
+
+    def test_find_roots(self):
+        from . import (
+            make_vars,
+            par,
+            taylor_adaptive,
+            taylor_adaptive_batch,
+            continuous_output_dbl,
+            continuous_output_batch_dbl,
+        )
+        import numpy as np
+
+        x, v = make_vars("x", "v")
+
+        # Harmonic oscillator: x(t) = cos(t), the roots of x
+        # are at pi/2 + k*pi.
+        sys = [(x, v), (v, -x)]
+
+        for fp_t in [float, np.longdouble]:
+            ta = taylor_adaptive(sys=sys, state=[fp_t(1), fp_t(0)], fp_type=fp_t)
+            c_out = ta.propagate_until(fp_t(20), c_output=True)[4]
+
+            roots = c_out.find_roots(x, [x, v])
+            self.assertEqual(roots.dtype, np.dtype(fp_t))
+            self.assertEqual(len(roots), 6)
+            self.assertTrue(
+                np.allclose(
+                    roots,
+                    np.pi / 2 + np.arange(6) * np.pi,
+                    rtol=0,
+                    atol=np.finfo(fp_t).eps * 1e3,
+                )
+            )
+
+            # Function with parameters: the times at which x = 0.5.
+            roots = c_out.find_roots(x - par[0], [x, v], pars=[fp_t(0.5)])
+            self.assertEqual(len(roots), 7)
+            self.assertTrue(
+                np.allclose(np.cos(roots.astype(float)), 0.5, rtol=0, atol=1e-12)
+            )
+
+            # Backward integration.
+            ta = taylor_adaptive(sys=sys, state=[fp_t(1), fp_t(0)], fp_type=fp_t)
+            c_out = ta.propagate_until(fp_t(-10), c_output=True)[4]
+            roots = c_out.find_roots(x, [x, v])
+            self.assertTrue(
+                np.allclose(
+                    roots,
+                    -np.pi / 2 - np.arange(3) * np.pi,
+                    rtol=0,
+                    atol=np.finfo(fp_t).eps * 1e3,
+                )
+            )
+
+            with self.assertRaises(ValueError) as cm:
+                c_out.find_roots(x, [x])
+            self.assertTrue(
+                "The number of variables passed to find_roots() (1) must be equal to the number of state variables (2)"
+                in str(cm.exception)
+            )
+
+            with self.assertRaises(ValueError) as cm:
+                c_out.find_roots(x - par[1], [x, v], pars=[fp_t(0)])
+            self.assertTrue(
+                "requires at least 2 parameter value(s), but only 1 value(s) were provided"
+                in str(cm.exception)
+            )
+
+            with self.assertRaises(ValueError) as cm:
+                c_out.find_roots(x, [x, v], nsamples=0)
+            self.assertTrue(
+                "The number of samples per step in find_roots() cannot be zero"
+                in str(cm.exception)
+            )
+
+            # Precompiled function.
+            fn = c_out.compile_root_fn(x - par[0], [x, v])
+            for p in [0.5, -0.5]:
+                self.assertTrue(
+                    np.array_equal(
+                        c_out.find_roots(fn, pars=[fp_t(p)]),
+                        c_out.find_roots(x - par[0], [x, v], pars=[fp_t(p)]),
+                    )
+                )
+
+            with self.assertRaises(ValueError) as cm:
+                c_out.find_roots(fn, [x, v], pars=[fp_t(0.5)])
+            self.assertTrue(
+                "The list of variables cannot be passed to find_roots() together with a precompiled function"
+                in str(cm.exception)
+            )
+
+            with self.assertRaises(ValueError) as cm:
+                c_out.find_roots(fn)
+            self.assertTrue(
+                "requires at least 1 parameter value(s), but only 0 value(s) were provided"
+                in str(cm.exception)
+            )
+
+            with self.assertRaises(ValueError) as cm:
+                c_out.find_roots(x)
+            self.assertTrue(
+                "The list of variables must be passed to find_roots() when the function is not precompiled"
+                in str(cm.exception)
+            )
+
+            # A function compiled for a continuous output
+            # object with a different number of state variables.
+            y = make_vars("y")
+            ta3 = taylor_adaptive(
+                sys=[(x, v), (v, -x), (y, x)],
+                state=[fp_t(1), fp_t(0), fp_t(0)],
+                fp_type=fp_t,
+            )
+            c_out3 = ta3.propagate_until(fp_t(1), c_output=True)[4]
+            with self.assertRaises(ValueError) as cm:
+                c_out3.find_roots(fn, pars=[fp_t(0.5)])
+            self.assertTrue(
+                "The precompiled function passed to find_roots() has 2 variable(s), but the continuous output object has 3 state variable(s)"
+                in str(cm.exception)
+            )
+
+        with self.assertRaises(ValueError) as cm:
+            continuous_output_dbl().find_roots(x, [x, v])
+        self.assertTrue(
+            "Cannot find roots in a default-constructed continuous_output object"
+            in str(cm.exception)
+        )
+
+        # Batch mode, with different final times for the lanes.
+        ta = taylor_adaptive_batch(sys=sys, state=[[1.0] * 4, [0.0] * 4])
+        c_out = ta.propagate_until([5.0, 10.0, 15.0, -10.0], c_output=True)
+
+        roots = c_out.find_roots(x, [x, v])
+        self.assertEqual(len(roots), 4)
+        self.assertEqual([len(_) for _ in roots], [2, 3, 5, 3])
+        for r, sgn in zip(roots, [1, 1, 1, -1]):
+            self.assertTrue(
+                np.allclose(
+                    r,
+                    sgn * (np.pi / 2 + np.arange(len(r)) * np.pi),
+                    rtol=0,
+                    atol=1e-12,
+                )
+            )
+
+        # Per-lane parameters.
+        roots = c_out.find_roots(
+            x - par[0], [x, v], pars=np.array([[0.5, -0.5, 0.5, -0.5]])
+        )
+        for r, p in zip(roots, [0.5, -0.5, 0.5, -0.5]):
+            self.assertGreater(len(r), 0)
+            self.assertTrue(np.allclose(np.cos(r), p, rtol=0, atol=1e-12))
+
+        with self.assertRaises(ValueError) as cm:
+            c_out.find_roots(x - par[0], [x, v], pars=np.zeros((1, 3)))
+        self.assertTrue("the expected array shape is (n, 4)" in str(cm.exception))
+
+        # Precompiled function in batch mode.
+        fn = c_out.compile_root_fn(x - par[0], [x, v])
+        pars = np.array([[0.5, -0.5, 0.5, -0.5]])
+        for r1, r2 in zip(
+            c_out.find_roots(fn, pars=pars),
+            c_out.find_roots(x - par[0], [x, v], pars=pars),
+        ):
+            self.assertTrue(np.array_equal(r1, r2))
+
+        with self.assertRaises(ValueError) as cm:
+            continuous_output_batch_dbl().compile_root_fn(x, [x, v])
+        self.assertTrue(
+            "Cannot compile a root function for a default-constructed continuous_output_batch object"
+            in str(cm.exception)
+        )
+
+    def test_components(self):
+        from . import make_vars, sin, taylor_adaptive, taylor_adaptive_batch
+        import numpy as np
+
+        x, v = make_vars("x", "v")
+
+        sys = [(x, v), (v, -9.8 * sin(x))]
+
+        # Scalar.
+        ta = taylor_adaptive(sys=sys, state=[0.0, 0.25])
+        c_out = ta.propagate_until(10.0, c_output=True)[4]
+
+        tm = np.linspace(0, 10, 50)
+        full = c_out(tm)
+
+        for comps in [[0], [1], [1, 0], [0, 0, 1]]:
+            res = c_out(tm, components=comps)
+            self.assertEqual(res.shape, (50, len(comps)))
+            self.assertTrue(np.all(res == full[:, comps]))
+
+        with self.assertRaises(ValueError) as cm:
+            c_out(tm, components=[])
+        self.assertTrue(
+            "The list of components passed to the call operator of a continuous_output object cannot be empty"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            c_out(tm, components=[2])
+        self.assertTrue(
+            "the component index 2 is not less than the dimension of the state vector (2)"
+            in str(cm.exception)
+        )
+
+        # Batch.
+        ta = taylor_adaptive_batch(
+            sys=sys, state=[[0.0, 0.01, 0.02, 0.03], [0.25, 0.26, 0.27, 0.28]]
+        )
+        c_out = ta.propagate_until([10.0] * 4, c_output=True)
+
+        tm = np.repeat(np.linspace(0, 10, 50), 4).reshape((50, 4))
+        full = c_out(tm)
+
+        for comps in [[0], [1], [1, 0], [0, 0, 1]]:
+            res = c_out(tm, components=comps)
+            self.assertEqual(res.shape, (50, len(comps), 4))
+            self.assertTrue(np.all(res == full[:, comps, :]))
+
+            # Single time batch.
+            res = c_out(tm[3], components=comps)
+            self.assertEqual(res.shape, (len(comps), 4))
+            self.assertTrue(np.all(res == full[3, comps, :]))
+
+        with self.assertRaises(ValueError) as cm:
+            c_out(tm, components=[])
+        self.assertTrue(
+            "The list of components passed to the call operator of a continuous_output_batch object cannot be empty"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            c_out(tm, components=[0, 5])
+        self.assertTrue(
+            "the component index 5 is not less than the dimension of the state vector (2)"
+            in str(cm.exception)
+        )
 
     def test_batch(self):
         from copy import copy, deepcopy
@@ -4080,12 +4551,352 @@ class s11n_backend_test_case(_ut.TestCase):
         self.assertEqual(get_serialization_backend(), cp)
 
 
+class lazy_import_test_case(_ut.TestCase):
+    def runTest(self):
+        # Check that importing heyoka does not import
+        # the optional dependencies, which are set up lazily
+        # on first use.
+        import subprocess
+        import sys
+        import os
+        from . import __file__ as hy_file
+
+        # Make sure the subprocess imports the same heyoka.
+        env = dict(os.environ)
+        env["PYTHONPATH"] = os.pathsep.join(
+            [os.path.dirname(os.path.dirname(hy_file))]
+            + ([env["PYTHONPATH"]] if "PYTHONPATH" in env else [])
+        )
+
+        code = (
+            "import sys, heyoka; "
+            "print('sympy' in sys.modules, 'cloudpickle' in sys.modules); "
+            "heyoka.get_serialization_backend(); "
+            "print('cloudpickle' in sys.modules)"
+        )
+
+        out = subprocess.run(
+            [sys.executable, "-c", code],
+            capture_output=True,
+            check=True,
+            text=True,
+            env=env,
+        ).stdout.split("\n")
+
+        self.assertEqual(out[0], "False False")
+        self.assertEqual(out[1], "True")
+
+
 class ensemble_test_case(_ut.TestCase):
     def runTest(self):
         self.test_scalar()
         self.test_batch()
+        self.test_sink()
+        self.test_grid_chunked()
+        self.test_reuse_integrators()
 
-    def test_batch(self):
+    def test_reuse_integrators(self):
+        from . import (
+            ensemble_propagate_until,
+            ensemble_propagate_grid,
+            ensemble_propagate_until_batch,
+            make_vars,
+            sin,
+            par,
+            taylor_adaptive,
+            taylor_adaptive_batch,
+            nt_event,
+            t_event,
+        )
+        import numpy as np
+
+        x, v = make_vars("x", "v")
+
+        # Use a pendulum for testing purposes.
+        sys = [(x, v), (v, -par[0] * sin(x))]
+
+        ta = taylor_adaptive(sys=sys, state=[0.0] * 2, pars=[9.8])
+
+        ics = np.zeros((20, 2))
+        for i in range(20):
+            ics[i] = [0.05 + i / 100, 0.025 + i / 100]
+
+        # NOTE: gen modifies the time, the state and the pars.
+        def gen(ta, idx):
+            ta.time = ta.time + 1.0
+            ta.state[:] = ics[idx]
+            ta.pars[0] += idx / 10.0
+
+            return ta
+
+        ref = ensemble_propagate_until(ta, 10.0, 20, gen, max_workers=4)
+        ret = ensemble_propagate_until(
+            ta, 10.0, 20, gen, max_workers=4, reuse_integrators=True
+        )
+
+        self.assertEqual(len(ret), 20)
+        for i in range(20):
+            # The final state is returned in place of the integrator.
+            self.assertTrue(isinstance(ret[i][0], np.ndarray))
+            self.assertTrue(np.all(ret[i][0] == ref[i][0].state))
+            self.assertEqual(ret[i][1:], ref[i][1:])
+
+        # The original integrator is not modified.
+        self.assertEqual(ta.time, 0.0)
+        self.assertEqual(ta.pars[0], 9.8)
+
+        grid = np.linspace(1.0, 10.0, 20)
+        ref = ensemble_propagate_grid(ta, grid, 20, gen, max_workers=4)
+        ret = ensemble_propagate_grid(
+            ta, grid, 20, gen, max_workers=4, reuse_integrators=True
+        )
+
+        for i in range(20):
+            self.assertTrue(np.all(ret[i][-1] == ref[i][-1]))
+
+        # Batch mode.
+        ta = taylor_adaptive_batch(sys=sys, state=[[0.0] * 4] * 2, pars=[[9.8] * 4])
+
+        def gen(ta, idx):
+            ta.set_time(ta.time + 1.0)
+            ta.state[:] = np.repeat(ics[idx], 4).reshape((2, 4))
+            ta.pars[0] += idx / 10.0
+
+            return ta
+
+        ref = ensemble_propagate_until_batch(ta, 10.0, 20, gen, max_workers=4)
+        ret = ensemble_propagate_until_batch(
+            ta, 10.0, 20, gen, max_workers=4, reuse_integrators=True
+        )
+
+        for i in range(20):
+            self.assertTrue(np.all(ret[i][0] == ref[i][0].state))
+
+        # The time is reset in double-length format.
+        from ._ensemble_impl import _resync_ta
+        from copy import deepcopy
+
+        ta_s = taylor_adaptive(sys=sys, state=[0.0] * 2, pars=[9.8])
+        ta_s.dtime = (1.0, 1e-17)
+        ta_s2 = deepcopy(ta_s)
+        ta_s2.dtime = (5.0, 0.0)
+        _resync_ta(ta_s2, ta_s)
+        self.assertEqual(ta_s2.dtime, (1.0, 1e-17))
+
+        ta_b2 = deepcopy(ta)
+        ta_b2.set_dtime(5.0, 0.0)
+        ta.set_dtime(1.0, 1e-17)
+        _resync_ta(ta_b2, ta)
+        self.assertTrue(np.all(ta_b2.dtime[0] == 1.0))
+        self.assertTrue(np.all(ta_b2.dtime[1] == 1e-17))
+        ta.set_dtime(0.0, 0.0)
+
+        # Error modes.
+        with self.assertRaises(ValueError) as cm:
+            ensemble_propagate_until_batch(
+                ta, 10.0, 20, gen, algorithm="process", reuse_integrators=True
+            )
+        self.assertTrue(
+            "The 'reuse_integrators' argument can be used only with the 'thread' parallelisation algorithm"
+            in str(cm.exception)
+        )
+
+        ta_ev = taylor_adaptive(
+            sys=sys,
+            state=[0.0] * 2,
+            pars=[9.8],
+            nt_events=[nt_event(v, lambda ta, t, d_sgn: None)],
+        )
+        with self.assertRaises(ValueError) as cm:
+            ensemble_propagate_until(ta_ev, 10.0, 20, gen, reuse_integrators=True)
+        self.assertTrue(
+            "The 'reuse_integrators' argument cannot be used with integrators whose events have callbacks"
+            in str(cm.exception)
+        )
+
+        ta_ev = taylor_adaptive(
+            sys=sys,
+            state=[0.0] * 2,
+            pars=[9.8],
+            t_events=[t_event(v, callback=lambda ta, mr, d_sgn: True)],
+        )
+        with self.assertRaises(ValueError) as cm:
+            ensemble_propagate_until(ta_ev, 10.0, 20, gen, reuse_integrators=True)
+        self.assertTrue(
+            "The 'reuse_integrators' argument cannot be used with integrators whose events have callbacks"
+            in str(cm.exception)
+        )
+
+        # Terminal events without callbacks are fine.
+        ta_ev = taylor_adaptive(
+            sys=sys, state=[0.0] * 2, pars=[9.8], t_events=[t_event(v - 100.0)]
+        )
+        ret = ensemble_propagate_until(ta_ev, 10.0, 4, gen, reuse_integrators=True)
+        self.assertEqual(len(ret), 4)
+
+    def test_sink(self):
+        from . import (
+            ensemble_propagate_grid,
+            ensemble_propagate_until,
+            make_vars,
+            sin,
+            taylor_adaptive,
+        )
+        import numpy as np
+        import os
+        import tempfile
+
+        x, v = make_vars("x", "v")
+
+        # Use a pendulum for testing purposes.
+        sys = [(x, v), (v, -9.8 * sin(x))]
+
+        ta = taylor_adaptive(sys=sys, state=[0.0] * 2)
+
+        ics = np.zeros((10, 2))
+        for i in range(10):
+            ics[i] = [0.05 + i / 100, 0.025 + i / 100]
+
+        def gen(ta, idx):
+            ta.time = 0.0
+            ta.state[:] = ics[idx]
+
+            return ta
+
+        grid = np.linspace(0, 10, 100)
+
+        for algo in ["thread", "process"]:
+            with tempfile.TemporaryDirectory() as tmpdir:
+                sink = os.path.join(tmpdir, "res")
+
+                ret = ensemble_propagate_grid(
+                    ta, grid, 10, gen, algorithm=algo, max_workers=8, sink=sink
+                )
+
+                self.assertEqual(len(ret), 10)
+
+                for i in range(10):
+                    ta.time = 0.0
+                    ta.state[:] = ics[i]
+                    loc_ret = ta.propagate_grid(grid)
+
+                    # The results were replaced by the file names.
+                    self.assertEqual(
+                        ret[i][-1], os.path.join(sink, "member_{:08d}.npy".format(i))
+                    )
+                    self.assertTrue(np.all(np.load(ret[i][-1]) == loc_ret[-1]))
+                    self.assertTrue(
+                        np.all(
+                            np.load(
+                                os.path.join(sink, "member_{:08d}_times.npy".format(i))
+                            )
+                            == grid
+                        )
+                    )
+                    self.assertEqual(ret[i][1], loc_ret[0])
+
+        # Error modes.
+        with self.assertRaises(ValueError) as cm:
+            ensemble_propagate_until(ta, 10.0, 10, gen, sink="foo")
+        self.assertTrue(
+            "The 'sink' argument can be used only in ensemble propagate_grid()"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            ensemble_propagate_grid(ta, grid, 10, gen, sink="foo", sink_format="bar")
+        self.assertTrue(
+            "The sink format must be one of ['npy', 'arrow'], but 'bar' was provided instead"
+            in str(cm.exception)
+        )
+
+    def test_grid_chunked(self):
+        from . import (
+            propagate_grid_chunked,
+            make_vars,
+            sin,
+            taylor_adaptive,
+            taylor_adaptive_batch,
+            taylor_outcome,
+        )
+        import numpy as np
+        import os
+        import tempfile
+
+        x, v = make_vars("x", "v")
+
+        # Use a pendulum for testing purposes.
+        sys = [(x, v), (v, -9.8 * sin(x))]
+
+        grid = np.linspace(0, 10, 105)
+
+        fmts = ["npy"]
+        try:
+            import pyarrow
+
+            fmts.append("arrow")
+        except ImportError:
+            pass
+
+        for fmt in fmts:
+            with tempfile.TemporaryDirectory() as tmpdir:
+                ta = taylor_adaptive(sys=sys, state=[0.05, 0.025])
+                ref = ta.propagate_grid(grid)[-1]
+
+                ta = taylor_adaptive(sys=sys, state=[0.05, 0.025])
+                ret = propagate_grid_chunked(
+                    ta, grid, tmpdir, chunk_size=10, sink_format=fmt
+                )
+
+                self.assertEqual(ret[0], taylor_outcome.time_limit)
+                self.assertEqual(len(ret[-1]), 11)
+                self.assertEqual(ta.time, grid[-1])
+
+                if fmt == "npy":
+                    res = np.concatenate([np.load(_) for _ in ret[-1]])
+                    times = np.concatenate(
+                        [np.load(_[:-4] + "_times.npy") for _ in ret[-1]]
+                    )
+                else:
+                    import pyarrow as pa
+
+                    tabs = [pa.ipc.open_file(_).read_all() for _ in ret[-1]]
+                    res = np.concatenate(
+                        [
+                            np.stack([t["c0"].to_numpy(), t["c1"].to_numpy()], axis=1)
+                            for t in tabs
+                        ]
+                    )
+                    times = np.concatenate([t["time"].to_numpy() for t in tabs])
+
+                self.assertTrue(np.all(times == grid))
+                self.assertTrue(np.allclose(res, ref, rtol=1e-14, atol=1e-14))
+
+        # Batch mode.
+        b_grid = np.repeat(grid, 2).reshape((-1, 2))
+
+        with tempfile.TemporaryDirectory() as tmpdir:
+            ta = taylor_adaptive_batch(sys=sys, state=[[0.05, 0.06], [0.025, 0.026]])
+            ref = ta.propagate_grid(b_grid)
+
+            ta = taylor_adaptive_batch(sys=sys, state=[[0.05, 0.06], [0.025, 0.026]])
+            ret = propagate_grid_chunked(ta, b_grid, tmpdir, chunk_size=50)
+
+            self.assertEqual(len(ret), 3)
+
+            res = np.concatenate([np.load(_) for _ in ret])
+            self.assertEqual(res.shape, ref.shape)
+            self.assertTrue(np.allclose(res, ref, rtol=1e-14, atol=1e-14))
+
+        # Error modes.
+        with self.assertRaises(ValueError) as cm:
+            propagate_grid_chunked(ta, b_grid, "foo", chunk_size=0)
+        self.assertTrue(
+            "The chunk size must be a positive integer, but 0 was provided instead"
+            in str(cm.exception)
+        )
+
+    def test_batch(self):
         from . import (
             ensemble_propagate_until_batch,
             ensemble_propagate_for_batch,
@@ -4457,90 +5268,458 @@ class cfunc_test_case(_ut.TestCase):
     def runTest(self):
         self.test_single()
         self.test_multi()
+        self.test_fptr()
+        self.test_reduce()
+        self.test_subset()
+        self.test_csr()
+        self.test_copy()
 
-    def test_multi(self):
+    def test_copy(self):
         import numpy as np
-        from . import make_cfunc, make_vars, sin, par, expression, core
-        from .core import _ppc_arch
+        from copy import copy, deepcopy
+        from . import make_cfunc, make_vars, sin, par
 
-        if _ppc_arch:
-            fp_types = [float]
-        else:
-            fp_types = [float, np.longdouble]
+        x, y = make_vars("x", "y")
+        func = [sin(x + y), x - par[0], x * y]
 
-        if hasattr(core, "real128"):
-            fp_types.append(core.real128)
+        fn = make_cfunc(func, batch_size=2)
+        fn.foo = [1, 2, 3]
 
-        x, y = make_vars("x", "y")
-        func = [sin(x + y), x - par[0], x + y + par[1]]
+        inputs = np.array([[1.0, 2.0, 3.0], [4.0, 5.0, 6.0]])
+        pars = np.array([-3.0])
+        res = fn(inputs, pars=pars)
 
-        for fp_t in fp_types:
-            with self.assertRaises(ValueError) as cm:
-                make_cfunc(func, vars=[y, x], fp_type=fp_t, batch_size=0)
+        for fn_copy in [copy(fn), deepcopy(fn)]:
+            self.assertEqual(fn_copy.nvars, fn.nvars)
+            self.assertEqual(fn_copy.nouts, fn.nouts)
+            self.assertEqual(fn_copy.nparams, fn.nparams)
+            self.assertEqual(fn_copy.batch_size, fn.batch_size)
+            self.assertEqual(fn_copy.foo, fn.foo)
+
+            # The function pointers must refer to the copied code.
+            self.assertNotEqual(fn_copy.fptr_scal, fn.fptr_scal)
+            self.assertNotEqual(fn_copy.fptr_batch, fn.fptr_batch)
+
+            self.assertTrue(np.array_equal(fn_copy(inputs, pars=pars), res))
             self.assertTrue(
-                "The batch size of a compiled function cannot be zero"
-                in str(cm.exception)
+                np.array_equal(fn_copy(inputs, pars=pars, out_idx=[2]), res[[2]])
             )
 
-            if fp_t == np.longdouble:
-                with self.assertRaises(ValueError) as cm:
-                    make_cfunc(func, vars=[y, x], fp_type=fp_t, batch_size=2)
-                self.assertTrue(
-                    "Batch sizes greater than 1 are not supported for this floating-point type"
-                    in str(cm.exception)
-                )
+            # The copy must remain usable after the
+            # destruction of the original object.
+            del fn
+            self.assertTrue(np.array_equal(fn_copy(inputs, pars=pars), res))
+            fn = make_cfunc(func, batch_size=2)
+            fn.foo = [1, 2, 3]
 
-            fn = make_cfunc(func, vars=[y, x], fp_type=fp_t)
+        # Check that deepcopy copies the attributes.
+        fn_copy = deepcopy(fn)
+        self.assertNotEqual(id(fn_copy.foo), id(fn.foo))
 
-            with self.assertRaises(ValueError) as cm:
-                fn(
-                    np.zeros((2, 5), dtype=fp_t),
-                    pars=[fp_t(0)],
-                    outputs=np.zeros((3, 1), dtype=fp_t),
-                )
-            self.assertTrue(
-                "The size in the second dimension for the output array provided for the evaluation of a compiled function (1) must match the size in the second dimension for the array of inputs (5)"
-                in str(cm.exception)
-            )
+    def test_subset(self):
+        import numpy as np
+        from . import make_cfunc, make_vars, sin, cos, par
 
-            with self.assertRaises(ValueError) as cm:
-                fn(np.zeros((2, 5), dtype=fp_t), pars=np.zeros((2, 4), dtype=fp_t))
-            self.assertTrue(
-                "The size in the second dimension for the array of parameter values provided for the evaluation of a compiled function (4) must match the size in the second dimension for the array of inputs (5)"
-                in str(cm.exception)
+        x, y, z = make_vars("x", "y", "z")
+        func = [sin(x + y), x - par[0], cos(z) + par[1], x * y * z]
+
+        fn = make_cfunc(func)
+
+        rng = np.random.default_rng(42)
+
+        for nevals in [None, 1, 3, 17]:
+            shape = (3,) if nevals is None else (3, nevals)
+            inputs = rng.uniform(-1, 1, size=shape)
+            pars = rng.uniform(-1, 1, size=(2,) + shape[1:])
+
+            full = fn(inputs, pars=pars)
+
+            for idx in [[0], [3, 1], [2, 2], [0, 1, 2, 3]]:
+                # NOTE: the subsets do not depend on all the
+                # variables/parameters, but they are evaluated
+                # on the same inputs as the original function.
+                sub = fn(inputs, pars=pars, out_idx=idx)
+                self.assertEqual(sub.shape, (len(idx),) + shape[1:])
+                self.assertTrue(np.allclose(sub, full[idx], rtol=0, atol=1e-15))
+
+                # Repeated evaluations hit the cache.
+                sub2 = fn(inputs, pars=pars, out_idx=idx)
+                self.assertTrue(np.all(sub == sub2))
+
+                # Provided outputs.
+                out = np.zeros_like(sub)
+                fn(inputs, pars=pars, out_idx=idx, outputs=out)
+                self.assertTrue(np.all(out == sub))
+
+        # Reductions.
+        inputs = rng.uniform(-1, 1, size=(3, 10))
+        pars = rng.uniform(-1, 1, size=(2, 10))
+        self.assertTrue(
+            np.allclose(
+                fn(inputs, pars=pars, reduce="sum", out_idx=[3, 0]),
+                np.sum(fn(inputs, pars=pars)[[3, 0]], axis=1),
+                rtol=1e-14,
+                atol=0,
             )
+        )
+
+        # Error modes.
+        with self.assertRaises(ValueError) as cm:
+            fn(inputs, pars=pars, out_idx=[])
+        self.assertTrue(
+            "The list of output indices for the evaluation of a compiled function cannot be empty"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            fn(inputs, pars=pars, out_idx=[1, 4])
+        self.assertTrue(
+            "The output index 4 is out of range for a compiled function with 4 output(s)"
+            in str(cm.exception)
+        )
+
+        # The number of parameters is checked against the original function.
+        with self.assertRaises(ValueError) as cm:
+            fn(inputs, pars=pars[:1], out_idx=[0])
+        self.assertTrue("but it must have a size of 2 instead" in str(cm.exception))
+
+    def test_csr(self):
+        import numpy as np
+        from . import make_cfunc, make_vars, sin, cos, expression
+
+        x, y = make_vars("x", "y")
+        zero = expression(0.0)
+
+        # A 3x3 matrix with an empty row.
+        func = [sin(x), zero, x * y, zero, zero, zero, zero, y, 2.0 * x]
+
+        fn = make_cfunc(func)
+        self.assertEqual(fn.nz_outputs, [0, 2, 7, 8])
+
+        rng = np.random.default_rng(42)
+
+        for nevals in [None, 1, 5]:
+            shape = (2,) if nevals is None else (2, nevals)
+            inputs = rng.uniform(-1, 1, size=shape)
+
+            full = fn(inputs)
+            data, indices, indptr = fn.eval_csr(inputs, (3, 3))
+
+            self.assertTrue(np.all(indices == [0, 2, 1, 2]))
+            self.assertTrue(np.all(indptr == [0, 2, 2, 4]))
+            self.assertEqual(data.shape, (4,) + shape[1:])
+
+            # Reconstruct the dense matrix.
+            dense = np.zeros((3, 3) + shape[1:])
+            for r in range(3):
+                for k in range(indptr[r], indptr[r + 1]):
+                    dense[r, indices[k]] = data[k]
 
-            nw_arr = np.zeros((3, 5), dtype=fp_t)
-            nw_arr.setflags(write=False)
-            with self.assertRaises(ValueError) as cm:
-                fn(
-                    np.zeros((2, 5), dtype=fp_t),
-                    outputs=nw_arr,
-                    pars=np.zeros((2, 5), dtype=fp_t),
-                )
             self.assertTrue(
-                "The array of outputs provided for the evaluation of a compiled function is not writeable"
-                in str(cm.exception)
+                np.allclose(dense.reshape((9,) + shape[1:]), full, rtol=0, atol=1e-15)
             )
 
-            for nevals in range(0, 10):
-                fn = make_cfunc(func, vars=[y, x], fp_type=fp_t)
+        # Identically zero function.
+        fn = make_cfunc([zero, zero])
+        data, indices, indptr = fn.eval_csr(np.zeros((0, 3)), (1, 2))
+        self.assertEqual(data.shape, (0, 3))
+        self.assertEqual(len(indices), 0)
+        self.assertTrue(np.all(indptr == [0, 0]))
 
-                # NOTE: deterministic seeding.
-                rng = np.random.default_rng(nevals)
+        # The inputs are validated also when all the outputs are zero.
+        with self.assertRaises(ValueError) as cm:
+            fn.eval_csr(np.zeros((1, 3)), (1, 2))
+        self.assertTrue("but it must have a size of 0 instead" in str(cm.exception))
 
-                # NOTE: long double rng not supported.
-                inputs = rng.random((2, nevals), dtype=float).astype(fp_t)
-                pars = rng.random((2, nevals), dtype=float).astype(fp_t)
+        fn = make_cfunc([zero, zero], vars=[x, y])
+        data, indices, indptr = fn.eval_csr(np.zeros((2,)), (2, 1))
+        self.assertEqual(data.shape, (0,))
+        self.assertTrue(np.all(indptr == [0, 0, 0]))
 
-                eval_arr = fn(inputs=inputs, pars=pars)
-                self.assertTrue(
-                    _allclose(
-                        eval_arr[0],
-                        np.sin(inputs[1, :] + inputs[0, :]),
-                        rtol=_get_eps(fp_t) * 10,
-                        atol=_get_eps(fp_t) * 10,
-                    )
+        with self.assertRaises(ValueError) as cm:
+            fn.eval_csr(np.zeros((3,)), (2, 1))
+        self.assertTrue("but it must have a size of 2 instead" in str(cm.exception))
+
+        # Only the outputs which are literally zero are detected.
+        fn = make_cfunc([sin(x) ** 2 + cos(x) ** 2 - 1.0, zero], vars=[x, y])
+        self.assertEqual(fn.nz_outputs, [0])
+
+        # Error modes.
+        with self.assertRaises(ValueError) as cm:
+            fn.eval_csr(np.zeros((0,)), (2, 2))
+        self.assertTrue(
+            "The shape (2, 2) passed to eval_csr() is incompatible with the number of outputs of the compiled function (2)"
+            in str(cm.exception)
+        )
+
+    def test_reduce(self):
+        import numpy as np
+        from . import make_cfunc, make_vars, sin, par
+        from .core import _ppc_arch
+
+        # NOTE: the reference values are computed via NumPy's
+        # reductions, hence test only with the NumPy floating-point types.
+        if _ppc_arch:
+            fp_types = [float]
+        else:
+            fp_types = [float, np.longdouble]
+
+        x, y = make_vars("x", "y")
+        func = [sin(x + y), x - par[0], x + y + par[1]]
+
+        rng = np.random.default_rng(42)
+
+        for fp_t in fp_types:
+            fn = make_cfunc(func, vars=[y, x], fp_type=fp_t)
+
+            tol = _get_eps(fp_t) * 100
+
+            # NOTE: test also numbers of evaluations which
+            # are not multiples of the batch size.
+            for nevals in [1, 2, 3, 10, 17]:
+                inputs = rng.uniform(-1, 1, size=(2, nevals)).astype(fp_t)
+                pars = rng.uniform(-1, 1, size=(2, nevals)).astype(fp_t)
+                weights = rng.uniform(0, 1, size=(nevals,)).astype(fp_t)
+
+                full = fn(inputs, pars=pars)
+
+                for op, ref in [
+                    ("sum", np.sum(full, axis=1)),
+                    ("max", np.max(full, axis=1)),
+                    ("min", np.min(full, axis=1)),
+                    ("mean", np.mean(full, axis=1)),
+                ]:
+                    ret = fn(inputs, pars=pars, reduce=op)
+                    self.assertEqual(ret.shape, (3,))
+                    self.assertEqual(ret.dtype, full.dtype)
+                    self.assertTrue(_allclose(ret, ref, rtol=tol, atol=tol))
+
+                # Weighted reductions.
+                ret = fn(inputs, pars=pars, reduce="sum", weights=weights)
+                self.assertTrue(
+                    _allclose(ret, np.sum(full * weights, axis=1), rtol=tol, atol=tol)
+                )
+
+                ret = fn(inputs, pars=pars, reduce="mean", weights=weights)
+                self.assertTrue(
+                    _allclose(
+                        ret,
+                        np.average(full, axis=1, weights=weights),
+                        rtol=tol,
+                        atol=tol,
+                    )
+                )
+
+            # NaN propagation in max/min.
+            inputs = np.array([[0.0, np.nan, 1.0], [0.0, 0.0, 0.0]], dtype=fp_t)
+            pars = np.zeros((2, 3), dtype=fp_t)
+            for op in ["max", "min"]:
+                ret = fn(inputs, pars=pars, reduce=op)
+                self.assertTrue(np.isnan(ret[0]))
+                self.assertFalse(np.isnan(ret[1]))
+                self.assertTrue(np.isnan(ret[2]))
+
+        # Error modes.
+        fn = make_cfunc(func, vars=[y, x])
+        inputs = np.zeros((2, 5))
+        pars = np.zeros((2, 5))
+
+        with self.assertRaises(ValueError) as cm:
+            fn(inputs, pars=pars, reduce="prod")
+        self.assertTrue(
+            "Invalid reduction 'prod' requested for the evaluation of a compiled function"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            fn(inputs[:, 0], pars=pars[:, 0], reduce="sum")
+        self.assertTrue(
+            "A reduction can be requested for the evaluation of a compiled function only if the array of inputs has 2 dimensions"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            fn(inputs, pars=pars, reduce="sum", outputs=np.zeros((3, 5)))
+        self.assertTrue(
+            "An array of outputs cannot be provided for the evaluation of a compiled function if a reduction is requested"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            fn(np.zeros((2, 0)), pars=np.zeros((2, 0)), reduce="sum")
+        self.assertTrue(
+            "Cannot compute a reduction over zero evaluations of a compiled function"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            fn(inputs, pars=pars, reduce="max", weights=np.ones(5))
+        self.assertTrue(
+            "Weights can be used only with the 'sum' and 'mean' reductions"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            fn(inputs, pars=pars, weights=np.ones(5))
+        self.assertTrue(
+            "Weights can be provided for the evaluation of a compiled function only if a reduction is requested"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            fn(inputs, pars=pars, reduce="sum", weights=np.ones(4))
+        self.assertTrue(
+            "The array of weights provided for the evaluation of a compiled function must be one-dimensional with a size of 5"
+            in str(cm.exception)
+        )
+
+    def test_fptr(self):
+        import ctypes
+        import numpy as np
+        from . import make_cfunc, make_vars, sin, par
+
+        x, y = make_vars("x", "y")
+        func = [sin(x + y), x - par[0], x + y + par[1]]
+
+        fn = make_cfunc(func, vars=[y, x], batch_size=2)
+
+        self.assertEqual(fn.nvars, 2)
+        self.assertEqual(fn.nouts, 3)
+        self.assertEqual(fn.nparams, 2)
+        self.assertEqual(fn.batch_size, 2)
+
+        sig = fn.signature
+        self.assertEqual(sig["dtype"], np.dtype(float))
+        self.assertEqual(sig["c_type"], "double")
+        self.assertEqual(sig["restype"], "void")
+        self.assertEqual(
+            sig["argtypes"], ("double *", "const double *", "const double *")
+        )
+        self.assertEqual(
+            sig["argtypes_s"],
+            ("double *", "const double *", "const double *", "size_t"),
+        )
+        self.assertEqual(sig["argnames_s"], ("out", "in", "pars", "stride"))
+        self.assertEqual(sig["batch_size"], 2)
+
+        for addr in [fn.fptr_scal, fn.fptr_scal_s, fn.fptr_batch, fn.fptr_batch_s]:
+            self.assertIsInstance(addr, int)
+            self.assertNotEqual(addr, 0)
+
+        dptr = ctypes.POINTER(ctypes.c_double)
+        proto = ctypes.CFUNCTYPE(None, dptr, dptr, dptr)
+        proto_s = ctypes.CFUNCTYPE(None, dptr, dptr, dptr, ctypes.c_size_t)
+
+        # Scalar evaluation via the raw function pointer.
+        inputs = np.array([1.0, 2.0])
+        pars = np.array([-3.0, 4.0])
+        out = np.zeros(3)
+        proto(fn.fptr_scal)(
+            out.ctypes.data_as(dptr),
+            inputs.ctypes.data_as(dptr),
+            pars.ctypes.data_as(dptr),
+        )
+        self.assertTrue(np.allclose(out, fn(inputs, pars=pars), rtol=0.0, atol=1e-15))
+
+        # Batch evaluation via the strided function pointer.
+        inputs = np.array([[1.0, 1.1, 1.2], [2.0, 2.1, 2.2]])
+        pars = np.array([[-3.0, -3.1, -3.2], [4.0, 4.1, 4.2]])
+        out = np.zeros((3, 3))
+        proto_s(fn.fptr_batch_s)(
+            out.ctypes.data_as(dptr),
+            inputs.ctypes.data_as(dptr),
+            pars.ctypes.data_as(dptr),
+            3,
+        )
+        self.assertTrue(
+            np.allclose(
+                out[:, :2], fn(inputs[:, :2], pars=pars[:, :2]), rtol=0.0, atol=1e-15
+            )
+        )
+
+    def test_multi(self):
+        import numpy as np
+        from . import make_cfunc, make_vars, sin, par, expression, core
+        from .core import _ppc_arch
+
+        if _ppc_arch:
+            fp_types = [float]
+        else:
+            fp_types = [float, np.longdouble]
+
+        if hasattr(core, "real128"):
+            fp_types.append(core.real128)
+
+        x, y = make_vars("x", "y")
+        func = [sin(x + y), x - par[0], x + y + par[1]]
+
+        for fp_t in fp_types:
+            with self.assertRaises(ValueError) as cm:
+                make_cfunc(func, vars=[y, x], fp_type=fp_t, batch_size=0)
+            self.assertTrue(
+                "The batch size of a compiled function cannot be zero"
+                in str(cm.exception)
+            )
+
+            if fp_t == np.longdouble:
+                with self.assertRaises(ValueError) as cm:
+                    make_cfunc(func, vars=[y, x], fp_type=fp_t, batch_size=2)
+                self.assertTrue(
+                    "Batch sizes greater than 1 are not supported for this floating-point type"
+                    in str(cm.exception)
+                )
+
+            fn = make_cfunc(func, vars=[y, x], fp_type=fp_t)
+
+            with self.assertRaises(ValueError) as cm:
+                fn(
+                    np.zeros((2, 5), dtype=fp_t),
+                    pars=[fp_t(0)],
+                    outputs=np.zeros((3, 1), dtype=fp_t),
+                )
+            self.assertTrue(
+                "The size in the second dimension for the output array provided for the evaluation of a compiled function (1) must match the size in the second dimension for the array of inputs (5)"
+                in str(cm.exception)
+            )
+
+            with self.assertRaises(ValueError) as cm:
+                fn(np.zeros((2, 5), dtype=fp_t), pars=np.zeros((2, 4), dtype=fp_t))
+            self.assertTrue(
+                "The size in the second dimension for the array of parameter values provided for the evaluation of a compiled function (4) must match the size in the second dimension for the array of inputs (5)"
+                in str(cm.exception)
+            )
+
+            nw_arr = np.zeros((3, 5), dtype=fp_t)
+            nw_arr.setflags(write=False)
+            with self.assertRaises(ValueError) as cm:
+                fn(
+                    np.zeros((2, 5), dtype=fp_t),
+                    outputs=nw_arr,
+                    pars=np.zeros((2, 5), dtype=fp_t),
+                )
+            self.assertTrue(
+                "The array of outputs provided for the evaluation of a compiled function is not writeable"
+                in str(cm.exception)
+            )
+
+            for nevals in range(0, 10):
+                fn = make_cfunc(func, vars=[y, x], fp_type=fp_t)
+
+                # NOTE: deterministic seeding.
+                rng = np.random.default_rng(nevals)
+
+                # NOTE: long double rng not supported.
+                inputs = rng.random((2, nevals), dtype=float).astype(fp_t)
+                pars = rng.random((2, nevals), dtype=float).astype(fp_t)
+
+                eval_arr = fn(inputs=inputs, pars=pars)
+                self.assertTrue(
+                    _allclose(
+                        eval_arr[0],
+                        np.sin(inputs[1, :] + inputs[0, :]),
+                        rtol=_get_eps(fp_t) * 10,
+                        atol=_get_eps(fp_t) * 10,
+                    )
                 )
                 self.assertTrue(
                     _allclose(
@@ -5060,8 +6239,1274 @@ class cfunc_test_case(_ut.TestCase):
             self.assertEqual(eval_arr[0], 3)
 
 
-def run_test_suite():
-    from . import make_nbody_sys, taylor_adaptive, _test_real, _test_real128, _test_mp
+class vsop2013_ephemeris_test_case(_ut.TestCase):
+    def runTest(self):
+        from . import (
+            vsop2013_ephemeris,
+            vsop2013_cartesian,
+            vsop2013_cartesian_icrf,
+            make_cfunc,
+            make_vars,
+        )
+        import numpy as np
+        import pickle
+        from copy import copy, deepcopy
+
+        t = make_vars("t")
+
+        tm = np.linspace(-0.1, 0.1, 23)
+
+        for frame, vsop_f in [
+            ("ecliptic", vsop2013_cartesian),
+            ("icrf", vsop2013_cartesian_icrf),
+        ]:
+            eph = vsop2013_ephemeris([1, 3], thresh=1e-5, frame=frame)
+
+            self.assertEqual(eph.pl_idxs, [1, 3])
+            self.assertEqual(eph.thresh, 1e-5)
+            self.assertEqual(eph.frame, frame)
+
+            res = eph(tm)
+            self.assertEqual(res.shape, (2, 6, 23))
+
+            # Compare with a compiled function.
+            for i, pl_idx in enumerate([1, 3]):
+                cf = make_cfunc(vsop_f(pl_idx, time=t, thresh=1e-5), vars=[t])
+                self.assertTrue(
+                    np.allclose(res[i], cf(inputs=[tm]), rtol=1e-14, atol=1e-14)
+                )
+
+            # Non-contiguous input and lists.
+            self.assertTrue(np.all(eph(np.repeat(tm, 2)[::2]) == res))
+            self.assertTrue(np.all(eph(list(tm)) == res))
+
+            # Empty input.
+            self.assertEqual(eph([]).shape, (2, 6, 0))
+
+            # Copy and pickling.
+            for eph2 in [copy(eph), deepcopy(eph), pickle.loads(pickle.dumps(eph))]:
+                self.assertEqual(eph2.pl_idxs, [1, 3])
+                self.assertEqual(eph2.frame, frame)
+                self.assertTrue(np.all(eph2(tm) == res))
+
+        # Error modes.
+        with self.assertRaises(ValueError) as cm:
+            vsop2013_ephemeris([])
+        self.assertTrue(
+            "The list of planet indices passed to the constructor of a VSOP2013 ephemeris "
+            "object cannot be empty" in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            vsop2013_ephemeris([1], frame="foo")
+        self.assertTrue("Invalid frame 'foo'" in str(cm.exception))
+
+        with self.assertRaises(ValueError) as cm:
+            vsop2013_ephemeris([1], thresh=float("nan"))
+        self.assertTrue("Invalid threshold value" in str(cm.exception))
+
+        with self.assertRaises(ValueError) as cm:
+            vsop2013_ephemeris([1], thresh=1e-5)([[1.0]])
+        self.assertTrue(
+            "the number of dimensions must be 1, but it is 2 instead"
+            in str(cm.exception)
+        )
+
+
+class expression_builders_test_case(_ut.TestCase):
+    def runTest(self):
+        self.test_dot()
+        self.test_horner()
+        self.test_chebyshev_series()
+        self.test_sph_harm_potential()
+
+    def test_dot(self):
+        from . import make_vars, make_cfunc, dot, sin, cos
+        import numpy as np
+
+        x, y = make_vars("x", "y")
+        exprs = [x, y, sin(x), cos(y)]
+        coeffs = np.array([1.5, 0.0, -2.0, 0.25])
+
+        inputs = np.random.default_rng(42).uniform(size=(2, 10))
+        ref = 1.5 * inputs[0] - 2.0 * np.sin(inputs[0]) + 0.25 * np.cos(inputs[1])
+
+        cf = make_cfunc([dot(coeffs, exprs)], vars=[x, y])
+        self.assertTrue(np.allclose(cf(inputs)[0], ref, rtol=1e-14, atol=1e-14))
+
+        # Coefficients as parameters.
+        cf = make_cfunc([dot(coeffs, exprs, par_offset=1)], vars=[x, y])
+        pars = np.zeros((5, 10))
+        pars[1:] = coeffs[:, None]
+        self.assertTrue(
+            np.allclose(cf(inputs, pars=pars)[0], ref, rtol=1e-14, atol=1e-14)
+        )
+
+        # Lists are accepted too.
+        self.assertEqual(dot([1.0, 2.0], [x, y]), dot(np.array([1.0, 2.0]), [x, y]))
+
+        with self.assertRaises(ValueError) as cm:
+            dot(coeffs, [x, y])
+        self.assertTrue(
+            "The number of coefficients passed to dot() (4) must be equal to the number of expressions (2)"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            dot(np.zeros((2, 2)), [x, y])
+        self.assertTrue(
+            "The array of coefficients passed to dot() must have 1 dimension(s)"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            dot([1.0, float("nan")], [x, y])
+        self.assertTrue("contains the non-finite value" in str(cm.exception))
+
+        with self.assertRaises(ValueError) as cm:
+            dot(coeffs, exprs, par_offset=2**32 - 2)
+        self.assertTrue("the parameter indices would overflow" in str(cm.exception))
+
+    def test_horner(self):
+        from . import make_vars, make_cfunc, horner
+        import numpy as np
+
+        (x,) = make_vars("x")
+        coeffs = np.array([1.0, -2.0, 0.0, 0.5, 3.0])
+        inputs = np.linspace(-2, 2, 11).reshape((1, -1))
+        ref = np.polynomial.polynomial.polyval(inputs[0], coeffs)
+
+        cf = make_cfunc([horner(coeffs, x)], vars=[x])
+        self.assertTrue(np.allclose(cf(inputs)[0], ref, rtol=1e-14, atol=1e-14))
+
+        cf = make_cfunc([horner(coeffs, x, par_offset=0)], vars=[x])
+        pars = np.repeat(coeffs, 11).reshape((5, 11))
+        self.assertTrue(
+            np.allclose(cf(inputs, pars=pars)[0], ref, rtol=1e-14, atol=1e-14)
+        )
+
+        # Empty polynomial.
+        cf = make_cfunc([horner([], x)], vars=[x])
+        self.assertTrue(np.all(cf(inputs)[0] == 0))
+
+    def test_chebyshev_series(self):
+        from . import make_vars, make_cfunc, chebyshev_series
+        import numpy as np
+        from numpy.polynomial import chebyshev as C
+
+        (x,) = make_vars("x")
+
+        for n in [0, 1, 2, 3, 10]:
+            coeffs = np.random.default_rng(n).uniform(-1, 1, size=(n,))
+            inputs = np.linspace(-1, 1, 11).reshape((1, -1))
+            ref = C.chebval(inputs[0], coeffs)
+
+            cf = make_cfunc([chebyshev_series(coeffs, x)], vars=[x])
+            self.assertTrue(np.allclose(cf(inputs)[0], ref, rtol=1e-13, atol=1e-13))
+
+            cf = make_cfunc([chebyshev_series(coeffs, x, par_offset=0)], vars=[x])
+            pars = np.repeat(coeffs, 11).reshape((n, 11))
+            self.assertTrue(
+                np.allclose(cf(inputs, pars=pars)[0], ref, rtol=1e-13, atol=1e-13)
+            )
+
+            # Custom domain.
+            inputs = np.linspace(2, 5, 11).reshape((1, -1))
+            ref = C.Chebyshev(coeffs, domain=[2, 5])(inputs[0])
+
+            cf = make_cfunc([chebyshev_series(coeffs, x, domain=(2, 5))], vars=[x])
+            self.assertTrue(np.allclose(cf(inputs)[0], ref, rtol=1e-13, atol=1e-13))
+
+        with self.assertRaises(ValueError) as cm:
+            chebyshev_series([1.0], x, domain=(1, 1))
+        self.assertTrue(
+            "Invalid domain [1, 1] passed to chebyshev_series()" in str(cm.exception)
+        )
+
+    def test_sph_harm_potential(self):
+        from . import make_vars, make_cfunc, sph_harm_potential
+        import numpy as np
+
+        x, y, z = make_vars("x", "y", "z")
+
+        mu, R = 3.986e5, 6378.0
+        J2, C22, S22 = 1.08e-3, 1.57e-6, -0.9e-6
+
+        C = np.zeros((4, 4))
+        S = np.zeros((4, 4))
+        C[0, 0] = 1.0
+        C[2, 0] = -J2 / np.sqrt(5)
+        C[2, 2] = C22
+        S[2, 2] = S22
+
+        inputs = np.random.default_rng(42).uniform(-1e4, 1e4, size=(3, 20))
+        inputs[0] += 2e4
+        xs, ys, zs = inputs
+        r = np.sqrt(xs**2 + ys**2 + zs**2)
+
+        # Closed-form reference.
+        N22 = np.sqrt(5.0 / 12)
+        ref = (
+            mu / r
+            - mu * J2 * R**2 / r**3 * (3 * zs**2 / r**2 - 1) / 2
+            + 3
+            * N22
+            * mu
+            * R**2
+            / r**5
+            * (C22 * (xs**2 - ys**2) + S22 * 2 * xs * ys)
+        )
+
+        U = sph_harm_potential([x, y, z], mu, R, C, S)
+        cf = make_cfunc([U], vars=[x, y, z])
+        self.assertTrue(np.allclose(cf(inputs)[0], ref, rtol=1e-13, atol=0))
+
+        # Coefficients as parameters.
+        U = sph_harm_potential([x, y, z], mu, R, C, S, par_offset=0)
+        cf = make_cfunc([U], vars=[x, y, z])
+        tril = np.tril_indices(4)
+        pars = np.concatenate([C[tril], S[tril]])
+        pars = np.repeat(pars, 20).reshape((-1, 20))
+        self.assertTrue(np.allclose(cf(inputs, pars=pars)[0], ref, rtol=1e-13, atol=0))
+
+        # Degree 0 only.
+        U = sph_harm_potential([x, y, z], mu, R, [[1.0]], [[0.0]])
+        cf = make_cfunc([U], vars=[x, y, z])
+        self.assertTrue(np.allclose(cf(inputs)[0], mu / r, rtol=1e-14, atol=0))
+
+        with self.assertRaises(ValueError) as cm:
+            sph_harm_potential([x, y], mu, R, C, S)
+        self.assertTrue(
+            "The position vector passed to sph_harm_potential() must have 3 components"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            sph_harm_potential([x, y, z], mu, R, C, S[:3, :3])
+        self.assertTrue(
+            "must both have a shape (nmax + 1, nmax + 1)" in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            sph_harm_potential([x, y, z], mu, -1.0, C, S)
+        self.assertTrue("Invalid gravitational parameter" in str(cm.exception))
+
+
+class variational_test_case(_ut.TestCase):
+    def runTest(self):
+        from . import (
+            make_vars,
+            make_variational_sys,
+            variational_ic,
+            stm_view,
+            sens_view,
+            taylor_adaptive,
+            taylor_adaptive_batch,
+            par,
+        )
+        import numpy as np
+
+        x, v = make_vars("x", "v")
+
+        # Harmonic oscillator with angular frequency sqrt(par[0]).
+        sys = [(x, v), (v, -par[0] * x)]
+
+        vsys = make_variational_sys(sys, pars=[0])
+        self.assertEqual(len(vsys), 2 + 4 + 2)
+        self.assertEqual(vsys[:2], sys)
+
+        ic = variational_ic([1.0, 0.0], npars=1)
+        self.assertTrue(np.all(ic == [1, 0, 1, 0, 0, 1, 0, 0]))
+
+        ta = taylor_adaptive(vsys, ic, pars=[1.0])
+        ta.propagate_until(2.0)
+
+        # Analytical STM and sensitivities
+        # (with respect to par[0] at par[0] == 1).
+        t = 2.0
+        stm = stm_view(ta, 2)
+        self.assertTrue(np.shares_memory(stm, ta.state))
+        self.assertTrue(
+            np.allclose(
+                stm,
+                [[np.cos(t), np.sin(t)], [-np.sin(t), np.cos(t)]],
+                rtol=0,
+                atol=1e-13,
+            )
+        )
+
+        sens = sens_view(ta, 2, 1)
+        self.assertEqual(sens.shape, (2, 1))
+        self.assertTrue(
+            np.allclose(
+                sens[:, 0],
+                [-t * np.sin(t) / 2, -(np.sin(t) + t * np.cos(t)) / 2],
+                rtol=0,
+                atol=1e-13,
+            )
+        )
+
+        # Only the STM.
+        vsys = make_variational_sys(sys)
+        self.assertEqual(len(vsys), 6)
+
+        # Only the sensitivities.
+        vsys = make_variational_sys(sys, stm=False, pars=[0])
+        self.assertEqual(len(vsys), 4)
+        ta = taylor_adaptive(
+            vsys, variational_ic([1.0, 0.0], stm=False, npars=1), pars=[1.0]
+        )
+        ta.propagate_until(t)
+        self.assertTrue(
+            np.allclose(
+                sens_view(ta, 2, 1, stm=False)[:, 0],
+                [-t * np.sin(t) / 2, -(np.sin(t) + t * np.cos(t)) / 2],
+                rtol=0,
+                atol=1e-13,
+            )
+        )
+
+        # Batch mode.
+        vsys = make_variational_sys(sys, pars=[0])
+        ic = variational_ic([[1.0] * 4, [0.0] * 4], npars=1)
+        self.assertEqual(ic.shape, (8, 4))
+        ta = taylor_adaptive_batch(vsys, ic, pars=[[1.0] * 4])
+        ta.propagate_until([t] * 4)
+        stm = stm_view(ta, 2)
+        self.assertEqual(stm.shape, (2, 2, 4))
+        for i in range(4):
+            self.assertTrue(
+                np.allclose(
+                    stm[:, :, i],
+                    [[np.cos(t), np.sin(t)], [-np.sin(t), np.cos(t)]],
+                    rtol=0,
+                    atol=1e-13,
+                )
+            )
+
+        # Error modes.
+        with self.assertRaises(ValueError) as cm:
+            make_variational_sys(sys, stm=False)
+        self.assertTrue(
+            "The variational equations must be constructed with respect to the initial conditions and/or to at least one parameter"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            make_variational_sys([(x + v, v)])
+        self.assertTrue("must all be variables" in str(cm.exception))
+
+        (phi,) = make_vars("phi_0_0")
+        with self.assertRaises(ValueError) as cm:
+            make_variational_sys([(x, phi), (phi, -x)])
+        self.assertTrue(
+            "the name 'phi_0_0' of a variational variable is already used by a state variable"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            stm_view(taylor_adaptive(sys, [1.0, 0.0]), 2)
+        self.assertTrue("is too short to contain" in str(cm.exception))
+
+
+class fit_lm_test_case(_ut.TestCase):
+    def runTest(self):
+        from . import make_vars, par, fit_lm, taylor_adaptive_batch
+        import numpy as np
+
+        x, v = make_vars("x", "v")
+
+        # Harmonic oscillator with angular frequency sqrt(par[0]).
+        sys = [(x, v), (v, -par[0] * x)]
+
+        bs = 4
+        true_k = np.array([[1.0, 1.5, 2.0, 0.8]])
+        true_state = np.array([[1.0, 0.5, -0.3, 2.0], [0.5, 0.0, 1.0, -0.2]])
+
+        grid = np.repeat(np.linspace(0.0, 5.0, 20), bs).reshape((-1, bs))
+
+        # Generate the observations of x.
+        ta = taylor_adaptive_batch(sys, true_state, pars=true_k)
+        obs = ta.propagate_grid(grid)[:, [0], :]
+
+        # Fit both the initial state and the parameter.
+        st, ps, cost, niter, conv = fit_lm(
+            sys,
+            true_state + 0.05,
+            grid,
+            obs,
+            pars=true_k * 1.1,
+            fit_pars=[0],
+            obs_idx=[0],
+        )
+
+        self.assertTrue(np.all(conv))
+        self.assertTrue(np.all(niter > 0))
+        self.assertTrue(np.allclose(st, true_state, rtol=0, atol=1e-8))
+        self.assertTrue(np.allclose(ps, true_k, rtol=0, atol=1e-8))
+        self.assertTrue(np.all(cost < 1e-16))
+
+        # Fit only the parameter, with weights.
+        st, ps, cost, niter, conv = fit_lm(
+            sys,
+            true_state,
+            grid,
+            obs,
+            pars=true_k * 0.9,
+            fit_state=False,
+            fit_pars=[0],
+            obs_idx=[0],
+            weights=2.0,
+        )
+
+        self.assertTrue(np.all(conv))
+        self.assertTrue(np.all(st == true_state))
+        self.assertTrue(np.allclose(ps, true_k, rtol=0, atol=1e-8))
+
+        # Error modes.
+        with self.assertRaises(ValueError) as cm:
+            fit_lm(sys, true_state, grid, obs[:, :, :2], pars=true_k, obs_idx=[0])
+        self.assertTrue(
+            "The observations must be an array of shape" in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            fit_lm(
+                sys,
+                true_state,
+                grid[:1],
+                obs[:1],
+                pars=true_k,
+                fit_pars=[0],
+                obs_idx=[0],
+            )
+        self.assertTrue(
+            "The number of fitted quantities (3) cannot be larger than the number of observations (1)"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            fit_lm(sys, true_state, grid, obs, pars=true_k, obs_idx=[0], weights=-1.0)
+        self.assertTrue(
+            "The weights must be finite and non-negative" in str(cm.exception)
+        )
+
+
+class dlpack_test_case(_ut.TestCase):
+    def runTest(self):
+        import numpy as np
+
+        # NOTE: DLPack support in NumPy
+        # requires NumPy >= 1.22.
+        if not hasattr(np, "from_dlpack"):
+            return
+
+        self.test_export()
+        self.test_import()
+
+    def test_export(self):
+        from . import taylor_adaptive, taylor_adaptive_batch, make_vars, sin, par
+        import numpy as np
+
+        x, v = make_vars("x", "v")
+        sys = [(x, v), (v, -par[0] * sin(x))]
+
+        ta = taylor_adaptive(sys, [0.05, 0.025], pars=[9.8])
+
+        # The exported tensors share the memory of the integrator.
+        st = np.from_dlpack(ta.state)
+        pars = np.from_dlpack(ta.pars)
+        self.assertTrue(np.shares_memory(st, ta.state))
+        self.assertTrue(np.shares_memory(pars, ta.pars))
+
+        st[0] = 0.1
+        self.assertEqual(ta.state[0], 0.1)
+
+        # The exported tensors keep the integrator alive.
+        del ta
+        self.assertEqual(st[0], 0.1)
+        self.assertEqual(pars[0], 9.8)
+
+        ta = taylor_adaptive_batch(
+            sys, [[0.05, 0.06], [0.025, 0.026]], pars=[[9.8, 9.9]]
+        )
+
+        st = np.from_dlpack(ta.state)
+        self.assertEqual(st.shape, (2, 2))
+        self.assertTrue(np.shares_memory(st, ta.state))
+
+    def test_import(self):
+        from . import taylor_adaptive, taylor_adaptive_batch, make_vars, make_cfunc
+        from . import sin, par
+        import numpy as np
+
+        # Minimal non-NumPy producer of DLPack tensors.
+        class dlp:
+            def __init__(self, arr):
+                self.arr = arr
+
+            def __dlpack__(self, **kwargs):
+                return self.arr.__dlpack__(**kwargs)
+
+            def __dlpack_device__(self):
+                return self.arr.__dlpack_device__()
+
+        x, v = make_vars("x", "v")
+        sys = [(x, v), (v, -par[0] * sin(x))]
+
+        ta = taylor_adaptive(
+            sys, dlp(np.array([0.05, 0.025])), pars=dlp(np.array([9.8]))
+        )
+        self.assertTrue(np.all(ta.state == [0.05, 0.025]))
+        self.assertTrue(np.all(ta.pars == [9.8]))
+
+        ta = taylor_adaptive_batch(
+            sys,
+            dlp(np.array([[0.05, 0.06], [0.025, 0.026]])),
+            pars=dlp(np.array([[9.8, 9.9]])),
+            time=dlp(np.array([1.0, 2.0])),
+        )
+        self.assertTrue(np.all(ta.state == [[0.05, 0.06], [0.025, 0.026]]))
+        self.assertTrue(np.all(ta.pars == [[9.8, 9.9]]))
+        self.assertTrue(np.all(ta.time == [1.0, 2.0]))
+
+        fn = make_cfunc([x + v + par[0]], vars=[x, v])
+        inputs = np.array([[1.0, 2.0, 3.0], [4.0, 5.0, 6.0]])
+        pars = np.array([[0.1, 0.2, 0.3]])
+        outputs = np.zeros((1, 3))
+        ret = fn(dlp(inputs), pars=dlp(pars), outputs=dlp(outputs))
+        self.assertTrue(
+            np.allclose(ret, inputs[0] + inputs[1] + pars[0], rtol=0.0, atol=1e-15)
+        )
+        # The outputs were written into the memory of the producer.
+        self.assertTrue(np.shares_memory(ret, outputs))
+        self.assertTrue(np.allclose(outputs, ret, rtol=0.0, atol=0.0))
+
+        # A producer which cannot be converted (e.g., because
+        # the tensor lives on a non-CPU device) is rejected by the
+        # vector caster, resulting in an argument type error.
+        class bad_dlp(dlp):
+            def __dlpack__(self, **kwargs):
+                raise BufferError("Cannot export")
+
+        with self.assertRaises(TypeError):
+            taylor_adaptive(sys, bad_dlp(np.array([0.05, 0.025])), pars=[9.8])
+
+
+class conjunctions_test_case(_ut.TestCase):
+    def runTest(self):
+        from . import make_vars, taylor_adaptive, screen_conjunctions
+        import numpy as np
+
+        x, y, z, vx, vy, vz = make_vars("x", "y", "z", "vx", "vy", "vz")
+
+        # Circular motion in the xy plane, with the z
+        # coordinate either constant or oscillating around 0.2.
+        sys_a = [(x, vx), (y, vy), (z, vz), (vx, -x), (vy, -y), (vz, 0.0 * z)]
+        sys_b = [(x, vx), (y, vy), (z, vz), (vx, -x), (vy, -y), (vz, 0.2 - z)]
+
+        def make_c_out(sys, state, tf=20.0):
+            ta = taylor_adaptive(sys, state)
+            return ta.propagate_until(tf, c_output=True)[4]
+
+        # The distance between the first two objects is 0.2 + 0.1*cos(t),
+        # with minima at odd multiples of pi. The third object is always far.
+        c_outs = [
+            make_c_out(sys_a, [1.0, 0.0, 0.0, 0.0, 1.0, 0.0]),
+            make_c_out(sys_b, [1.0, 0.0, 0.3, 0.0, 1.0, 0.0]),
+            make_c_out(sys_a, [5.0, 0.0, 0.0, 0.0, 5.0, 0.0]),
+        ]
+
+        for window in [None, 0.5, 3.0, 100.0]:
+            res = screen_conjunctions(c_outs, 0.15, window=window)
+            self.assertEqual(len(res), 3)
+
+            for k, (i, j, tca, dca) in enumerate(res):
+                self.assertEqual((i, j), (0, 1))
+                self.assertAlmostEqual(tca, (2 * k + 1) * np.pi, delta=1e-8)
+                self.assertAlmostEqual(dca, 0.1, delta=1e-12)
+
+        self.assertEqual(screen_conjunctions(c_outs, 0.05), [])
+
+        # Swap the order of the objects.
+        res = screen_conjunctions(c_outs[::-1], 0.15)
+        self.assertEqual([(_[0], _[1]) for _ in res], [(1, 2)] * 3)
+
+        # Custom position indices.
+        res = screen_conjunctions(c_outs, 0.15, pos_idx=[1, 0, 2])
+        self.assertEqual(len(res), 3)
+
+        # Error checking.
+        with self.assertRaises(ValueError) as cm:
+            screen_conjunctions(c_outs[:1], 0.15)
+        self.assertTrue(
+            "At least 2 continuous_output objects are needed to screen conjunctions"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            screen_conjunctions(c_outs, -1.0)
+        self.assertTrue(
+            "The conjunction threshold must be finite and positive" in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            screen_conjunctions(c_outs, 0.15, window=0.0)
+        self.assertTrue(
+            "The window size must be finite and positive" in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            screen_conjunctions(c_outs, 0.15, pos_idx=[0, 1, 6])
+        self.assertTrue("Invalid position index 6" in str(cm.exception))
+
+        with self.assertRaises(ValueError) as cm:
+            screen_conjunctions(
+                c_outs + [make_c_out(sys_a, [1.0, 0.0, 0.0, 0.0, 1.0, 0.0], -1.0)],
+                0.15,
+            )
+        self.assertTrue(
+            "supports only continuous_output objects produced by forward integrations"
+            in str(cm.exception)
+        )
+
+
+class parareal_test_case(_ut.TestCase):
+    def runTest(self):
+        import numpy as np
+        from copy import deepcopy
+        from . import parareal, make_vars, sin, taylor_adaptive
+
+        x, v = make_vars("x", "v")
+        sys = [(x, v), (v, -9.8 * sin(x))]
+        ic = [0.05, 0.025]
+
+        ta = taylor_adaptive(sys, ic)
+        ref_ta = deepcopy(ta)
+        ref_ta.propagate_until(20.0)
+
+        for nsegs in [1, 4, 7]:
+            fine = deepcopy(ta)
+            coarse = taylor_adaptive(sys, ic, tol=1e-4)
+
+            states, niter, converged, speedup = parareal(
+                fine, coarse, 20.0, nsegs=nsegs
+            )
+
+            self.assertTrue(converged)
+            self.assertTrue(1 <= niter <= nsegs)
+            self.assertTrue(speedup > 0)
+            self.assertEqual(states.shape, (nsegs + 1, 2))
+            self.assertTrue(np.all(states[0] == ic))
+            self.assertTrue(np.all(states[-1] == fine.state))
+            self.assertEqual(fine.time, 20.0)
+            self.assertTrue(np.allclose(fine.state, ref_ta.state, rtol=0, atol=1e-12))
+
+        # With the maximum number of iterations, the solution
+        # coincides with the sequential fine solution.
+        fine = deepcopy(ta)
+        states, niter, converged, _ = parareal(
+            fine,
+            taylor_adaptive(sys, ic, tol=1e-4),
+            20.0,
+            nsegs=4,
+            max_iter=4,
+            tol=1e-300,
+        )
+        self.assertTrue(converged)
+        self.assertEqual(niter, 4)
+        self.assertTrue(np.allclose(fine.state, ref_ta.state, rtol=0, atol=1e-13))
+
+        # Backward propagation.
+        fine = deepcopy(ref_ta)
+        parareal(fine, taylor_adaptive(sys, ic, tol=1e-4), 0.0, nsegs=3)
+        self.assertTrue(np.allclose(fine.state, ic, rtol=0, atol=1e-12))
+
+        # Fine integrator with event callbacks (which are copied
+        # into the per-segment integrators).
+        from . import nt_event, t_event
+
+        counter = [0]
+
+        def nt_cb(ta, t, d_sgn):
+            counter[0] += 1
+
+        fine = taylor_adaptive(
+            sys,
+            ic,
+            nt_events=[nt_event(v, nt_cb)],
+            t_events=[t_event(x - 10.0, callback=lambda ta, mr, d_sgn: True)],
+        )
+        _, _, converged, _ = parareal(
+            fine, taylor_adaptive(sys, ic, tol=1e-4), 20.0, nsegs=4
+        )
+        self.assertTrue(converged)
+        self.assertTrue(counter[0] > 0)
+        self.assertTrue(np.allclose(fine.state, ref_ta.state, rtol=0, atol=1e-12))
+
+        # Error modes.
+        with self.assertRaises(ValueError) as cm:
+            parareal(deepcopy(ta), taylor_adaptive(sys, ic), float("inf"))
+        self.assertTrue(
+            "The final time passed to parareal() must be finite, but it is inf instead"
+            in str(cm.exception)
+        )
+
+        y = make_vars("y")
+        with self.assertRaises(ValueError) as cm:
+            parareal(
+                deepcopy(ta),
+                taylor_adaptive(sys + [(y, x)], ic + [0.0]),
+                1.0,
+            )
+        self.assertTrue(
+            "The coarse integrator passed to parareal() has a dimension of 3, but it must have the same dimension as the fine integrator (2)"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            parareal(deepcopy(ta), taylor_adaptive(sys, ic), 1.0, max_iter=0)
+        self.assertTrue(
+            "The maximum number of iterations in parareal() must be positive"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            parareal(deepcopy(ta), taylor_adaptive(sys, ic), 1.0, tol=-1.0)
+        self.assertTrue(
+            "The tolerance in parareal() must be positive and finite, but it is -1 instead"
+            in str(cm.exception)
+        )
+
+
+class taylor_adaptive_tiered_test_case(_ut.TestCase):
+    def runTest(self):
+        import numpy as np
+        from copy import copy, deepcopy
+        from . import (
+            taylor_adaptive_tiered,
+            taylor_adaptive,
+            make_vars,
+            sin,
+            par,
+            t_event,
+        )
+
+        x, v = make_vars("x", "v")
+        sys = [(x, v), (v, -par[0] * sin(x))]
+        ic = [0.05, 0.025]
+
+        tt = taylor_adaptive_tiered(sys, ic, pars=[9.8], loose_tol=1e-4)
+        self.assertEqual(tt.tier, "loose")
+        self.assertEqual(tt.loose.tol, 1e-4)
+        self.assertEqual(tt.accurate.tol, np.finfo(float).eps)
+        self.assertTrue(tt.loose.order < tt.accurate.order)
+        self.assertEqual(tt.active.tol, 1e-4)
+
+        # Screening with the loose tier.
+        tt.propagate_until(5.0)
+        self.assertEqual(tt.time, 5.0)
+        self.assertEqual(tt.accurate.time, 0.0)
+
+        # Switch to the accurate tier: the state is transferred.
+        tt.tier = "accurate"
+        self.assertEqual(tt.tier, "accurate")
+        self.assertEqual(tt.accurate.time, 5.0)
+        self.assertTrue(np.all(tt.accurate.state == tt.loose.state))
+        self.assertTrue(np.all(tt.state == tt.loose.state))
+
+        # Parameter changes follow the active tier.
+        tt.pars[0] = 9.81
+        tt.propagate_until(10.0)
+        tt.tier = "loose"
+        self.assertEqual(tt.loose.pars[0], 9.81)
+        self.assertEqual(tt.time, 10.0)
+
+        # Switch via the tier keyword argument.
+        tt.propagate_for(1.0, tier="accurate")
+        self.assertEqual(tt.tier, "accurate")
+        self.assertEqual(tt.time, 11.0)
+
+        oc, h = tt.step()
+        self.assertEqual(tt.time, 11.0 + h)
+
+        _, _, _, _, res = tt.propagate_grid([tt.time, tt.time + 1.0], tier="loose")
+        self.assertEqual(tt.tier, "loose")
+        self.assertEqual(res.shape, (2, 2))
+
+        # A full propagation in the accurate tier matches
+        # a standalone integrator.
+        tt = taylor_adaptive_tiered(sys, ic, pars=[9.8], tier="accurate")
+        ta = taylor_adaptive(sys, ic, pars=[9.8])
+        tt.propagate_until(10.0)
+        ta.propagate_until(10.0)
+        self.assertTrue(np.all(tt.state == ta.state))
+
+        # Copy semantics.
+        tt2 = copy(tt)
+        tt2.propagate_until(20.0)
+        self.assertEqual(tt.time, 10.0)
+        tt3 = deepcopy(tt2)
+        self.assertEqual(tt3.tier, "accurate")
+        self.assertEqual(tt3.time, 20.0)
+
+        # Pickling.
+        import pickle
+
+        tt3.foo = [1, 2, 3]
+        tt4 = pickle.loads(pickle.dumps(tt3))
+        self.assertEqual(tt4.tier, "accurate")
+        self.assertEqual(tt4.time, 20.0)
+        self.assertEqual(tt4.loose.tol, tt3.loose.tol)
+        self.assertEqual(tt4.foo, [1, 2, 3])
+        self.assertTrue(np.all(tt4.state == tt3.state))
+        self.assertTrue(np.all(tt4.loose.state == tt3.loose.state))
+        tt3.propagate_until(30.0, tier="loose")
+        tt4.propagate_until(30.0, tier="loose")
+        self.assertTrue(np.all(tt4.state == tt3.state))
+
+        # Events are available in both tiers.
+        tt = taylor_adaptive_tiered(
+            sys, ic, pars=[9.8], t_events=[t_event(v)], loose_tol=1e-8
+        )
+        self.assertEqual(len(tt.loose.t_events), 1)
+        self.assertEqual(len(tt.accurate.t_events), 1)
+        oc = tt.propagate_until(10.0)[0]
+        self.assertTrue(int(oc) == -1)
+        tt.tier = "accurate"
+        oc = tt.propagate_until(10.0)[0]
+        self.assertTrue(int(oc) == -1)
+
+        # Long double.
+        ld_t = np.longdouble
+        tt = taylor_adaptive_tiered(
+            sys, [ld_t(0.05), ld_t(0.025)], pars=[ld_t(9.8)], fp_type=ld_t
+        )
+        self.assertEqual(tt.time.dtype, ld_t)
+        tt.propagate_until(ld_t(1.0), tier="accurate")
+        self.assertEqual(tt.state.dtype, ld_t)
+
+        # Error modes.
+        with self.assertRaises(ValueError) as cm:
+            taylor_adaptive_tiered(sys, ic, loose_tol=-1.0)
+        self.assertTrue(
+            "The loose tolerance of a tiered integrator must be positive and finite, but it is -1 instead"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            taylor_adaptive_tiered(sys, ic, loose_tol=1e-10, tol=1e-8)
+        self.assertTrue(
+            "The loose tolerance of a tiered integrator (1e-10) cannot be smaller than the accurate tolerance (1e-08)"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            tt.tier = "medium"
+        self.assertTrue(
+            "Invalid tier 'medium' for a tiered integrator: the tier must be either 'loose' or 'accurate'"
+            in str(cm.exception)
+        )
+
+
+class propagate_adaptive_grid_test_case(_ut.TestCase):
+    def runTest(self):
+        import numpy as np
+        from copy import deepcopy
+        from . import (
+            taylor_adaptive,
+            make_vars,
+            sqrt,
+            t_event,
+            event_direction,
+            taylor_outcome,
+        )
+
+        # Eccentric Kepler orbit, starting from the apoapsis.
+        x, y, vx, vy = make_vars("x", "y", "vx", "vy")
+        r3 = sqrt(x**2 + y**2) ** 3
+        sys = [(x, vx), (y, vy), (vx, -x / r3), (vy, -y / r3)]
+        ic = [1.9, 0.0, 0.0, np.sqrt(0.1 / 1.9)]
+        rv = x * vx + y * vy
+
+        ta = taylor_adaptive(sys, ic)
+        tf = 4 * np.pi
+
+        # No refinement: base grid only.
+        ta0 = deepcopy(ta)
+        oc, _, _, nsteps, times, vals, evs = ta0.propagate_adaptive_grid(tf, 0.5)
+        self.assertEqual(oc, taylor_outcome.time_limit)
+        self.assertTrue(nsteps > 0)
+        self.assertTrue(
+            np.allclose(times[:-1], np.arange(0, tf, 0.5), rtol=0, atol=1e-14)
+        )
+        self.assertEqual(times[-1], tf)
+        self.assertEqual(vals.shape, (len(times), 4))
+        self.assertEqual(len(evs), 0)
+        self.assertTrue(np.allclose(vals[-1], ta0.state, rtol=0, atol=1e-13))
+
+        # Refinement around the zero crossings of the radial velocity.
+        ta1 = deepcopy(ta)
+        oc, _, _, _, times, vals, evs = ta1.propagate_adaptive_grid(
+            tf, 0.5, events=[rv]
+        )
+        self.assertEqual(oc, taylor_outcome.time_limit)
+        self.assertTrue(np.all(np.diff(times) > 0))
+        self.assertEqual(times[0], 0.0)
+        self.assertEqual(times[-1], tf)
+        for ev in [np.pi, 2 * np.pi, 3 * np.pi]:
+            self.assertTrue(np.min(np.abs(evs - ev)) < 1e-8)
+            self.assertTrue(np.min(np.abs(times - ev)) < 1e-8)
+        self.assertTrue(
+            np.count_nonzero(np.abs(times - np.pi) <= 0.5)
+            > 2 * np.count_nonzero(np.abs(times - np.pi / 2) <= 0.5)
+        )
+
+        # The outputs match a propagation on the same grid.
+        ta2 = deepcopy(ta)
+        grid_res = ta2.propagate_grid(times)[4]
+        self.assertTrue(np.allclose(vals, grid_res, rtol=1e-10, atol=1e-10))
+
+        # Refinement where the output changes rapidly.
+        ta3 = deepcopy(ta)
+        _, _, _, _, times3, vals3, evs3 = ta3.propagate_adaptive_grid(
+            tf, 0.5, outputs=[x], max_change=0.1
+        )
+        self.assertEqual(vals3.shape, (len(times3), 1))
+        self.assertEqual(len(evs3), 0)
+        self.assertTrue(len(times3) > 27)
+        self.assertTrue(
+            np.count_nonzero(np.abs(times3 - np.pi) <= 0.5)
+            > np.count_nonzero(np.abs(times3 - np.pi / 2) <= 0.5)
+        )
+
+        # Terminal event at the periapsis.
+        ta4 = taylor_adaptive(
+            sys, ic, t_events=[t_event(rv, direction=event_direction.positive)]
+        )
+        oc, _, _, _, times4, vals4, evs4 = ta4.propagate_adaptive_grid(tf, 0.5)
+        self.assertEqual(int(oc), -1)
+        self.assertEqual(len(evs4), 1)
+        self.assertEqual(evs4[0], ta4.time)
+        self.assertEqual(times4[-1], ta4.time)
+        self.assertTrue(abs(ta4.time - np.pi) < 1e-8)
+        self.assertTrue(np.allclose(vals4[-1], ta4.state, rtol=0, atol=1e-13))
+
+        # Backward propagation.
+        ta5 = deepcopy(ta)
+        _, _, _, _, times5, _, _ = ta5.propagate_adaptive_grid(-tf, 0.5)
+        self.assertTrue(np.all(np.diff(times5) < 0))
+        self.assertEqual(times5[-1], -tf)
+
+        # Long double.
+        ld_t = np.longdouble
+        ta6 = taylor_adaptive(sys, [ld_t(v) for v in ic], fp_type=ld_t)
+        _, _, _, _, times6, vals6, _ = ta6.propagate_adaptive_grid(
+            ld_t(1.0), ld_t(0.25)
+        )
+        self.assertEqual(times6.dtype, ld_t)
+        self.assertEqual(vals6.dtype, ld_t)
+        self.assertEqual(len(times6), 5)
+
+        # Error modes.
+        with self.assertRaises(ValueError) as cm:
+            deepcopy(ta).propagate_adaptive_grid(float("inf"), 0.5)
+        self.assertTrue(
+            "A non-finite final time of inf was passed to propagate_adaptive_grid()"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            deepcopy(ta).propagate_adaptive_grid(1.0, -0.5)
+        self.assertTrue(
+            "The base cadence in propagate_adaptive_grid() must be positive and finite, but it is -0.5 instead"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            deepcopy(ta).propagate_adaptive_grid(1.0, 0.5, refine=0)
+        self.assertTrue(
+            "The refinement factor in propagate_adaptive_grid() must be positive"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            deepcopy(ta).propagate_adaptive_grid(1.0, 0.5, window=-1.0)
+        self.assertTrue(
+            "The event window in propagate_adaptive_grid() must be non-negative and finite, but it is -1 instead"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            deepcopy(ta).propagate_adaptive_grid(1.0, 0.5, max_change=0.0)
+        self.assertTrue(
+            "The maximum output change in propagate_adaptive_grid() must be positive and finite, but it is 0 instead"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            deepcopy(ta).propagate_adaptive_grid(1.0, 0.5, events=[])
+        self.assertTrue(
+            "The list of output expressions cannot be empty" in str(cm.exception)
+        )
+
+
+class batch_layout_test_case(_ut.TestCase):
+    def runTest(self):
+        import numpy as np
+        from copy import deepcopy
+        from . import taylor_adaptive_batch, make_vars, sin
+
+        x, v = make_vars("x", "v")
+        sys = [(x, v), (v, -9.8 * sin(x))]
+
+        ta = taylor_adaptive_batch(
+            sys, [[0.05, 0.06, 0.07, 0.08], [0.025, 0.026, 0.027, 0.028]]
+        )
+
+        # State getter/setter.
+        st = ta.get_state()
+        self.assertTrue(np.shares_memory(st, ta.state))
+        st_lane = ta.get_state(layout="lane")
+        self.assertEqual(st_lane.shape, (4, 2))
+        self.assertTrue(st_lane.flags.c_contiguous)
+        self.assertTrue(np.all(st_lane == ta.state.T))
+
+        ta2 = deepcopy(ta)
+        ta2.set_state(st_lane[::-1], layout="lane")
+        self.assertTrue(np.all(ta2.state == ta.state[:, ::-1]))
+        ta2.set_state(ta.state)
+        self.assertTrue(np.all(ta2.state == ta.state))
+
+        # Grid propagation.
+        grid = np.repeat(np.linspace(0, 10, 20), 4).reshape(20, 4)
+        ta2 = deepcopy(ta)
+        res = ta2.propagate_grid(grid)
+        ta2 = deepcopy(ta)
+        res_lane = ta2.propagate_grid(grid, layout="lane")
+        self.assertEqual(res_lane.shape, (4, 20, 2))
+        self.assertTrue(res_lane.flags.c_contiguous)
+        self.assertTrue(np.all(res_lane == np.transpose(res, (2, 0, 1))))
+
+        ta2 = deepcopy(ta)
+        res_lane = ta2.propagate_grid(grid, components=[1], layout="lane")
+        self.assertEqual(res_lane.shape, (4, 20, 1))
+        self.assertTrue(np.all(res_lane[:, :, 0] == res[:, 1, :].T))
+
+        ta2 = deepcopy(ta)
+        res_lane = ta2.propagate_grid(grid, outputs=[x + v, x], layout="lane")
+        self.assertEqual(res_lane.shape, (4, 20, 2))
+        self.assertTrue(np.allclose(res_lane[:, :, 1], res[:, 0, :].T, rtol=0, atol=0))
+
+        # Continuous output.
+        ta2 = deepcopy(ta)
+        c_out = ta2.propagate_until(10.0, c_output=True)
+        tm = grid[1:]
+        out = c_out(tm)
+        out_lane = c_out(tm, layout="lane")
+        self.assertEqual(out_lane.shape, (4, 19, 2))
+        self.assertTrue(np.all(out_lane == np.transpose(out, (2, 0, 1))))
+
+        out_lane = c_out(tm, components=[0], layout="lane")
+        self.assertTrue(np.all(out_lane[:, :, 0] == out[:, 0, :].T))
+
+        out = c_out(tm[3])
+        out_lane = c_out(tm[3], layout="lane")
+        self.assertEqual(out_lane.shape, (4, 2))
+        self.assertTrue(np.all(out_lane == out.T))
+
+        # Error modes.
+        with self.assertRaises(ValueError) as cm:
+            ta.get_state(layout="row")
+        self.assertTrue(
+            "Invalid layout 'row' passed to get_state(): the layout must be either 'component' or 'lane'"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            deepcopy(ta).propagate_grid(grid, layout="row")
+        self.assertTrue(
+            "Invalid layout 'row' passed to propagate_grid()" in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            c_out(tm, layout="row")
+        self.assertTrue(
+            "Invalid layout 'row' passed to the call operator of a continuous_output_batch object"
+            in str(cm.exception)
+        )
+
+        with self.assertRaises(ValueError) as cm:
+            ta.set_state(ta.state, layout="lane")
+        self.assertTrue(
+            "Invalid state array passed to the set_state() method of a batch integrator: the expected array shape is (4, 2)"
+            in str(cm.exception)
+        )
+
+
+class concurrency_test_case(_ut.TestCase):
+    # NOTE: these tests exercise the library from multiple
+    # threads. They are meaningful mostly in free-threaded
+    # Python builds, but they must pass also with the GIL.
+    def runTest(self):
+        self.test_cfunc()
+        self.test_integrators()
+        self.test_shared_objects()
+        self.test_misc()
+
+    def _run_threads(self, func, nthreads=8):
+        import threading
+
+        barrier = threading.Barrier(nthreads)
+        errors = []
+
+        def wrapper(idx):
+            try:
+                barrier.wait()
+                func(idx)
+            except Exception as e:
+                errors.append(e)
+
+        threads = [threading.Thread(target=wrapper, args=(i,)) for i in range(nthreads)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+        if errors:
+            raise errors[0]
+
+    def test_cfunc(self):
+        from . import make_cfunc, make_vars, sin, cos, par
+        import numpy as np
+
+        x, y = make_vars("x", "y")
+
+        # NOTE: use non-contiguous inputs and several
+        # different batch sizes, so that the evaluations
+        # go through the scratch buffers.
+        cf = make_cfunc([sin(x) * cos(y) + par[0], x - y * par[1]])
+
+        def worker(idx):
+            rng = np.random.default_rng(idx)
+
+            for n in [1, 3, 17, 100]:
+                inputs = rng.uniform(size=(2, 2 * n))[:, ::2]
+                pars = rng.uniform(size=(2, 2 * n))[:, ::2]
+
+                for _ in range(20):
+                    res = cf(inputs, pars=pars)
+
+                    self.assertTrue(
+                        np.allclose(
+                            res[0],
+                            np.sin(inputs[0]) * np.cos(inputs[1]) + pars[0],
+                            rtol=1e-14,
+                            atol=1e-14,
+                        )
+                    )
+                    self.assertTrue(
+                        np.allclose(
+                            res[1],
+                            inputs[0] - inputs[1] * pars[1],
+                            rtol=1e-14,
+                            atol=1e-14,
+                        )
+                    )
+
+        self._run_threads(worker)
+
+    def test_integrators(self):
+        from . import make_vars, sin, taylor_adaptive
+        from copy import deepcopy
+        import numpy as np
+
+        x, v = make_vars("x", "v")
+
+        ta = taylor_adaptive([(x, v), (v, -9.8 * sin(x))], [0.0, 0.25])
+
+        ref = deepcopy(ta)
+        ref.propagate_until(10.0)
+
+        def worker(idx):
+            local_ta = deepcopy(ta)
+
+            for _ in range(5):
+                local_ta.time = 0.0
+                local_ta.state[:] = [0.0, 0.25]
+                local_ta.propagate_until(10.0)
+
+                self.assertTrue(np.all(local_ta.state == ref.state))
+
+        self._run_threads(worker)
+
+    def test_shared_objects(self):
+        from . import make_vars, sin, taylor_adaptive
+        from copy import deepcopy
+        import numpy as np
+
+        x, v = make_vars("x", "v")
+
+        ta = taylor_adaptive([(x, v), (v, -9.8 * sin(x))], [0.0, 0.25])
+        c_out = ta.propagate_until(10.0, c_output=True)[4]
+
+        times = np.linspace(0.0, 10.0, 1000)
+        ref = c_out(times)
+        ref_state = ta.state.copy()
+
+        # NOTE: the continuous output object and the integrator
+        # are shared by all threads. The evaluation of the continuous
+        # output over an array of times returns a new array, and
+        # copying the integrator does not alter it.
+        def worker(idx):
+            rng = np.random.default_rng(idx)
+
+            for _ in range(20):
+                sel = np.sort(rng.choice(times.shape[0], size=100, replace=False))
+                self.assertTrue(np.all(c_out(times[sel]) == ref[sel]))
+
+                local_ta = deepcopy(ta)
+                self.assertTrue(np.all(local_ta.state == ref_state))
+                self.assertEqual(local_ta.time, 10.0)
+
+        self._run_threads(worker)
+
+        self.assertTrue(np.all(ta.state == ref_state))
+        self.assertTrue(np.all(c_out(times) == ref))
+
+    def test_misc(self):
+        from . import make_vars, set_nthreads, get_nthreads, to_sympy
+
+        x, y = make_vars("x", "y")
+
+        orig_nthreads = get_nthreads()
+
+        def worker(idx):
+            set_nthreads(idx + 1)
+            get_nthreads()
+
+            try:
+                to_sympy(x + y)
+            except ImportError:
+                pass
+
+        try:
+            self._run_threads(worker)
+        finally:
+            set_nthreads(0)
+
+        self.assertEqual(get_nthreads(), orig_nthreads)
+
+
+def run_test_suite():
+    from . import (
+        make_nbody_sys,
+        taylor_adaptive,
+        _test_real,
+        _test_real128,
+        _test_mp,
+        _test_mpi,
+    )
     import numpy as np
 
     sys = make_nbody_sys(2, masses=[1.1, 2.1], Gconst=1)
@@ -5073,11 +7518,13 @@ def run_test_suite():
 
     suite = _ut.TestLoader().loadTestsFromTestCase(taylor_add_jet_test_case)
     suite.addTest(_test_mp.mp_test_case())
+    suite.addTest(_test_mpi.mpi_test_case())
     suite.addTest(_test_real.real_test_case())
     suite.addTest(_test_real128.real128_test_case())
     suite.addTest(cfunc_test_case())
     suite.addTest(ensemble_test_case())
     suite.addTest(s11n_backend_test_case())
+    suite.addTest(lazy_import_test_case())
     suite.addTest(recommended_simd_size_test_case())
     suite.addTest(c_output_test_case())
     suite.addTest(expression_test_case())
@@ -5090,6 +7537,17 @@ def run_test_suite():
     suite.addTest(kepE_test_case())
     suite.addTest(sympy_test_case())
     suite.addTest(zero_division_error_test_case())
+    suite.addTest(vsop2013_ephemeris_test_case())
+    suite.addTest(expression_builders_test_case())
+    suite.addTest(variational_test_case())
+    suite.addTest(fit_lm_test_case())
+    suite.addTest(dlpack_test_case())
+    suite.addTest(conjunctions_test_case())
+    suite.addTest(parareal_test_case())
+    suite.addTest(taylor_adaptive_tiered_test_case())
+    suite.addTest(propagate_adaptive_grid_test_case())
+    suite.addTest(batch_layout_test_case())
+    suite.addTest(concurrency_test_case())
 
     test_result = _ut.TextTestRunner(verbosity=2).run(suite)
 
@@ -0,0 +1,198 @@
+// Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+//
+// This file is part of the heyoka.py library.
+//
+// This Source Code Form is subject to the terms of the Mozilla
+// Public License v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <Python.h>
+
+#include <heyoka/expression.hpp>
+#include <heyoka/math.hpp>
+#include <heyoka/param.hpp>
+#include <heyoka/variable.hpp>
+
+#include "common_utils.hpp"
+#include "variational.hpp"
+
+namespace heyoka_py
+{
+
+namespace hey = heyoka;
+
+namespace detail
+{
+
+namespace
+{
+
+// Helper to detect expressions which are identically zero,
+// such as the derivatives of an expression with respect
+// to variables/parameters it does not depend on.
+bool is_zero_ex(const hey::expression &ex)
+{
+    return ex == hey::expression{0.};
+}
+
+// Helper to build the linear combination of the factors with the variables
+// of the same index, skipping the zero factors and returning zero
+// if all factors are zero.
+hey::expression lin_comb(const std::vector<const hey::expression *> &factors,
+                         const std::vector<hey::expression> &vars)
+{
+    std::vector<hey::expression> terms;
+
+    for (std::size_t k = 0; k < factors.size(); ++k) {
+        if (factors[k] != nullptr) {
+            terms.push_back(*factors[k] * vars[k]);
+        }
+    }
+
+    if (terms.empty()) {
+        return hey::expression{0.};
+    }
+
+    return hey::sum(std::move(terms));
+}
+
+} // namespace
+
+} // namespace detail
+
+// Augment the ODE system sys with the first-order variational equations.
+// If with_stm is true, the variational equations with respect to the initial
+// conditions are added: the n*n variables phi_i_j represent the elements
+// of the state transition matrix in row-major order, and they satisfy
+// d(phi)/dt = J * phi, where J is the Jacobian of the dynamics with respect to the state.
+// For each parameter index p_k in pars, the n variables sens_i_k represent
+// the sensitivities of the state with respect to par[p_k], and they
+// satisfy d(sens_k)/dt = J * sens_k + df/d(par[p_k]). The variables are
+// appended to the original state vector in the order above.
+// NOTE: each element of the Jacobian is computed once and shared among
+// all the variational equations, and the products with zero elements of the
+// Jacobian are pruned.
+std::vector<std::pair<hey::expression, hey::expression>>
+make_variational_sys(const std::vector<std::pair<hey::expression, hey::expression>> &sys, bool with_stm,
+                     const std::vector<std::uint32_t> &pars)
+{
+    if (sys.empty()) {
+        py_throw(PyExc_ValueError, "Cannot construct the variational equations of an empty ODE system");
+    }
+
+    if (!with_stm && pars.empty()) {
+        py_throw(PyExc_ValueError, "The variational equations must be constructed with respect to the initial "
+                                   "conditions and/or to at least one parameter");
+    }
+
+    const auto n = sys.size();
+
+    // Fetch the names of the state variables.
+    std::vector<std::string> names;
+    std::set<std::string> names_set;
+    for (const auto &[lhs, _] : sys) {
+        const auto *var_ptr = std::get_if<hey::variable>(&lhs.value());
+
+        if (var_ptr == nullptr) {
+            py_throw(PyExc_ValueError, "The left-hand sides of the ODE system passed to make_variational_sys() "
+                                       "must all be variables");
+        }
+
+        names.push_back(var_ptr->name());
+        names_set.insert(var_ptr->name());
+    }
+
+    if (names_set.size() != n) {
+        py_throw(PyExc_ValueError, "The ODE system passed to make_variational_sys() contains duplicate variables");
+    }
+
+    // Helper to create the new variables, checking
+    // for collisions with the state variables.
+    auto make_var = [&names_set](std::string name) {
+        if (names_set.count(name) != 0u) {
+            py_throw(PyExc_ValueError,
+                     fmt::format("Cannot construct the variational equations: the name '{}' of a variational "
+                                 "variable is already used by a state variable",
+                                 name)
+                         .c_str());
+        }
+
+        return hey::expression{hey::variable{std::move(name)}};
+    };
+
+    // Compute the Jacobian with respect to the state.
+    std::vector<hey::expression> jac;
+    jac.reserve(n * n);
+    for (std::size_t i = 0; i < n; ++i) {
+        for (std::size_t j = 0; j < n; ++j) {
+            jac.push_back(hey::diff(sys[i].second, names[j]));
+        }
+    }
+
+    // Rows of the Jacobian, as lists of pointers to the elements.
+    // NOTE: null pointers represent zero elements.
+    std::vector<std::vector<const hey::expression *>> jac_rows(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        for (std::size_t j = 0; j < n; ++j) {
+            const auto &el = jac[i * n + j];
+            jac_rows[i].push_back(detail::is_zero_ex(el) ? nullptr : &el);
+        }
+    }
+
+    auto retval = sys;
+
+    if (with_stm) {
+        // The columns of the state transition matrix.
+        std::vector<std::vector<hey::expression>> phi_cols(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            for (std::size_t j = 0; j < n; ++j) {
+                phi_cols[j].push_back(make_var(fmt::format("phi_{}_{}", i, j)));
+            }
+        }
+
+        for (std::size_t i = 0; i < n; ++i) {
+            for (std::size_t j = 0; j < n; ++j) {
+                retval.emplace_back(phi_cols[j][i], detail::lin_comb(jac_rows[i], phi_cols[j]));
+            }
+        }
+    }
+
+    if (!pars.empty()) {
+        const auto np = pars.size();
+
+        // The columns of the sensitivity matrix.
+        std::vector<std::vector<hey::expression>> sens_cols(np);
+        for (std::size_t i = 0; i < n; ++i) {
+            for (std::size_t k = 0; k < np; ++k) {
+                sens_cols[k].push_back(make_var(fmt::format("sens_{}_{}", i, k)));
+            }
+        }
+
+        for (std::size_t i = 0; i < n; ++i) {
+            for (std::size_t k = 0; k < np; ++k) {
+                auto rhs = detail::lin_comb(jac_rows[i], sens_cols[k]);
+
+                auto df_dp = hey::diff(sys[i].second, hey::par[pars[k]]);
+                if (!detail::is_zero_ex(df_dp)) {
+                    rhs = detail::is_zero_ex(rhs) ? std::move(df_dp) : std::move(rhs) + std::move(df_dp);
+                }
+
+                retval.emplace_back(sens_cols[k][i], std::move(rhs));
+            }
+        }
+    }
+
+    return retval;
+}
+
+} // namespace heyoka_py
@@ -0,0 +1,27 @@
+// Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+//
+// This file is part of the heyoka.py library.
+//
+// This Source Code Form is subject to the terms of the Mozilla
+// Public License v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef HEYOKA_PY_VARIATIONAL_HPP
+#define HEYOKA_PY_VARIATIONAL_HPP
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <heyoka/expression.hpp>
+
+namespace heyoka_py
+{
+
+std::vector<std::pair<heyoka::expression, heyoka::expression>>
+make_variational_sys(const std::vector<std::pair<heyoka::expression, heyoka::expression>> &, bool,
+                     const std::vector<std::uint32_t> &);
+
+} // namespace heyoka_py
+
+#endif
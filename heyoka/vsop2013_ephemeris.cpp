@@ -0,0 +1,384 @@
+// Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+//
+// This file is part of the heyoka.py library.
+//
+// This Source Code Form is subject to the terms of the Mozilla
+// Public License v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <boost/numeric/conversion/cast.hpp>
+
+#include <fmt/format.h>
+
+#include <oneapi/tbb/blocked_range.h>
+#include <oneapi/tbb/parallel_for.h>
+#include <oneapi/tbb/parallel_invoke.h>
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <Python.h>
+
+#include <heyoka/celmec/vsop2013.hpp>
+#include <heyoka/expression.hpp>
+#include <heyoka/llvm_state.hpp>
+#include <heyoka/s11n.hpp>
+#include <heyoka/variable.hpp>
+
+#include "common_utils.hpp"
+#include "custom_casters.hpp"
+#include "dtypes.hpp"
+#include "pickle_wrappers.hpp"
+#include "vsop2013_ephemeris.hpp"
+
+namespace heyoka_py
+{
+
+namespace py = pybind11;
+namespace hey = heyoka;
+
+namespace detail
+{
+
+namespace
+{
+
+// Cache of the truncated VSOP2013 cartesian series. The key
+// is the (planet index, threshold, ICRF flag) tuple, the value
+// the vector of the 6 cartesian state components of the planet
+// as functions of the variable returned by vsop2013_time_var().
+using vsop2013_cache_key_t = std::tuple<std::uint32_t, double, bool>;
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::mutex vsop2013_cache_mutex;
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::map<vsop2013_cache_key_t, std::vector<hey::expression>> vsop2013_cache;
+
+hey::expression vsop2013_time_var()
+{
+    return hey::expression{hey::variable{"t"}};
+}
+
+// Fetch the series for the planet pl_idx from the cache,
+// building and inserting them if necessary.
+std::vector<hey::expression> vsop2013_fetch_series(std::uint32_t pl_idx, double thresh, bool icrf)
+{
+    namespace kw = hey::kw;
+
+    const auto key = vsop2013_cache_key_t{pl_idx, thresh, icrf};
+
+    {
+        std::lock_guard lock(vsop2013_cache_mutex);
+
+        if (const auto it = vsop2013_cache.find(key); it != vsop2013_cache.end()) {
+            return it->second;
+        }
+    }
+
+    // NOTE: build the series without holding the lock,
+    // as this can take a while.
+    auto series = icrf ? hey::vsop2013_cartesian_icrf(pl_idx, kw::time = vsop2013_time_var(), kw::thresh = thresh)
+                       : hey::vsop2013_cartesian(pl_idx, kw::time = vsop2013_time_var(), kw::thresh = thresh);
+
+    std::lock_guard lock(vsop2013_cache_mutex);
+
+    // NOTE: if another thread inserted the same series
+    // in the meantime, emplace() will be a no-op.
+    return vsop2013_cache.emplace(key, std::move(series)).first->second;
+}
+
+// An ephemeris object evaluating the cartesian state vectors
+// of a set of planets according to the VSOP2013 theory.
+// The series for all the planets are compiled into a single
+// function with one input (the time) and 6 * npl outputs.
+class vsop2013_ephemeris
+{
+    using ptr_s_t = void (*)(double *, const double *, const double *, std::size_t) noexcept;
+
+    std::vector<std::uint32_t> m_pl_idxs;
+    double m_thresh = 0;
+    bool m_icrf = false;
+    std::uint32_t m_simd_size = 1;
+    hey::llvm_state m_s_scal, m_s_batch;
+    ptr_s_t m_fptr_scal = nullptr, m_fptr_batch = nullptr;
+
+    void lookup()
+    {
+        m_fptr_scal = reinterpret_cast<ptr_s_t>(m_s_scal.jit_lookup("eph.strided"));
+        m_fptr_batch = reinterpret_cast<ptr_s_t>(m_s_batch.jit_lookup("eph.strided"));
+    }
+
+    // Serialisation.
+    friend class boost::serialization::access;
+    template <typename Archive>
+    void save(Archive &ar, unsigned) const
+    {
+        ar << m_pl_idxs;
+        ar << m_thresh;
+        ar << m_icrf;
+        ar << m_simd_size;
+        ar << m_s_scal;
+        ar << m_s_batch;
+    }
+    template <typename Archive>
+    void load(Archive &ar, unsigned)
+    {
+        ar >> m_pl_idxs;
+        ar >> m_thresh;
+        ar >> m_icrf;
+        ar >> m_simd_size;
+        ar >> m_s_scal;
+        ar >> m_s_batch;
+
+        // NOTE: the llvm states are stored in compiled form,
+        // thus we just need to look up the function pointers.
+        if (!m_pl_idxs.empty()) {
+            lookup();
+        } else {
+            m_fptr_scal = nullptr;
+            m_fptr_batch = nullptr;
+        }
+    }
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+public:
+    vsop2013_ephemeris() = default;
+    explicit vsop2013_ephemeris(std::vector<std::uint32_t> pl_idxs, double thresh, bool icrf, bool compact_mode,
+                                unsigned opt_level, bool force_avx512, bool fast_math, std::uint32_t simd_size)
+        : m_pl_idxs(std::move(pl_idxs)), m_thresh(thresh), m_icrf(icrf), m_simd_size(simd_size),
+          m_s_scal{hey::kw::opt_level = opt_level, hey::kw::force_avx512 = force_avx512,
+                   hey::kw::fast_math = fast_math},
+          m_s_batch{hey::kw::opt_level = opt_level, hey::kw::force_avx512 = force_avx512,
+                    hey::kw::fast_math = fast_math}
+    {
+        namespace kw = hey::kw;
+
+        // Assemble the series for all planets.
+        std::vector<hey::expression> fn;
+        for (const auto pl_idx : m_pl_idxs) {
+            auto series = vsop2013_fetch_series(pl_idx, m_thresh, m_icrf);
+            fn.insert(fn.end(), series.begin(), series.end());
+        }
+
+        const std::vector vars = {vsop2013_time_var()};
+
+        oneapi::tbb::parallel_invoke(
+            [&]() {
+                hey::add_cfunc<double>(m_s_scal, "eph", fn, kw::vars = vars, kw::compact_mode = compact_mode);
+                m_s_scal.compile();
+            },
+            [&]() {
+                hey::add_cfunc<double>(m_s_batch, "eph", fn, kw::vars = vars, kw::batch_size = m_simd_size,
+                                       kw::compact_mode = compact_mode);
+                m_s_batch.compile();
+            });
+
+        lookup();
+    }
+    vsop2013_ephemeris(const vsop2013_ephemeris &other)
+        : m_pl_idxs(other.m_pl_idxs), m_thresh(other.m_thresh), m_icrf(other.m_icrf),
+          m_simd_size(other.m_simd_size), m_s_scal(other.m_s_scal), m_s_batch(other.m_s_batch)
+    {
+        // NOTE: the function pointers must be looked up
+        // again in the copied llvm states.
+        if (!m_pl_idxs.empty()) {
+            lookup();
+        }
+    }
+    vsop2013_ephemeris(vsop2013_ephemeris &&) noexcept = default;
+    vsop2013_ephemeris &operator=(const vsop2013_ephemeris &other)
+    {
+        if (this != &other) {
+            *this = vsop2013_ephemeris(other);
+        }
+
+        return *this;
+    }
+    vsop2013_ephemeris &operator=(vsop2013_ephemeris &&) noexcept = default;
+
+    const std::vector<std::uint32_t> &get_pl_idxs() const
+    {
+        return m_pl_idxs;
+    }
+    double get_thresh() const
+    {
+        return m_thresh;
+    }
+    bool get_icrf() const
+    {
+        return m_icrf;
+    }
+    std::uint32_t get_simd_size() const
+    {
+        return m_simd_size;
+    }
+
+    // Evaluate the ephemeris at the n times in tm, writing
+    // the result into out. out is a (6 * npl, n) row-major array.
+    // NOTE: this does not call into the Python interpreter,
+    // thus it can be invoked with the GIL released.
+    void eval(double *out, const double *tm, std::size_t n) const
+    {
+        const auto simd_size = static_cast<std::size_t>(m_simd_size);
+        const auto n_simd_blocks = n / simd_size;
+
+        // Evaluate over the simd blocks in parallel.
+        oneapi::tbb::parallel_for(oneapi::tbb::blocked_range<std::size_t>(0, n_simd_blocks),
+                                  [&](const auto &range) {
+                                      for (auto k = range.begin(); k != range.end(); ++k) {
+                                          const auto start_offset = k * simd_size;
+
+                                          m_fptr_batch(out + start_offset, tm + start_offset, nullptr, n);
+                                      }
+                                  });
+
+        // Handle the remainder, if present.
+        for (auto k = n_simd_blocks * simd_size; k < n; ++k) {
+            m_fptr_scal(out + k, tm + k, nullptr, n);
+        }
+    }
+};
+
+} // namespace
+
+} // namespace detail
+
+void expose_vsop2013_ephemeris(py::module_ &m)
+{
+    using namespace pybind11::literals;
+
+    using eph_t = detail::vsop2013_ephemeris;
+
+    py::class_<eph_t> cl(m, "vsop2013_ephemeris", py::dynamic_attr{});
+    cl.def(py::init([](std::vector<std::uint32_t> pl_idxs, double thresh, const std::string &frame,
+                       bool compact_mode, unsigned opt_level, bool force_avx512,
+                       std::optional<std::uint32_t> batch_size, bool fast_math) {
+               if (pl_idxs.empty()) {
+                   py_throw(PyExc_ValueError,
+                            "The list of planet indices passed to the constructor of a VSOP2013 ephemeris "
+                            "object cannot be empty");
+               }
+
+               // NOTE: the threshold is validated also by the vsop2013
+               // functions, but we need to ensure it is a valid key for the cache.
+               if (!std::isfinite(thresh) || thresh < 0) {
+                   py_throw(PyExc_ValueError,
+                            fmt::format("Invalid threshold value passed to the constructor of a VSOP2013 ephemeris "
+                                        "object: the value must be finite and non-negative, but it is {} instead",
+                                        thresh)
+                                .c_str());
+               }
+
+               if (frame != "ecliptic" && frame != "icrf") {
+                   py_throw(PyExc_ValueError,
+                            fmt::format("Invalid frame '{}' passed to the constructor of a VSOP2013 ephemeris "
+                                        "object: the frame must be either 'ecliptic' or 'icrf'",
+                                        frame)
+                                .c_str());
+               }
+
+               const auto simd_size = batch_size ? *batch_size : hey::recommended_simd_size<double>();
+               if (simd_size == 0u) {
+                   py_throw(PyExc_ValueError, "The batch size of a VSOP2013 ephemeris object cannot be zero");
+               }
+
+               // NOTE: release the GIL during the construction
+               // of the series and the compilation.
+               py::gil_scoped_release release;
+
+               return eph_t(std::move(pl_idxs), thresh, frame == "icrf", compact_mode, opt_level, force_avx512,
+                            fast_math, simd_size);
+           }),
+           "pl_idxs"_a, "thresh"_a.noconvert() = 1e-9, "frame"_a = "ecliptic", "compact_mode"_a = true,
+           "opt_level"_a.noconvert() = 3, "force_avx512"_a.noconvert() = false, "batch_size"_a = py::none{},
+           "fast_math"_a.noconvert() = false)
+        .def(
+            "__call__",
+            [](const eph_t &eph, const py::iterable &tm_ob) {
+                if (eph.get_pl_idxs().empty()) {
+                    py_throw(PyExc_ValueError, "Cannot use a default-constructed VSOP2013 ephemeris object");
+                }
+
+                // Convert the input iterable into an array of the correct type.
+                py::array tm = tm_ob;
+                const auto dt = get_dtype<double>();
+                if (tm.dtype().num() != dt) {
+                    tm = tm.attr("astype")(py::dtype(dt), "casting"_a = "safe");
+                }
+
+                if (tm.ndim() != 1) {
+                    py_throw(PyExc_ValueError,
+                             fmt::format("Invalid time array passed to a VSOP2013 ephemeris object: the "
+                                         "number of dimensions must be 1, but it is {} instead",
+                                         tm.ndim())
+                                 .c_str());
+                }
+
+                // Make sure we can read directly from tm.
+                if (!is_npy_array_carray(tm)) {
+                    tm = tm.attr("copy")();
+                }
+
+                const auto n = tm.shape(0);
+
+                // Prepare the output array.
+                auto ret = py::array(tm.dtype(), py::array::ShapeContainer{
+                                                     boost::numeric_cast<py::ssize_t>(eph.get_pl_idxs().size()), 6, n});
+
+                const auto *tm_ptr = static_cast<const double *>(tm.data());
+                auto *ret_ptr = static_cast<double *>(ret.mutable_data());
+
+                {
+                    py::gil_scoped_release release;
+
+                    eph.eval(ret_ptr, tm_ptr, boost::numeric_cast<std::size_t>(n));
+                }
+
+                return ret;
+            },
+            "time"_a)
+        .def_property_readonly("pl_idxs", &eph_t::get_pl_idxs)
+        .def_property_readonly("thresh", &eph_t::get_thresh)
+        .def_property_readonly("frame", [](const eph_t &eph) { return eph.get_icrf() ? "icrf" : "ecliptic"; })
+        .def_property_readonly("batch_size", &eph_t::get_simd_size)
+        // Repr.
+        .def("__repr__",
+             [](const eph_t &eph) {
+                 std::ostringstream oss;
+
+                 oss << "VSOP2013 ephemeris\n";
+                 oss << "Planet indices: [";
+                 for (decltype(eph.get_pl_idxs().size()) i = 0; i < eph.get_pl_idxs().size(); ++i) {
+                     oss << eph.get_pl_idxs()[i];
+                     if (i + 1u != eph.get_pl_idxs().size()) {
+                         oss << ", ";
+                     }
+                 }
+                 oss << "]\n";
+                 oss << fmt::format("Threshold     : {}\n", eph.get_thresh());
+                 oss << fmt::format("Frame         : {}\n", eph.get_icrf() ? "icrf" : "ecliptic");
+
+                 return oss.str();
+             })
+        // Copy/deepcopy.
+        .def("__copy__", copy_wrapper<eph_t>)
+        .def("__deepcopy__", deepcopy_wrapper<eph_t>, "memo"_a)
+        // Pickle support.
+        .def(py::pickle(&pickle_getstate_wrapper<eph_t>, &pickle_setstate_wrapper<eph_t>));
+}
+
+} // namespace heyoka_py
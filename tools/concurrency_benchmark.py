@@ -0,0 +1,109 @@
+# Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+#
+# This file is part of the heyoka.py library.
+#
+# This Source Code Form is subject to the terms of the Mozilla
+# Public License v. 2.0. If a copy of the MPL was not distributed
+# with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+# Benchmark for the scalability of heyoka.py in multithreaded
+# Python code.
+#
+# Usage:
+#
+#   python concurrency_benchmark.py [--nthreads N1,N2,...] [--nreps N]
+#
+# For each number of threads, the script measures the throughput of:
+#
+# - many small evaluations of the same compiled function;
+# - many short propagations of per-thread copies of an integrator.
+#
+# The work is driven by Python threads. With the GIL, the throughput
+# is expected to stay roughly constant as the number of threads grows.
+# NOTE: heyoka.py does not declare support for running without the GIL
+# yet, hence importing it in a free-threaded Python build re-enables the
+# GIL (unless it is explicitly disabled, e.g., via PYTHON_GIL=0). The
+# reported GIL status refers to the moment after the import.
+
+import argparse
+import sys
+import threading
+import time
+
+
+def _run(nthreads, func):
+    barrier = threading.Barrier(nthreads + 1)
+
+    def wrapper(idx):
+        barrier.wait()
+        func(idx)
+
+    threads = [threading.Thread(target=wrapper, args=(i,)) for i in range(nthreads)]
+    for t in threads:
+        t.start()
+
+    barrier.wait()
+    start = time.perf_counter()
+
+    for t in threads:
+        t.join()
+
+    return time.perf_counter() - start
+
+
+def main():
+    from copy import deepcopy
+    import numpy as np
+    from heyoka import make_cfunc, make_vars, sin, cos, par, taylor_adaptive
+
+    parser = argparse.ArgumentParser(description="heyoka.py concurrency benchmark")
+    parser.add_argument("--nthreads", type=str, default="1,2,4,8")
+    parser.add_argument("--nreps", type=int, default=2000)
+    args = parser.parse_args()
+
+    nthreads_list = [int(_) for _ in args.nthreads.split(",")]
+
+    gil_enabled = getattr(sys, "_is_gil_enabled", lambda: True)()
+    print("GIL enabled: {}".format(gil_enabled))
+
+    x, v = make_vars("x", "v")
+
+    cf = make_cfunc([sin(x) * cos(v) + par[0], x - v * par[1]])
+    inputs = np.random.default_rng(42).uniform(size=(2, 32))
+    pars = np.ones((2, 32))
+
+    ta = taylor_adaptive([(x, v), (v, -9.8 * sin(x))], [0.0, 0.25])
+
+    def cf_worker(idx):
+        for _ in range(args.nreps):
+            cf(inputs, pars=pars)
+
+    def ta_worker(idx):
+        local_ta = deepcopy(ta)
+
+        for _ in range(args.nreps // 20):
+            local_ta.time = 0.0
+            local_ta.state[:] = [0.0, 0.25]
+            local_ta.propagate_until(10.0)
+
+    print(
+        "{:>8} {:>20} {:>20}".format(
+            "nthreads", "cfunc (calls/s)", "propagate (calls/s)"
+        )
+    )
+
+    for nthreads in nthreads_list:
+        cf_time = _run(nthreads, cf_worker)
+        ta_time = _run(nthreads, ta_worker)
+
+        print(
+            "{:>8} {:>20.1f} {:>20.1f}".format(
+                nthreads,
+                nthreads * args.nreps / cf_time,
+                nthreads * (args.nreps // 20) / ta_time,
+            )
+        )
+
+
+if __name__ == "__main__":
+    main()
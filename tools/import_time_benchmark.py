@@ -0,0 +1,102 @@
+# Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+#
+# This file is part of the heyoka.py library.
+#
+# This Source Code Form is subject to the terms of the Mozilla
+# Public License v. 2.0. If a copy of the MPL was not distributed
+# with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+# Benchmark for the import time of heyoka.py.
+#
+# Usage:
+#
+#   python import_time_benchmark.py [--nruns N] [--max-time SECONDS]
+#
+# The import of heyoka is timed in fresh interpreters. The script
+# prints the minimum/median wall-clock times and the slowest modules
+# reported by "python -X importtime". If --max-time is provided,
+# the script exits with a nonzero status if the median import time
+# exceeds the given threshold.
+
+import argparse
+import statistics
+import subprocess
+import sys
+import time
+
+
+def _time_import(nruns):
+    ret = []
+
+    for _ in range(nruns):
+        start = time.perf_counter()
+        subprocess.run([sys.executable, "-c", "import heyoka"], check=True)
+        ret.append(time.perf_counter() - start)
+
+    return ret
+
+
+def _baseline(nruns):
+    # Time of an empty interpreter startup, to be subtracted.
+    ret = []
+
+    for _ in range(nruns):
+        start = time.perf_counter()
+        subprocess.run([sys.executable, "-c", "pass"], check=True)
+        ret.append(time.perf_counter() - start)
+
+    return min(ret)
+
+
+def _slowest_modules(n):
+    # Parse the output of -X importtime, which is
+    # written to stderr in the format:
+    # import time: self [us] | cumulative | imported package
+    res = subprocess.run(
+        [sys.executable, "-X", "importtime", "-c", "import heyoka"],
+        check=True,
+        capture_output=True,
+        text=True,
+    )
+
+    entries = []
+    for line in res.stderr.splitlines():
+        if not line.startswith("import time:") or "self [us]" in line:
+            continue
+
+        fields = line[len("import time:") :].split("|")
+        entries.append((int(fields[0]), int(fields[1]), fields[2].rstrip()))
+
+    return sorted(entries, reverse=True)[:n]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="heyoka.py import time benchmark")
+    parser.add_argument("--nruns", type=int, default=10)
+    parser.add_argument("--max-time", type=float, default=None)
+    args = parser.parse_args()
+
+    base = _baseline(args.nruns)
+    times = [_ - base for _ in _time_import(args.nruns)]
+
+    med = statistics.median(times)
+
+    print("Import time (interpreter startup excluded):")
+    print("  min   : {:.3f}s".format(min(times)))
+    print("  median: {:.3f}s".format(med))
+
+    print("\nSlowest modules (self time):")
+    for self_us, cumul_us, name in _slowest_modules(15):
+        print("  {:>10} us {:>10} us  {}".format(self_us, cumul_us, name))
+
+    if args.max_time is not None and med > args.max_time:
+        print(
+            "\nThe median import time ({:.3f}s) exceeds the threshold ({:.3f}s)".format(
+                med, args.max_time
+            )
+        )
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,127 @@
+# Copyright 2020, 2021, 2022 Francesco Biscani (bluescarni@gmail.com), Dario Izzo (dario.izzo@gmail.com)
+#
+# This file is part of the heyoka.py library.
+#
+# This Source Code Form is subject to the terms of the Mozilla
+# Public License v. 2.0. If a copy of the MPL was not distributed
+# with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+# Benchmark for the evaluation of compiled functions
+# in arbitrary precision.
+#
+# Usage:
+#
+#   python real_cfunc_benchmark.py [--nevals N] [--nreps N] [--precs P1,P2,...]
+#
+# For each precision, the script measures, with inputs and parameters
+# which are not contiguous in memory (so that they are copied through
+# the evaluation buffers):
+#
+# - the time per evaluation in a single call with many evaluations;
+# - the time per call in many calls with a single evaluation each;
+# - the time per pair of calls in many pairs of calls with a single
+#   evaluation each, alternating between the function and another
+#   function with a different precision.
+#
+# The last timing is compared to the sum of the times per call of the
+# two functions when they are invoked without alternating precisions.
+# A ratio close to 1 indicates that alternating precisions does not
+# incur any penalty in the management of the evaluation buffers.
+
+import argparse
+import time
+
+
+def _make_inputs(nvars, nevals, prec):
+    import numpy as np
+    from heyoka import real
+
+    # NOTE: make the arrays non-contiguous by taking
+    # every other column.
+    ret = np.empty((nvars, 2 * nevals), dtype=real)
+
+    for i in range(nvars):
+        for j in range(2 * nevals):
+            ret[i, j] = real(1 + i + j / (2 * nevals), prec)
+
+    return ret[:, ::2]
+
+
+def _best_time(nreps, func):
+    best = float("inf")
+    for _ in range(nreps):
+        start = time.perf_counter()
+        func()
+        best = min(best, time.perf_counter() - start)
+
+    return best
+
+
+def main():
+    from heyoka import make_cfunc, make_vars, real, sin, cos, par
+
+    parser = argparse.ArgumentParser(
+        description="heyoka.py arbitrary-precision cfunc benchmark"
+    )
+    parser.add_argument("--nevals", type=int, default=1000)
+    parser.add_argument("--nreps", type=int, default=10)
+    parser.add_argument("--precs", type=str, default="128,256,512,1024")
+    args = parser.parse_args()
+
+    precs = [int(_) for _ in args.precs.split(",")]
+
+    xs = make_vars(*["x{}".format(i) for i in range(8)])
+    func = [sin(xs[i]) * cos(xs[(i + 1) % 8]) + par[i] for i in range(8)]
+
+    # Many calls with a single evaluation each.
+    def calls(fn, in1, pars1):
+        for _ in range(args.nevals):
+            fn(in1, pars=pars1)
+
+    # The function used in the calls with alternating precisions.
+    alt_prec = 53
+    alt_fn = make_cfunc(func, vars=list(xs), fp_type=real, prec=alt_prec)
+    alt_in1 = _make_inputs(8, 1, alt_prec)[:, 0]
+    alt_pars1 = _make_inputs(8, 1, alt_prec)[:, 0]
+    alt_call_time = _best_time(args.nreps, lambda: calls(alt_fn, alt_in1, alt_pars1))
+
+    print(
+        "{:>6} {:>16} {:>18} {:>20} {:>7}".format(
+            "prec", "eval (us/eval)", "1-eval call (us)", "alt. prec pair (us)", "ratio"
+        )
+    )
+
+    for prec in precs:
+        fn = make_cfunc(func, vars=list(xs), fp_type=real, prec=prec)
+
+        inputs = _make_inputs(8, args.nevals, prec)
+        pars = _make_inputs(8, args.nevals, prec)
+        in1 = inputs[:, 0]
+        pars1 = pars[:, 0]
+
+        # Batched evaluations through the buffers.
+        eval_time = _best_time(args.nreps, lambda: fn(inputs, pars=pars))
+
+        call_time = _best_time(args.nreps, lambda: calls(fn, in1, pars1))
+
+        # Pairs of calls alternating precisions.
+        def alt_calls():
+            for _ in range(args.nevals):
+                fn(in1, pars=pars1)
+                alt_fn(alt_in1, pars=alt_pars1)
+
+        alt_time = _best_time(args.nreps, alt_calls)
+
+        print(
+            "{:>6} {:>16.3f} {:>18.3f} {:>20.3f} {:>7.3f}".format(
+                prec,
+                eval_time / args.nevals * 1e6,
+                call_time / args.nevals * 1e6,
+                alt_time / args.nevals * 1e6,
+                alt_time / (call_time + alt_call_time),
+            )
+        )
+
+
+if __name__ == "__main__":
+    main()